@@ -0,0 +1,402 @@
+/*
+ Asynchronous and parallel formatting for the C++ format library
+
+ Copyright (c) 2012, Victor Zverovich
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice, this
+    list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "async.h"
+
+#if FMT_USE_ASYNC
+
+#include <stdint.h>
+
+#include <chrono>
+#include <cstring>
+
+using std::size_t;
+using fmt::internal::AsyncRecord;
+using fmt::internal::MessageRecord;
+using fmt::internal::RecordQueue;
+using fmt::internal::ThreadPool;
+
+namespace {
+
+// The consumer waits this long for a notification before checking the
+// queue again, so a lost wakeup can only delay the output.
+const int MAX_WAIT_MS = 100;
+
+// The number of times the consumer checks for new records before waiting.
+const int NUM_SPINS = 64;
+
+inline size_t Align(size_t offset, size_t alignment) {
+  return (offset + alignment - 1) & ~(alignment - 1);
+}
+}
+
+RecordQueue::RecordQueue(size_t capacity)
+: mask_(0), data_(0), head_(0), tail_(0), sleeping_(false), notified_(false) {
+  size_t num_blocks = 2;
+  while (num_blocks * BLOCK_SIZE < capacity)
+    num_blocks *= 2;
+  mask_ = num_blocks - 1;
+  blocks_.reset(new Block[num_blocks]);
+  for (size_t i = 0; i < num_blocks; ++i)
+    blocks_[i].seq.store(0, std::memory_order_relaxed);
+  storage_.reset(new char[num_blocks * BLOCK_SIZE + BLOCK_SIZE]);
+  data_ = storage_.get() + Align(
+      reinterpret_cast<uintptr_t>(storage_.get()), BLOCK_SIZE) -
+      reinterpret_cast<uintptr_t>(storage_.get());
+}
+
+char *RecordQueue::Reserve(size_t size, size_t &pos) {
+  size_t num_blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  size_t capacity = mask_ + 1;
+  // A record together with the padding before it should fit into an
+  // empty queue.
+  if (num_blocks > capacity / 2)
+    fmt::internal::ReportError("format arguments don't fit into the queue");
+  size_t head = head_.load(std::memory_order_relaxed);
+  size_t padding = 0;
+  for (;;) {
+    size_t index = head & mask_;
+    padding = index + num_blocks > capacity ? capacity - index : 0;
+    size_t end = head + padding + num_blocks;
+    if (end - tail_.load(std::memory_order_acquire) > capacity) {
+      // The queue is full, let the consumer catch up.
+      Notify();
+      std::this_thread::yield();
+      head = head_.load(std::memory_order_relaxed);
+      continue;
+    }
+    if (head_.compare_exchange_weak(head, end, std::memory_order_relaxed))
+      break;
+  }
+  if (padding != 0) {
+    Block &block = blocks_[head & mask_];
+    block.num_blocks = padding;
+    block.padding = true;
+    block.seq.store(head + 1, std::memory_order_release);
+    head += padding;
+  }
+  Block &block = blocks_[head & mask_];
+  block.num_blocks = num_blocks;
+  block.padding = false;
+  pos = head;
+  return data_ + (head & mask_) * BLOCK_SIZE;
+}
+
+void RecordQueue::Commit(size_t pos) {
+  blocks_[pos & mask_].seq.store(pos + 1, std::memory_order_release);
+  // Pairs with the fence in Wait: either the consumer sees the record
+  // or this thread sees that the consumer is sleeping.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleeping_.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    wake_.notify_one();
+  }
+}
+
+char *RecordQueue::Front() {
+  for (;;) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    Block &block = blocks_[pos & mask_];
+    if (block.seq.load(std::memory_order_acquire) != pos + 1)
+      return 0;
+    if (!block.padding)
+      return data_ + (pos & mask_) * BLOCK_SIZE;
+    tail_.store(pos + block.num_blocks, std::memory_order_release);
+  }
+}
+
+void RecordQueue::Pop() {
+  size_t pos = tail_.load(std::memory_order_relaxed);
+  tail_.store(pos + blocks_[pos & mask_].num_blocks,
+      std::memory_order_release);
+}
+
+void RecordQueue::Wait() {
+  for (int i = 0; i < NUM_SPINS; ++i) {
+    if (Front()) return;
+    std::this_thread::yield();
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  sleeping_.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (!notified_ && !Front())
+    wake_.wait_for(lock, std::chrono::milliseconds(MAX_WAIT_MS));
+  sleeping_.store(false, std::memory_order_relaxed);
+  notified_ = false;
+}
+
+void RecordQueue::Notify() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  notified_ = true;
+  wake_.notify_one();
+}
+
+// A record consists of a header followed by copies of the arguments,
+// pointers to operations on the arguments of custom types and the data
+// of strings and custom arguments.
+struct AsyncRecord::Header {
+  const char *format;
+  const fmt::CompiledFormat *compiled_format;
+  unsigned num_args;
+};
+
+void AsyncRecord::DoPush(RecordQueue &queue, const char *format,
+    const fmt::CompiledFormat *compiled_format, const Arg *args,
+    const CustomOps *const *ops, size_t *sizes, unsigned num_args) {
+  size_t ops_offset = Align(sizeof(Header), alignof(Arg)) +
+      num_args * sizeof(Arg);
+  size_t data_offset = ops_offset + num_args * sizeof(const CustomOps*);
+  size_t size = data_offset;
+  for (unsigned i = 0; i < num_args; ++i) {
+    const Arg &arg = args[i];
+    if (arg.type == Formatter::STRING) {
+      if (!arg.string.value) continue;
+      size_t length = arg.string.size;
+      if (length == 0)
+        length = std::strlen(arg.string.value);
+      sizes[i] = length;
+      size += length + 1;
+    } else if (arg.type == Formatter::CUSTOM) {
+      size = Align(size, ops[i]->alignment) + ops[i]->size;
+    }
+  }
+
+  size_t pos = 0;
+  char *record = queue.Reserve(size, pos);
+  Header *header = new (record) Header;
+  header->format = format;
+  header->compiled_format = compiled_format;
+  header->num_args = num_args;
+  Arg *arg_copies = reinterpret_cast<Arg*>(
+      record + Align(sizeof(Header), alignof(Arg)));
+  const CustomOps **ops_copies =
+      reinterpret_cast<const CustomOps**>(record + ops_offset);
+  size_t offset = data_offset;
+  unsigned i = 0;
+#if FMT_EXCEPTIONS
+  try {
+#endif
+    for (; i < num_args; ++i) {
+      Arg *arg = new (arg_copies + i) Arg(args[i]);
+      ops_copies[i] = 0;
+      if (arg->type == Formatter::STRING && arg->string.value) {
+        char *data = record + offset;
+        std::memcpy(data, arg->string.value, sizes[i]);
+        data[sizes[i]] = '\0';
+        arg->string.value = data;
+        arg->string.size = sizes[i];
+        offset += sizes[i] + 1;
+      } else if (arg->type == Formatter::CUSTOM) {
+        offset = Align(offset, ops[i]->alignment);
+        ops[i]->copy(record + offset, arg->custom.value);
+        arg->custom.value = record + offset;
+        ops_copies[i] = ops[i];
+        offset += ops[i]->size;
+      }
+    }
+#if FMT_EXCEPTIONS
+  } catch (...) {
+    // A copy constructor has thrown. The reserved record still has to be
+    // committed for the consumer to proceed, so make it empty.
+    for (unsigned j = 0; j < i; ++j) {
+      if (ops_copies[j])
+        ops_copies[j]->destroy(const_cast<void*>(arg_copies[j].custom.value));
+    }
+    header->format = "";
+    header->compiled_format = 0;
+    header->num_args = 0;
+    queue.Commit(pos);
+    throw;
+  }
+#endif
+  queue.Commit(pos);
+}
+
+void AsyncRecord::Format(Formatter &f, char *record) {
+  const Header *header = reinterpret_cast<const Header*>(record);
+  unsigned num_args = header->num_args;
+  size_t args_offset = Align(sizeof(Header), alignof(Arg));
+  Arg *args = reinterpret_cast<Arg*>(record + args_offset);
+  const CustomOps *const *ops = reinterpret_cast<const CustomOps**>(
+      record + args_offset + num_args * sizeof(Arg));
+
+  // Destroys the copies of the arguments when formatting is complete
+  // or fails.
+  struct ArgDestroyer {
+    Arg *args;
+    const CustomOps *const *ops;
+    unsigned num_args;
+
+    ~ArgDestroyer() {
+      for (unsigned i = 0; i < num_args; ++i) {
+        if (ops[i])
+          ops[i]->destroy(const_cast<void*>(args[i].custom.value));
+        args[i].~Arg();
+      }
+    }
+  } destroyer = {args, ops, num_args};
+
+  f.ClearArgs();
+  for (unsigned i = 0; i < num_args; ++i)
+    f.Add(args[i]);
+#if FMT_EXCEPTIONS
+  size_t size = f.size();
+  try {
+#endif
+    if (const fmt::CompiledFormat *compiled_format = header->compiled_format) {
+      f.format_ = 0;
+      f.compiled_format_ = compiled_format;
+      f.DoFormat(*compiled_format);
+    } else {
+      f.format_ = header->format;
+      f.compiled_format_ = 0;
+      f.DoFormat();
+    }
+#if FMT_EXCEPTIONS
+  } catch (...) {
+    f.buffer_.resize(size);
+    throw;
+  }
+#endif
+}
+
+// A message record consists of a header followed by the message unless
+// the message is too large for the queue.
+struct MessageRecord::Header {
+  std::size_t size;
+  char *data;  // Dynamically allocated message or null.
+};
+
+void MessageRecord::Push(RecordQueue &queue, const char *data, size_t size) {
+  size_t record_size = sizeof(Header) + size;
+  char *copy = 0;
+  if (record_size > queue.capacity() / 4) {
+    // Leave room for other records, the message is passed by pointer.
+    copy = new char[size];
+    std::memcpy(copy, data, size);
+    record_size = sizeof(Header);
+  }
+  size_t pos = 0;
+  char *record = queue.Reserve(record_size, pos);
+  Header *header = new (record) Header;
+  header->size = size;
+  header->data = copy;
+  if (!copy)
+    std::memcpy(record + sizeof(Header), data, size);
+  queue.Commit(pos);
+}
+
+void MessageRecord::Format(fmt::Formatter &f, char *record) {
+  const Header *header = reinterpret_cast<const Header*>(record);
+  if (char *data = header->data) {
+    std::unique_ptr<char[]> guard(data);
+    f << fmt::StringRef(data, header->size);
+  } else {
+    f << fmt::StringRef(record + sizeof(Header), header->size);
+  }
+}
+
+ThreadPool::ThreadPool(unsigned num_threads)
+: task_(0), data_(0), generation_(0), num_running_(0), stop_(false) {
+  for (unsigned i = 1; i < num_threads; ++i)
+    threads_.push_back(std::thread(&ThreadPool::Work, this, i));
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  start_.notify_all();
+  for (size_t i = 0, n = threads_.size(); i != n; ++i)
+    threads_[i].join();
+}
+
+void ThreadPool::RunTask(Task task, void *data, unsigned thread_index) {
+#if FMT_EXCEPTIONS
+  try {
+    task(data, thread_index);
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!error_)
+      error_ = std::current_exception();
+  }
+#else
+  task(data, thread_index);
+#endif
+}
+
+void ThreadPool::Work(unsigned thread_index) {
+  size_t generation = 0;
+  for (;;) {
+    Task task = 0;
+    void *data = 0;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (!stop_ && generation_ == generation)
+        start_.wait(lock);
+      if (stop_) return;
+      generation = generation_;
+      task = task_;
+      data = data_;
+    }
+    RunTask(task, data, thread_index);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--num_running_ == 0)
+      done_.notify_one();
+  }
+}
+
+void ThreadPool::Run(Task task, void *data) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task_ = task;
+    data_ = data;
+    ++generation_;
+    num_running_ = static_cast<unsigned>(threads_.size());
+  }
+  start_.notify_all();
+  RunTask(task, data, 0);
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (num_running_ != 0)
+    done_.wait(lock);
+#if FMT_EXCEPTIONS
+  if (error_) {
+    std::exception_ptr e = error_;
+    error_ = std::exception_ptr();
+    std::rethrow_exception(e);
+  }
+#endif
+}
+
+fmt::ParallelFormatter::ParallelFormatter(unsigned num_threads)
+: pool_(num_threads != 0 ? num_threads :
+        std::max(std::thread::hardware_concurrency(), 1u)),
+  formatters_(new Formatter[pool_.num_threads()]) {}
+
+#endif  // FMT_USE_ASYNC
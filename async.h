@@ -0,0 +1,657 @@
+/*
+ Asynchronous and parallel formatting for the C++ format library
+
+ Copyright (c) 2012, Victor Zverovich
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice, this
+    list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef FORMAT_ASYNC_H_
+#define FORMAT_ASYNC_H_
+
+#include "format.h"
+
+// Asynchronous formatting requires threads and atomics from C++11.
+#ifndef FMT_USE_ASYNC
+# if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#  define FMT_USE_ASYNC 1
+# else
+#  define FMT_USE_ASYNC 0
+# endif
+#endif
+
+#if FMT_USE_ASYNC
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace format {
+
+namespace internal {
+
+// A bounded lock-free queue of variable-size records with multiple
+// producers and a single consumer. The storage is divided into blocks
+// and a record occupies one or more consecutive blocks. A producer
+// reserves blocks by advancing the head position with compare-and-swap
+// and publishes a record by storing its position in the sequence number
+// of the first block. A record that would wrap around the end of the
+// storage is preceded by a padding record that fills the remaining blocks.
+class RecordQueue {
+ private:
+  enum { BLOCK_SIZE = 64 };
+
+  struct Block {
+    std::atomic<std::size_t> seq;  // Position + 1 of a committed record.
+    std::size_t num_blocks;
+    bool padding;
+  };
+
+  std::size_t mask_;
+  std::unique_ptr<Block[]> blocks_;
+  std::unique_ptr<char[]> storage_;
+  char *data_;  // storage_ aligned to BLOCK_SIZE.
+
+  // The head is advanced by producers and the tail by the consumer.
+  // They are kept on different cache lines to avoid false sharing.
+  char pad0_[BLOCK_SIZE];
+  std::atomic<std::size_t> head_;
+  char pad1_[BLOCK_SIZE];
+  std::atomic<std::size_t> tail_;
+  char pad2_[BLOCK_SIZE];
+
+  // Wakes up the consumer waiting for records.
+  std::atomic<bool> sleeping_;
+  bool notified_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+
+  // Do not implement!
+  RecordQueue(const RecordQueue &);
+  void operator=(const RecordQueue &);
+
+ public:
+  // Constructs a queue with the storage of at least capacity bytes.
+  explicit RecordQueue(std::size_t capacity);
+
+  // Returns the storage size in bytes.
+  std::size_t capacity() const { return (mask_ + 1) * BLOCK_SIZE; }
+
+  // Returns the position past the last reserved record.
+  std::size_t head() const { return head_.load(); }
+
+  // Returns the position of the first record that hasn't been popped.
+  std::size_t tail() const { return tail_.load(); }
+
+  // Reserves storage for a record of the given size waiting while the
+  // queue is full. Returns a pointer to the storage aligned to BLOCK_SIZE
+  // and stores the record position in pos.
+  char *Reserve(std::size_t size, std::size_t &pos);
+
+  // Makes the record at the position pos available to the consumer.
+  void Commit(std::size_t pos);
+
+  // Returns the oldest record or null if it hasn't been committed yet.
+  // Can only be called by the consumer.
+  char *Front();
+
+  // Removes the record returned by Front.
+  void Pop();
+
+  // Waits until a record is committed or Notify is called.
+  void Wait();
+
+  // Wakes up the consumer.
+  void Notify();
+};
+
+// Captures format arguments into records of RecordQueue and formats
+// them. Strings and objects of custom types are copied into the record,
+// so the arguments need not outlive the call.
+class AsyncRecord {
+ private:
+  typedef Formatter::Arg Arg;
+
+  // Operations on an argument of a custom type copied into a record.
+  struct CustomOps {
+    std::size_t size;
+    std::size_t alignment;
+    void (*copy)(void *dst, const void *src);
+    void (*destroy)(void *p);
+  };
+
+  template <typename T>
+  struct CustomOpsFor {
+    static void Copy(void *dst, const void *src) {
+      new (dst) T(*static_cast<const T*>(src));
+    }
+    static void Destroy(void *p) { static_cast<T*>(p)->~T(); }
+    static const CustomOps OPS;
+  };
+
+  struct Header;
+
+  static void DoPush(RecordQueue &queue, const char *format,
+      const CompiledFormat *compiled_format, const Arg *args,
+      const CustomOps *const *ops, std::size_t *sizes, unsigned num_args);
+
+ public:
+  // Copies a format and arguments into a new record of the queue.
+  template <typename... Args>
+  static void Push(RecordQueue &queue, const char *format,
+      const CompiledFormat *compiled_format, const Args &... args) {
+    // The trailing argument avoids a zero-size array and is not captured.
+    const Arg arg_array[] = {args..., 0};
+    const CustomOps *ops[] = {
+      &CustomOpsFor<typename std::decay<Args>::type>::OPS..., 0
+    };
+    std::size_t sizes[sizeof...(Args) + 1];
+    DoPush(queue, format, compiled_format, arg_array, ops, sizes,
+           static_cast<unsigned>(sizeof...(Args)));
+  }
+
+  // Formats a record appending the output to f and destroys the copies
+  // of the arguments. On error the output of the record is discarded.
+  static void Format(Formatter &f, char *record);
+};
+
+template <typename T>
+const AsyncRecord::CustomOps AsyncRecord::CustomOpsFor<T>::OPS = {
+  sizeof(T), alignof(T), &CustomOpsFor<T>::Copy, &CustomOpsFor<T>::Destroy
+};
+
+// A fixed set of threads that run a task together with the calling thread.
+class ThreadPool {
+ public:
+  typedef void (*Task)(void *data, unsigned thread_index);
+
+ private:
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+  Task task_;
+  void *data_;
+  std::size_t generation_;  // Incremented when a new task is started.
+  unsigned num_running_;
+  bool stop_;
+  std::exception_ptr error_;
+
+  // Do not implement!
+  ThreadPool(const ThreadPool &);
+  void operator=(const ThreadPool &);
+
+  // Runs the task and stores the first error it throws.
+  void RunTask(Task task, void *data, unsigned thread_index);
+
+  void Work(unsigned thread_index);
+
+ public:
+  // Constructs a pool of num_threads threads including the calling one.
+  explicit ThreadPool(unsigned num_threads);
+  ~ThreadPool();
+
+  unsigned num_threads() const {
+    return static_cast<unsigned>(threads_.size()) + 1;
+  }
+
+  // Runs task(data, i) for each thread index i in [0, num_threads()),
+  // index 0 on the calling thread, and waits for all of them to complete.
+  // Rethrows the first error if any.
+  void Run(Task task, void *data);
+};
+
+// Copies formatted messages into records of RecordQueue. A message that
+// doesn't fit into a record is copied to dynamically allocated memory.
+class MessageRecord {
+ private:
+  struct Header;
+
+ public:
+  // Copies a message into a new record of the queue.
+  static void Push(RecordQueue &queue, const char *data, std::size_t size);
+
+  // Appends the message of a record to f.
+  static void Format(Formatter &f, char *record);
+};
+
+// A background thread that converts records of a queue to text with
+// a function such as AsyncRecord::Format and passes the text to Output
+// in batches.
+template <typename Output>
+class SinkWorker {
+ public:
+  typedef void (*FormatFunc)(Formatter &f, char *record);
+
+ private:
+  RecordQueue queue_;
+  Output output_;
+  FormatFunc format_;
+  std::atomic<bool> stop_;
+  std::mutex mutex_;
+  std::condition_variable flushed_;
+  std::size_t written_;  // Position up to which the output is written.
+  std::exception_ptr error_;
+  std::thread thread_;
+
+  // Do not implement!
+  SinkWorker(const SinkWorker &);
+  void operator=(const SinkWorker &);
+
+  // Stores the first error to be reported by Flush.
+  void SetError() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!error_)
+      error_ = std::current_exception();
+  }
+
+  void Write(Formatter &f) {
+#if FMT_EXCEPTIONS
+    try {
+      output_(f.data(), f.size());
+    } catch (...) {
+      SetError();
+    }
+#else
+    output_(f.data(), f.size());
+#endif
+    f.Clear();
+  }
+
+  // Formats queued records until the worker is destroyed.
+  void Run() {
+    Formatter f;
+    for (;;) {
+      // Records committed before stop_ is set are visible after it is read.
+      bool stop = stop_.load();
+      while (char *record = queue_.Front()) {
+#if FMT_EXCEPTIONS
+        try {
+          format_(f, record);
+        } catch (...) {
+          SetError();
+        }
+#else
+        format_(f, record);
+#endif
+        queue_.Pop();
+        if (f.size() >= MAX_BATCH_SIZE)
+          Write(f);
+      }
+      if (f.size() != 0)
+        Write(f);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        written_ = queue_.tail();
+      }
+      flushed_.notify_all();
+      if (stop) break;
+      queue_.Wait();
+    }
+  }
+
+ public:
+  enum {
+    MAX_BATCH_SIZE = 4096  // Output size passed to Output at once.
+  };
+
+  SinkWorker(Output output, std::size_t capacity, FormatFunc format)
+  : queue_(capacity), output_(output), format_(format), stop_(false),
+    written_(0), thread_(&SinkWorker::Run, this) {}
+
+  ~SinkWorker() {
+    stop_.store(true);
+    queue_.Notify();
+    thread_.join();
+  }
+
+  RecordQueue &queue() { return queue_; }
+
+  const Output &output() const { return output_; }
+
+  // Waits until all records queued before the call are formatted and
+  // their output is passed to the output function. Throws the first
+  // error that occurred since the previous call, if any.
+  void Flush() {
+    std::size_t pos = queue_.head();
+    queue_.Notify();
+    std::unique_lock<std::mutex> lock(mutex_);
+    // Positions only grow, so the difference handles wrap-around.
+    while (static_cast<std::ptrdiff_t>(written_ - pos) < 0)
+      flushed_.wait(lock);
+#if FMT_EXCEPTIONS
+    if (error_) {
+      std::exception_ptr e = error_;
+      error_ = std::exception_ptr();
+      std::rethrow_exception(e);
+    }
+#endif
+  }
+};
+}
+
+/**
+  \rst
+  A sink that formats on a background thread. A call to :meth:`Format`
+  only copies the format string pointer and the arguments into a
+  lock-free queue; a worker thread owned by the sink formats queued
+  records in the order they were submitted and passes the output to
+  *Output*, a function object taking ``const char*`` and ``std::size_t``
+  such as :cpp:class:`format::FileOutput`. :meth:`Format` can be called
+  from multiple threads and waits while the queue is full.
+
+  Strings and objects of custom types are copied, so they need not outlive
+  the call, but custom types should be copy-constructible and their
+  ``Format`` function should be safe to call from the worker thread.
+  Format strings are not copied and should remain valid until formatted,
+  for example, be string literals.
+
+  **Example**::
+
+    fmt::AsyncSink<fmt::FileOutput> log((fmt::FileOutput(stderr)));
+    log.Format("{0}: {1}\n", "error", 42);
+    log.Flush();
+
+  Errors that occur when formatting or writing the output are reported
+  by :meth:`Flush`. Remaining records are formatted on destruction
+  ignoring errors.
+  \endrst
+*/
+template <typename Output>
+class AsyncSink {
+ private:
+  internal::SinkWorker<Output> worker_;
+
+  // Do not implement!
+  AsyncSink(const AsyncSink &);
+  void operator=(const AsyncSink &);
+
+ public:
+  enum {
+    DEFAULT_CAPACITY = 1 << 16,
+    MAX_BATCH_SIZE = internal::SinkWorker<Output>::MAX_BATCH_SIZE
+  };
+
+  /**
+    \rst
+    Constructs a sink with a queue of at least *capacity* bytes and starts
+    the worker thread.
+    \endrst
+  */
+  explicit AsyncSink(Output output = Output(),
+      std::size_t capacity = DEFAULT_CAPACITY)
+  : worker_(output, capacity, &internal::AsyncRecord::Format) {}
+
+  /**
+    \rst
+    Queues a format string and arguments for formatting on the worker
+    thread.
+    \endrst
+  */
+  template <typename... Args>
+  void Format(const char *format, const Args &... args) {
+    internal::AsyncRecord::Push(worker_.queue(), format, 0, args...);
+  }
+
+  /**
+    \rst
+    Queues arguments for formatting with a precompiled format. The format
+    object should outlive the formatting.
+    \endrst
+  */
+  template <typename... Args>
+  void Format(const CompiledFormat &format, const Args &... args) {
+    internal::AsyncRecord::Push(worker_.queue(), 0, &format, args...);
+  }
+
+  /**
+    \rst
+    Waits until all records queued before the call are formatted and
+    their output is passed to the output function. Throws the first
+    error that occurred since the previous call, if any.
+    \endrst
+  */
+  void Flush() { worker_.Flush(); }
+
+  /**
+    \rst
+    Returns the output function object. It is only safe to access after
+    :meth:`Flush`.
+    \endrst
+  */
+  const Output &output() const { return worker_.output(); }
+};
+
+/**
+  \rst
+  A sink for printing from many threads without a lock. :meth:`Print`
+  formats a message on the calling thread into the buffer of a
+  temporary formatter like :cpp:func:`format::Print`. When formatting is
+  complete the message is copied into a lock-free queue in one piece,
+  and a worker thread owned by the sink passes queued messages to
+  *Output*, a function object taking ``const char*`` and ``std::size_t``
+  such as :cpp:class:`format::FdOutput`, in batches in the order they
+  were completed. Messages are never interleaved.
+
+  **Example**::
+
+    static fmt::ConcurrentSink<fmt::FdOutput> out((fmt::FdOutput(1)));
+    // On any thread:
+    out.Print("{0}: {1}\n") << thread_name << status;
+
+  Unlike with :cpp:class:`format::AsyncSink`, arguments are formatted
+  before :meth:`Print` returns, so they need not be copyable or outlive
+  the call. Errors that occur when writing the output are reported by
+  :meth:`Flush`. Remaining messages are written on destruction ignoring
+  errors.
+  \endrst
+*/
+template <typename Output>
+class ConcurrentSink {
+ private:
+  internal::SinkWorker<Output> worker_;
+
+  // A formatting action that queues the output of a formatter.
+  class PushAction {
+   private:
+    internal::RecordQueue *queue_;
+
+   public:
+    explicit PushAction(internal::RecordQueue *queue) : queue_(queue) {}
+
+    void operator()(const BasicFormatter &f) const {
+      internal::MessageRecord::Push(*queue_, f.data(), f.size());
+    }
+  };
+
+  // Do not implement!
+  ConcurrentSink(const ConcurrentSink &);
+  void operator=(const ConcurrentSink &);
+
+ public:
+  enum { DEFAULT_CAPACITY = 1 << 16 };
+
+  /**
+    \rst
+    Constructs a sink with a queue of at least *capacity* bytes and starts
+    the worker thread.
+    \endrst
+  */
+  explicit ConcurrentSink(Output output = Output(),
+      std::size_t capacity = DEFAULT_CAPACITY)
+  : worker_(output, capacity, &internal::MessageRecord::Format) {}
+
+  /**
+    \rst
+    Formats a string and queues the output when formatting is complete.
+    Arguments are accepted via operator ``<<``.
+    \endrst
+  */
+  TempFormatter<PushAction> Print(StringRef format) {
+    return TempFormatter<PushAction>(format, PushAction(&worker_.queue()));
+  }
+
+  /**
+    \rst
+    Formats arguments using a precompiled format and queues the output
+    when formatting is complete.
+    \endrst
+  */
+  TempFormatter<PushAction> Print(const CompiledFormat &format) {
+    return TempFormatter<PushAction>(format, PushAction(&worker_.queue()));
+  }
+
+  /**
+    \rst
+    Waits until all messages queued before the call are passed to the
+    output function. Throws the first error that occurred since the
+    previous call, if any.
+    \endrst
+  */
+  void Flush() { worker_.Flush(); }
+
+  /**
+    \rst
+    Returns the output function object. It is only safe to access after
+    :meth:`Flush`.
+    \endrst
+  */
+  const Output &output() const { return worker_.output(); }
+};
+
+/**
+  \rst
+  A formatter that splits rows of columnar data into chunks and formats
+  them in parallel on a pool of threads.
+
+  **Example**::
+
+    std::vector<int> ids = ...;
+    std::vector<double> values = ...;
+    fmt::ParallelFormatter pf;
+    fmt::FileOutput out(file);
+    static const fmt::CompiledFormat format("{0},{1:.3f}\n");
+    pf.FormatRows(out, format, ids.size(), ids.data(), values.data());
+  \endrst
+*/
+class ParallelFormatter {
+ private:
+  internal::ThreadPool pool_;
+  std::unique_ptr<Formatter[]> formatters_;  // Per-thread chunk buffers.
+
+  template <typename FormatRow>
+  struct Job {
+    FormatRow &format_row;
+    Formatter *formatters;
+    std::size_t start;
+    std::size_t num_rows;
+    std::size_t rows_per_thread;
+
+    static void Run(void *data, unsigned thread_index) {
+      Job &job = *static_cast<Job*>(data);
+      Formatter &f = job.formatters[thread_index];
+      f.Clear();
+      std::size_t begin = job.start + thread_index * job.rows_per_thread;
+      std::size_t end = std::min(begin + job.rows_per_thread, job.num_rows);
+      for (std::size_t row = begin; row < end; ++row)
+        job.format_row(f, row);
+    }
+  };
+
+  template <typename Output, typename FormatRow>
+  void Run(Output &output, std::size_t num_rows, FormatRow &format_row);
+
+  // Do not implement!
+  ParallelFormatter(const ParallelFormatter &);
+  void operator=(const ParallelFormatter &);
+
+ public:
+  // The maximum number of rows formatted by a thread at once.
+  enum { ROWS_PER_CHUNK = 1024 };
+
+  /**
+    \rst
+    Constructs a formatter that uses *num_threads* threads including the
+    calling one. If *num_threads* is 0, the number of hardware threads
+    is used.
+    \endrst
+  */
+  explicit ParallelFormatter(unsigned num_threads = 0);
+
+  /**
+    \rst
+    Returns the number of threads used for formatting.
+    \endrst
+  */
+  unsigned num_threads() const { return pool_.num_threads(); }
+
+  /**
+    \rst
+    Formats *num_rows* rows with a precompiled format where the arguments
+    of row ``i`` are ``columns[i]...`` and passes the output to *output*,
+    a function object taking ``const char*`` and ``std::size_t``, in the
+    order of rows. The output of a chunk of rows is passed at once, so
+    *output* is called from the calling thread far fewer times than
+    there are rows. The first error that occurs in any thread is rethrown
+    when the chunks being formatted are complete, in which case only the
+    output of the preceding chunks is passed to *output*.
+    \endrst
+  */
+  template <typename Output, typename... Columns>
+  void FormatRows(Output &output, const CompiledFormat &format,
+                  std::size_t num_rows, const Columns *... columns) {
+    auto format_row = [&](Formatter &f, std::size_t row) {
+      f.FormatArgs(format, columns[row]...);
+    };
+    Run(output, num_rows, format_row);
+  }
+};
+
+template <typename Output, typename FormatRow>
+void ParallelFormatter::Run(
+    Output &output, std::size_t num_rows, FormatRow &format_row) {
+  unsigned num_threads = pool_.num_threads();
+  std::size_t rows_per_thread = (num_rows + num_threads - 1) / num_threads;
+  if (rows_per_thread > ROWS_PER_CHUNK)
+    rows_per_thread = ROWS_PER_CHUNK;
+  Job<FormatRow> job = {format_row, formatters_.get(), 0, num_rows,
+                        rows_per_thread};
+  while (job.start < num_rows) {
+    pool_.Run(&Job<FormatRow>::Run, &job);
+    for (unsigned i = 0; i < num_threads; ++i) {
+      if (formatters_[i].size() != 0)
+        output(formatters_[i].data(), formatters_[i].size());
+    }
+    job.start += rows_per_thread * num_threads;
+  }
+}
+}
+
+#endif  // FMT_USE_ASYNC
+
+#endif  // FORMAT_ASYNC_H_
@@ -0,0 +1,315 @@
+/*
+ Binary logging for the C++ format library
+
+ Copyright (c) 2012, Victor Zverovich
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice, this
+    list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "binlog.h"
+
+using std::size_t;
+using fmt::internal::BinaryBuffer;
+using fmt::internal::BinaryRecord;
+using fmt::internal::FormatIdMap;
+
+namespace {
+
+template <typename T>
+inline void Put(BinaryBuffer &buffer, const T &value) {
+  const char *p = reinterpret_cast<const char*>(&value);
+  buffer.append(p, p + sizeof(T));
+}
+
+inline void PutTag(BinaryBuffer &buffer, BinaryRecord::Tag tag) {
+  buffer.push_back(static_cast<char>(tag));
+}
+
+inline void PutString(BinaryBuffer &buffer, const char *s, size_t size) {
+  Put(buffer, static_cast<uint32_t>(size));
+  buffer.append(s, s + size);
+}
+
+// Reads a value returning false if there is not enough data.
+template <typename T>
+inline bool Get(const char *&p, const char *end, T &value) {
+  if (static_cast<size_t>(end - p) < sizeof(T))
+    return false;
+  std::memcpy(&value, p, sizeof(T));
+  p += sizeof(T);
+  return true;
+}
+
+FMT_NORETURN void ReportInvalidRecord() {
+  fmt::internal::ReportError("invalid binary log record");
+}
+
+// Returns the index at which to start looking for a format in a hash
+// table of the given size which is a power of 2.
+inline size_t GetSlot(const char *format, size_t size) {
+  uintptr_t p = reinterpret_cast<uintptr_t>(format);
+  p = (p ^ (p >> 16)) * 0x45d9f3b;
+  return (p ^ (p >> 16)) & (size - 1);
+}
+}
+
+void FormatIdMap::Grow() {
+  std::vector<Entry> entries(entries_.empty() ? 16 : entries_.size() * 2);
+  entries.swap(entries_);
+  size_t mask = entries_.size() - 1;
+  for (size_t i = 0, n = entries.size(); i != n; ++i) {
+    if (!entries[i].format) continue;
+    size_t slot = GetSlot(entries[i].format, entries_.size());
+    while (entries_[slot].format)
+      slot = (slot + 1) & mask;
+    entries_[slot] = entries[i];
+  }
+}
+
+unsigned FormatIdMap::Find(const char *format, bool &is_new) {
+  // Keep the table at most half full.
+  if (2 * (size_ + 1) > entries_.size())
+    Grow();
+  size_t mask = entries_.size() - 1;
+  size_t slot = GetSlot(format, entries_.size());
+  for (; entries_[slot].format; slot = (slot + 1) & mask) {
+    if (entries_[slot].format == format) {
+      is_new = false;
+      return entries_[slot].id;
+    }
+  }
+  entries_[slot].format = format;
+  entries_[slot].id = size_;
+  is_new = true;
+  return size_++;
+}
+
+void BinaryRecord::DoEncode(BinaryBuffer &buffer, Formatter &scratch,
+    unsigned format_id, const Arg *args, unsigned num_args) {
+  if (num_args > MAX_ARGS)
+    fmt::internal::ReportError("too many arguments for binary log");
+  size_t start = buffer.size();
+#if FMT_EXCEPTIONS
+  try {
+#endif
+    buffer.push_back(static_cast<char>(ARG_RECORD));
+    Put(buffer, static_cast<uint32_t>(format_id));
+    buffer.push_back(static_cast<char>(num_args));
+    for (unsigned i = 0; i < num_args; ++i) {
+      const Arg &arg = args[i];
+      switch (arg.type) {
+      case Formatter::INT:
+        PutTag(buffer, INT_TAG);
+        Put(buffer, arg.int_value);
+        break;
+      case Formatter::UINT:
+        PutTag(buffer, UINT_TAG);
+        Put(buffer, arg.uint_value);
+        break;
+      case Formatter::LONG:
+        PutTag(buffer, LONG_TAG);
+        Put(buffer, arg.long_value);
+        break;
+      case Formatter::ULONG:
+        PutTag(buffer, ULONG_TAG);
+        Put(buffer, arg.ulong_value);
+        break;
+      case Formatter::LONG_LONG:
+        PutTag(buffer, LONG_LONG_TAG);
+        Put(buffer, arg.long_long_value);
+        break;
+      case Formatter::ULONG_LONG:
+        PutTag(buffer, ULONG_LONG_TAG);
+        Put(buffer, arg.ulong_long_value);
+        break;
+      case Formatter::DOUBLE:
+        PutTag(buffer, DOUBLE_TAG);
+        Put(buffer, arg.double_value);
+        break;
+      case Formatter::LONG_DOUBLE:
+        PutTag(buffer, LONG_DOUBLE_TAG);
+        Put(buffer, arg.long_double_value);
+        break;
+      case Formatter::CHAR:
+        PutTag(buffer, CHAR_TAG);
+        buffer.push_back(static_cast<char>(arg.int_value));
+        break;
+      case Formatter::STRING:
+        PutTag(buffer, STRING_TAG);
+        PutString(buffer, arg.string.value, Formatter::GetStringSize(arg));
+        break;
+      case Formatter::POINTER:
+        PutTag(buffer, POINTER_TAG);
+        Put(buffer, arg.pointer_value);
+        break;
+      case Formatter::CUSTOM:
+        scratch.Clear();
+        (scratch.*arg.custom.format)(arg.custom.value, FormatSpec());
+        PutTag(buffer, STRING_TAG);
+        PutString(buffer, scratch.data(), scratch.size());
+        break;
+      }
+    }
+#if FMT_EXCEPTIONS
+  } catch (...) {
+    buffer.resize(start);
+    throw;
+  }
+#else
+  (void)start;
+#endif
+}
+
+size_t BinaryRecord::Format(
+    Formatter &f, const CompiledFormat &format, const char *data, size_t size) {
+  const char *p = data, *end = data + size;
+  unsigned char num_args = 0;
+  if (!Get(p, end, num_args))
+    return 0;
+  f.ClearArgs();
+  for (unsigned i = 0; i < num_args; ++i) {
+    unsigned char tag = 0;
+    if (!Get(p, end, tag))
+      return 0;
+    switch (tag) {
+    case INT_TAG: {
+      int value = 0;
+      if (!Get(p, end, value)) return 0;
+      f.Add(Arg(value));
+      break;
+    }
+    case UINT_TAG: {
+      unsigned value = 0;
+      if (!Get(p, end, value)) return 0;
+      f.Add(Arg(value));
+      break;
+    }
+    case LONG_TAG: {
+      long value = 0;
+      if (!Get(p, end, value)) return 0;
+      f.Add(Arg(value));
+      break;
+    }
+    case ULONG_TAG: {
+      unsigned long value = 0;
+      if (!Get(p, end, value)) return 0;
+      f.Add(Arg(value));
+      break;
+    }
+    case LONG_LONG_TAG: {
+      fmt::internal::LongLong value = 0;
+      if (!Get(p, end, value)) return 0;
+      f.Add(Arg(value));
+      break;
+    }
+    case ULONG_LONG_TAG: {
+      fmt::internal::ULongLong value = 0;
+      if (!Get(p, end, value)) return 0;
+      f.Add(Arg(value));
+      break;
+    }
+    case DOUBLE_TAG: {
+      double value = 0;
+      if (!Get(p, end, value)) return 0;
+      f.Add(Arg(value));
+      break;
+    }
+    case LONG_DOUBLE_TAG: {
+      long double value = 0;
+      if (!Get(p, end, value)) return 0;
+      f.Add(Arg(value));
+      break;
+    }
+    case CHAR_TAG: {
+      char value = 0;
+      if (!Get(p, end, value)) return 0;
+      f.Add(Arg(value));
+      break;
+    }
+    case STRING_TAG: {
+      uint32_t length = 0;
+      if (!Get(p, end, length) || static_cast<size_t>(end - p) < length)
+        return 0;
+      f.Add(Arg(fmt::StringRef(p, length)));
+      p += length;
+      break;
+    }
+    case POINTER_TAG: {
+      const void *value = 0;
+      if (!Get(p, end, value)) return 0;
+      f.Add(Arg(value));
+      break;
+    }
+    default:
+      ReportInvalidRecord();
+    }
+  }
+
+  f.format_ = 0;
+  f.compiled_format_ = 0;
+#if FMT_EXCEPTIONS
+  size_t start = f.size();
+  try {
+    f.DoFormat(format);
+  } catch (...) {
+    f.buffer_.resize(start);
+    throw;
+  }
+#else
+  f.DoFormat(format);
+#endif
+  return p - data;
+}
+
+size_t fmt::BinaryLogDecoder::Decode(
+    const char *data, size_t size, Formatter &f) {
+  const char *p = data, *end = data + size;
+  const char *decoded = data;  // The end of the last complete record.
+  while (p != end) {
+    char type = *p++;
+    if (type != BinaryRecord::FORMAT_RECORD &&
+        type != BinaryRecord::ARG_RECORD) {
+      ReportInvalidRecord();
+    }
+    uint32_t id = 0;
+    if (!Get(p, end, id))
+      break;
+    if (type == BinaryRecord::FORMAT_RECORD) {
+      uint32_t length = 0;
+      if (!Get(p, end, length) || static_cast<size_t>(end - p) < length)
+        break;
+      if (id != formats_.size())
+        ReportInvalidRecord();
+      formats_.push_back(fmt::CompiledFormat(std::string(p, length)));
+      p += length;
+    } else {
+      if (id >= formats_.size())
+        fmt::internal::ReportError("unknown format ID in binary log");
+      size_t n = BinaryRecord::Format(f, formats_[id], p, end - p);
+      if (n == 0)
+        break;
+      p += n;
+    }
+    decoded = p;
+  }
+  return decoded - data;
+}
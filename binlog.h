@@ -0,0 +1,268 @@
+/*
+ Binary logging for the C++ format library
+
+ Copyright (c) 2012, Victor Zverovich
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice, this
+    list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef FORMAT_BINLOG_H_
+#define FORMAT_BINLOG_H_
+
+#include <stdint.h>
+#include <cstring>
+
+#include "format.h"
+
+namespace format {
+
+namespace internal {
+
+typedef Array<char, 1024> BinaryBuffer;
+
+// Assigns sequential IDs to format strings identified by their addresses.
+class FormatIdMap {
+ private:
+  struct Entry {
+    const char *format;
+    unsigned id;
+  };
+
+  std::vector<Entry> entries_;  // An open addressing hash table.
+  unsigned size_;
+
+  void Grow();
+
+ public:
+  FormatIdMap() : size_(0) {}
+
+  // Returns the number of registered formats.
+  unsigned size() const { return size_; }
+
+  // Returns the ID of a format string registering it if it is new.
+  unsigned Find(const char *format, bool &is_new);
+};
+
+// Encodes formatting arguments into binary log records and formats
+// decoded records.
+//
+// A log is a sequence of records in native byte order. A format record
+// consisting of the byte 'F', the format ID (uint32) and the length
+// (uint32) and characters of the format string precedes the first
+// argument record using the format. An argument record consists of the
+// byte 'A', the format ID (uint32), the number of arguments (uint8) and
+// for each argument a tag byte followed by the raw bytes of the value.
+// Strings are stored as the length (uint32) followed by the characters.
+// Objects of custom types are formatted and stored as strings.
+class BinaryRecord {
+ private:
+  typedef Formatter::Arg Arg;
+
+  static void DoEncode(BinaryBuffer &buffer, Formatter &scratch,
+      unsigned format_id, const Arg *args, unsigned num_args);
+
+ public:
+  enum {
+    FORMAT_RECORD = 'F',
+    ARG_RECORD = 'A',
+    MAX_ARGS = 255
+  };
+
+  // Argument tags. They are part of the stored format and should not
+  // be reordered.
+  enum Tag {
+    INT_TAG, UINT_TAG, LONG_TAG, ULONG_TAG, DOUBLE_TAG, LONG_DOUBLE_TAG,
+    CHAR_TAG, STRING_TAG, POINTER_TAG, LONG_LONG_TAG, ULONG_LONG_TAG
+  };
+
+#if FMT_USE_VARIADIC_TEMPLATES
+  // Appends an argument record to the buffer. scratch is used to format
+  // objects of custom types.
+  template <typename... Args>
+  static void Encode(BinaryBuffer &buffer, Formatter &scratch,
+                     unsigned format_id, const Args &... args) {
+    // The trailing argument avoids a zero-size array and is not encoded.
+    const Arg arg_array[] = {args..., 0};
+    DoEncode(buffer, scratch, format_id, arg_array,
+             static_cast<unsigned>(sizeof...(Args)));
+  }
+#endif
+
+  // Formats the arguments of a record of the given size starting after
+  // the format ID with the compiled format and appends the output to f.
+  // Returns the number of bytes read or 0 if the record is incomplete.
+  static std::size_t Format(Formatter &f, const CompiledFormat &format,
+                            const char *data, std::size_t size);
+};
+}
+
+#if FMT_USE_VARIADIC_TEMPLATES
+/**
+  \rst
+  A log that stores formatting arguments in a compact binary form instead
+  of formatting them. Each format string is written once together with
+  its ID and each record only contains the ID and the raw bytes of the
+  arguments, so logging doesn't spend time converting values to text.
+  Records are buffered and passed to *Output*, a function object taking
+  ``const char*`` and ``std::size_t``, once the buffer size reaches the
+  threshold. :cpp:class:`format::BinaryLogDecoder` turns a log back into
+  text.
+
+  **Example**::
+
+    fmt::BinaryLog<fmt::FileOutput> log((fmt::FileOutput(file)));
+    log.Log("{0}: {1:.3f}\n", "latency", 0.25);
+
+  Format strings are identified by their addresses, so they should not
+  be modified or freed while the log exists, for example, be string
+  literals. Records use native byte order and type sizes, so a log should
+  be decoded on the same platform.
+  \endrst
+*/
+template <typename Output>
+class BinaryLog {
+ private:
+  internal::FormatIdMap ids_;
+  internal::BinaryBuffer buffer_;
+  Formatter scratch_;
+  Output output_;
+  std::size_t flush_threshold_;
+
+  // Do not implement!
+  BinaryLog(const BinaryLog &);
+  void operator=(const BinaryLog &);
+
+  void WriteFormatRecord(const char *format, unsigned id);
+
+ public:
+  enum { DEFAULT_FLUSH_THRESHOLD = 4096 };
+
+  explicit BinaryLog(Output output = Output(),
+      std::size_t flush_threshold = DEFAULT_FLUSH_THRESHOLD)
+  : output_(output), flush_threshold_(flush_threshold) {}
+
+  ~BinaryLog() {
+#if FMT_EXCEPTIONS
+    try {
+      Flush();
+    } catch (...) {}
+#else
+    Flush();
+#endif
+  }
+
+  /**
+    \rst
+    Writes a record with a format string and arguments. The buffer is
+    flushed if its size reaches the threshold.
+    \endrst
+  */
+  template <typename... Args>
+  void Log(const char *format, const Args &... args) {
+    bool is_new = false;
+    unsigned id = ids_.Find(format, is_new);
+    if (is_new)
+      WriteFormatRecord(format, id);
+    internal::BinaryRecord::Encode(buffer_, scratch_, id, args...);
+    if (buffer_.size() >= flush_threshold_)
+      Flush();
+  }
+
+  /**
+    \rst
+    Returns the number of buffered bytes that haven't been passed to the
+    output yet.
+    \endrst
+  */
+  std::size_t size() const { return buffer_.size(); }
+
+  /**
+    \rst
+    Returns the output function object.
+    \endrst
+  */
+  const Output &output() const { return output_; }
+
+  /**
+    \rst
+    Passes the buffered records to the output function and clears the
+    buffer.
+    \endrst
+  */
+  void Flush() {
+    if (buffer_.size() == 0) return;
+    output_(&buffer_[0], buffer_.size());
+    buffer_.clear();
+  }
+};
+
+template <typename Output>
+void BinaryLog<Output>::WriteFormatRecord(const char *format, unsigned id) {
+  uint32_t header[2] = {id, static_cast<uint32_t>(std::strlen(format))};
+  char tag = internal::BinaryRecord::FORMAT_RECORD;
+  buffer_.append(&tag, &tag + 1);
+  const char *p = reinterpret_cast<const char*>(header);
+  buffer_.append(p, p + sizeof(header));
+  buffer_.append(format, format + header[1]);
+}
+#endif
+
+/**
+  \rst
+  A decoder that formats records written by :cpp:class:`format::BinaryLog`
+  through the normal formatting code.
+
+  **Example**::
+
+    fmt::BinaryLogDecoder decoder;
+    fmt::Formatter f;
+    std::size_t n = decoder.Decode(data, size, f);
+    // f contains the text of the complete records in the first n bytes.
+  \endrst
+*/
+class BinaryLogDecoder {
+ private:
+  // Formats are compiled once when their records are read so that
+  // argument records don't go through the format cache keyed by address.
+  std::vector<CompiledFormat> formats_;
+
+ public:
+  /**
+    \rst
+    Decodes and formats records from [*data*, *data* + *size*) appending
+    the text to *f*. Returns the number of bytes of the complete records
+    decoded; the rest should be passed again with more data. Throws
+    :cpp:class:`format::FormatError` if the data is not a valid log.
+    \endrst
+  */
+  std::size_t Decode(const char *data, std::size_t size, Formatter &f);
+
+  /**
+    \rst
+    Returns the number of format strings read so far.
+    \endrst
+  */
+  std::size_t num_formats() const { return formats_.size(); }
+};
+}
+
+#endif  // FORMAT_BINLOG_H_
@@ -38,13 +38,67 @@
 
 #include <cassert>
 #include <cctype>
+#include <cerrno>
 #include <climits>
+#include <clocale>
+#include <cstdlib>
 #include <cstring>
 #include <algorithm>
+#include <limits>
+
+#ifdef _WIN32
+# include <io.h>
+# define FMT_POSIX(call) _##call
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/uio.h>
+# include <unistd.h>
+# define FMT_POSIX(call) call
+#endif
+
+// Literal text in format strings is scanned with SSE2 when available.
+#ifndef FMT_USE_SSE2
+# if defined(__SSE2__) || defined(_M_X64) || \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define FMT_USE_SSE2 1
+# else
+#  define FMT_USE_SSE2 0
+# endif
+#endif
+
+#if FMT_USE_SSE2
+# include <emmintrin.h>
+# ifdef _MSC_VER
+#  include <intrin.h>
+# endif
+#endif
+
+// Formatting operations are timed with the processor's cycle counter
+// when collecting statistics.
+#if FMT_USE_FORMAT_STATS
+# if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#  include <intrin.h>
+#  define FMT_RDTSC() __rdtsc()
+# elif defined(__x86_64__) || defined(__i386__)
+#  include <x86intrin.h>
+#  define FMT_RDTSC() __rdtsc()
+# else
+#  include <chrono>
+# endif
+#endif
+
+// The SSE2 scanner reads whole aligned blocks that may extend past the
+// end of a format string, which is safe but reported by sanitizers.
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 8)
+# define FMT_NO_SANITIZE __attribute__((no_sanitize("address", "thread")))
+#else
+# define FMT_NO_SANITIZE
+#endif
 
 using std::size_t;
-using fmt::BasicFormatter;
-using fmt::Formatter;
+using fmt::BasicWriter;
+using fmt::GenericFormatter;
 using fmt::FormatSpec;
 using fmt::StringRef;
 
@@ -54,6 +108,33 @@ char Case<uppercase>::lookup[16] =  { '0', '1', '2', '3', '4', '5', '6', '7', '8
 
 char Case<lowercase>::lookup[16] =  { '0', '1', '2', '3', '4', '5', '6', '7', '8',
 									'9', 'a', 'b', 'c', 'd', 'e', 'f'};
+
+const char Case<lowercase>::pairs[] =
+  "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+  "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+  "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+  "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+  "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+  "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+  "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+  "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+const char Case<uppercase>::pairs[] =
+  "000102030405060708090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F"
+  "202122232425262728292A2B2C2D2E2F303132333435363738393A3B3C3D3E3F"
+  "404142434445464748494A4B4C4D4E4F505152535455565758595A5B5C5D5E5F"
+  "606162636465666768696A6B6C6D6E6F707172737475767778797A7B7C7D7E7F"
+  "808182838485868788898A8B8C8D8E8F909192939495969798999A9B9C9D9E9F"
+  "A0A1A2A3A4A5A6A7A8A9AAABACADAEAFB0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+  "C0C1C2C3C4C5C6C7C8C9CACBCCCDCECFD0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+  "E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEFF0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
+
+const char Digits<oct>::pairs[] =
+  "0001020304050607101112131415161720212223242526273031323334353637"
+  "4041424344454647505152535455565760616263646566677071727374757677";
+
+const char Digits<bin>::quads[] =
+  "0000000100100011010001010110011110001001101010111100110111101111";
 }}
 
 #if _MSC_VER
@@ -64,17 +145,73 @@ char Case<lowercase>::lookup[16] =  { '0', '1', '2', '3', '4', '5', '6', '7', '8
 
 namespace {
 
-// Flags.
-enum { SIGN_FLAG = 1, PLUS_FLAG = 2, HASH_FLAG = 4 };
+// Flags. RAW_DIGITS_FLAG is internal and makes FormatLongDouble keep the
+// output of snprintf as is.
+enum { SIGN_FLAG = 1, PLUS_FLAG = 2, HASH_FLAG = 4, RAW_DIGITS_FLAG = 8 };
+
+typedef fmt::sprint::Digits<fmt::sprint::hex> HexDigits;
+typedef fmt::sprint::Digits<fmt::sprint::oct> OctDigits;
+
+// Returns a pointer to the first '{', '}' or terminating null character
+// in s.
+template <typename Char>
+inline const Char *FindBrace(const Char *s) {
+  while (*s && *s != '{' && *s != '}')
+    ++s;
+  return s;
+}
+
+#if FMT_USE_SSE2
+inline unsigned CountTrailingZeros(unsigned n) {
+# ifdef _MSC_VER
+  unsigned long index = 0;
+  _BitScanForward(&index, n);
+  return index;
+# else
+  return __builtin_ctz(n);
+# endif
+}
+
+// Returns a mask of the bytes of a block that are '{', '}' or null.
+inline unsigned MatchBraces(__m128i block) {
+  __m128i matches = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('{')),
+                   _mm_cmpeq_epi8(block, _mm_set1_epi8('}'))),
+      _mm_cmpeq_epi8(block, _mm_setzero_si128()));
+  return static_cast<unsigned>(_mm_movemask_epi8(matches));
+}
+
+// Checks 16 characters at a time. Loads are aligned, so a block never
+// crosses a page boundary even if it extends past the terminating null.
+FMT_NO_SANITIZE inline const char *FindBrace(const char *s) {
+  std::size_t offset = reinterpret_cast<uintptr_t>(s) & 15;
+  const __m128i *p = reinterpret_cast<const __m128i*>(s - offset);
+  // Ignore the characters preceding s in the first block.
+  unsigned mask = MatchBraces(_mm_load_si128(p)) >> offset;
+  if (mask != 0)
+    return s + CountTrailingZeros(mask);
+  for (;;) {
+    mask = MatchBraces(_mm_load_si128(++p));
+    if (mask != 0)
+      return reinterpret_cast<const char*>(p) + CountTrailingZeros(mask);
+  }
+}
+#endif
 
-void ReportUnknownType(char code, const char *type) {
+// Error messages are built in a buffer of this size without allocating
+// memory, so that reporting an error doesn't fail or take long.
+enum { MAX_ERROR_MESSAGE_SIZE = 256 };
+
+FMT_NORETURN void ReportUnknownType(char code, const char *type) {
+  char message[MAX_ERROR_MESSAGE_SIZE];
   if (std::isprint(static_cast<unsigned char>(code))) {
-    throw fmt::FormatError(
-        str(fmt::Format("unknown format code '{0}' for {1}") << code << type));
+    snprintf(message, sizeof(message),
+        "unknown format code '%c' for %s", code, type);
+  } else {
+    snprintf(message, sizeof(message), "unknown format code '\\x%02x' for %s",
+        static_cast<unsigned>(code), type);
   }
-  throw fmt::FormatError(
-      str(fmt::Format("unknown format code '\\x{0:02x}' for {1}")
-        << static_cast<unsigned>(code) << type));
+  fmt::internal::ReportError(message);
 }
 
 // Information about an integer type.
@@ -96,13 +233,41 @@ struct IntTraits<long> {
   static bool IsNegative(long value) { return value < 0; }
 };
 
+template <>
+struct IntTraits<fmt::internal::LongLong> {
+  typedef fmt::internal::ULongLong UnsignedType;
+  static bool IsNegative(fmt::internal::LongLong value) { return value < 0; }
+};
+
 template <typename T>
 struct IsLongDouble { enum {VALUE = 0}; };
 
 template <>
 struct IsLongDouble<long double> { enum {VALUE = 1}; };
 
+#if defined(__GNUC__) || defined(__clang__)
+# define FMT_BUILTIN_CLZLL(n) __builtin_clzll(n)
+#endif
+
+#ifdef FMT_BUILTIN_CLZLL
+// 0 followed by powers of 10 from 10^1 to 10^19 used by CountDigits.
+const uint64_t ZERO_OR_POWERS_OF_10_64[] = {
+  0, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+  1000000000, 10000000000ull, 100000000000ull, 1000000000000ull,
+  10000000000000ull, 100000000000000ull, 1000000000000000ull,
+  10000000000000000ull, 100000000000000000ull, 1000000000000000000ull,
+  10000000000000000000ull
+};
+#endif
+
 inline unsigned CountDigits(uint64_t n) {
+#ifdef FMT_BUILTIN_CLZLL
+  // Compute an approximation of log10(n) from the bit length of n as
+  // bits * log10(2) ~ bits * 1233 / 4096 and correct it using the table
+  // instead of looping over digits.
+  unsigned t = (64 - FMT_BUILTIN_CLZLL(n | 1)) * 1233 >> 12;
+  return t - (n < ZERO_OR_POWERS_OF_10_64[t]) + 1;
+#else
   unsigned count = 1;
   for (;;) {
     // Integer division is slow so do it for a group of four digits instead
@@ -115,6 +280,7 @@ inline unsigned CountDigits(uint64_t n) {
     n /= 10000u;
     count += 4;
   }
+#endif
 }
 
 const char DIGITS[] =
@@ -124,40 +290,140 @@ const char DIGITS[] =
     "6061626364656667686970717273747576777879"
     "8081828384858687888990919293949596979899";
 
-void FormatDecimal(char *buffer, uint64_t value, unsigned num_digits) {
+// Writes exactly 8 decimal digits of value which should be less than 10^8.
+template <typename Char>
+inline void FormatEightDigits(Char *buffer, uint32_t value) {
+  uint32_t high = value / 10000, low = value % 10000;
+  unsigned index = (high / 100) * 2;
+  buffer[0] = DIGITS[index];
+  buffer[1] = DIGITS[index + 1];
+  index = (high % 100) * 2;
+  buffer[2] = DIGITS[index];
+  buffer[3] = DIGITS[index + 1];
+  index = (low / 100) * 2;
+  buffer[4] = DIGITS[index];
+  buffer[5] = DIGITS[index + 1];
+  index = (low % 100) * 2;
+  buffer[6] = DIGITS[index];
+  buffer[7] = DIGITS[index + 1];
+}
+
+template <typename Char>
+void FormatDecimal(Char *buffer, uint64_t value, unsigned num_digits) {
+  // Division of 64-bit integers is much slower than of 32-bit ones, so
+  // split off groups of 8 digits and convert them with 32-bit arithmetic.
+  while (value > 0xffffffffu) {
+    num_digits -= 8;
+    FormatEightDigits(buffer + num_digits,
+        static_cast<uint32_t>(value % 100000000));
+    value /= 100000000;
+  }
+  uint32_t n = static_cast<uint32_t>(value);
   --num_digits;
-  while (value >= 100) {
+  while (n >= 100) {
     // Integer division is slow so do it for a group of two digits instead
     // of for every digit. The idea comes from the talk by Alexandrescu
     // "Three Optimization Tips for C++". See speed-test for a comparison.
-    unsigned index = (value % 100) * 2;
-    value /= 100;
+    unsigned index = (n % 100) * 2;
+    n /= 100;
     buffer[num_digits] = DIGITS[index + 1];
     buffer[num_digits - 1] = DIGITS[index];
     num_digits -= 2;
   }
-  if (value < 10) {
-    *buffer = static_cast<char>('0' + value);
+  if (n < 10) {
+    *buffer = static_cast<Char>('0' + n);
     return;
   }
-  unsigned index = static_cast<unsigned>(value * 2);
+  unsigned index = n * 2;
   buffer[1] = DIGITS[index + 1];
   buffer[0] = DIGITS[index];
 }
 
+// Returns the number of thousands separators for num_digits digits.
+inline unsigned CountSeparators(unsigned num_digits, const FormatSpec &spec) {
+  return spec.thousands_sep && num_digits > 3 ? (num_digits - 1) / 3 : 0;
+}
+
+// Returns the number of integer digits of a number with num_digits
+// significant integer digits and size other characters including the
+// zeros padding it to the width. As in Python, zero padding of a number
+// with thousands separators is grouped too, so the output may be one
+// character wider than the width to avoid a leading separator.
+inline unsigned CountPaddedDigits(
+    unsigned num_digits, unsigned size, const FormatSpec &spec) {
+  if (!spec.thousands_sep || spec.fill != '0' ||
+      spec.align != fmt::ALIGN_NUMERIC || spec.width <= size + num_digits) {
+    return num_digits;
+  }
+  // The smallest number of digits n such that n + (n - 1) / 3 >= width.
+  unsigned width = spec.width - size;
+  return std::max(num_digits, width - (width - 1) / 4);
+}
+
+// Inserts num_seps separators between groups of three digits of
+// [buffer, buffer + num_digits) counting from the end. The buffer should
+// have room for num_digits + num_seps characters.
+template <typename Char>
+void GroupDigits(Char *buffer, unsigned num_digits, unsigned num_seps,
+                 char sep) {
+  Char *src = buffer + num_digits, *dst = src + num_seps;
+  for (; num_seps != 0; --num_seps) {
+    *--dst = *--src;
+    *--dst = *--src;
+    *--dst = *--src;
+    *--dst = static_cast<Char>(sep);
+  }
+}
+
 // Fills the padding around the content and returns the pointer to the
 // content area.
-char *FillPadding(char *buffer,
-    unsigned total_size, std::size_t content_size, char fill) {
+template <typename Char>
+Char *FillPadding(Char *buffer,
+    unsigned total_size, std::size_t content_size, wchar_t fill) {
   std::size_t padding = total_size - content_size;
   std::size_t left_padding = padding / 2;
-  std::fill_n(buffer, left_padding, fill);
+  Char fill_char = static_cast<Char>(fill);
+  std::fill_n(buffer, left_padding, fill_char);
   buffer += left_padding;
-  char *content = buffer;
-  std::fill_n(buffer + content_size, padding - left_padding, fill);
+  Char *content = buffer;
+  std::fill_n(buffer + content_size, padding - left_padding, fill_char);
   return content;
 }
 
+// Returns the number of characters written by FormatInt for value
+// without formatting it.
+template <typename T>
+std::size_t CountIntChars(T value, const FormatSpec &spec) {
+  typedef typename IntTraits<T>::UnsignedType UnsignedType;
+  UnsignedType abs_value = value;
+  unsigned size = 0;
+  if (IntTraits<T>::IsNegative(value)) {
+    ++size;
+    abs_value = 0 - abs_value;
+  } else if ((spec.flags & SIGN_FLAG) != 0) {
+    ++size;
+  }
+  switch (spec.type) {
+  case 0: case 'd': {
+    unsigned num_digits = CountPaddedDigits(CountDigits(abs_value), size, spec);
+    size += num_digits + CountSeparators(num_digits, spec);
+    break;
+  }
+  case 'x': case 'X':
+    if ((spec.flags & HASH_FLAG) != 0) size += 2;
+    size += HexDigits::count(abs_value);
+    break;
+  case 'o':
+    if ((spec.flags & HASH_FLAG) != 0) ++size;
+    size += OctDigits::count(abs_value);
+    break;
+  default:
+    ReportUnknownType(spec.type, "integer");
+    break;
+  }
+  return std::max<std::size_t>(size, spec.width);
+}
+
 #ifdef _MSC_VER
 int signbit(double value) {
   if (value < 0) return 1;
@@ -167,21 +433,543 @@ int signbit(double value) {
   return sign;
 }
 #endif
+
+const uint32_t POWERS_OF_10_32[] = {
+  1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+// Normalized 64-bit significands of cached powers of 10 from 1e-348 to 1e340
+// with a step of 8 used by the Grisu algorithm.
+const uint64_t POW10_SIGNIFICANDS[] = {
+  0xfa8fd5a0081c0288ull, 0xbaaee17fa23ebf76ull, 0x8b16fb203055ac76ull,
+  0xcf42894a5dce35eaull, 0x9a6bb0aa55653b2dull, 0xe61acf033d1a45dfull,
+  0xab70fe17c79ac6caull, 0xff77b1fcbebcdc4full, 0xbe5691ef416bd60cull,
+  0x8dd01fad907ffc3cull, 0xd3515c2831559a83ull, 0x9d71ac8fada6c9b5ull,
+  0xea9c227723ee8bcbull, 0xaecc49914078536dull, 0x823c12795db6ce57ull,
+  0xc21094364dfb5637ull, 0x9096ea6f3848984full, 0xd77485cb25823ac7ull,
+  0xa086cfcd97bf97f4ull, 0xef340a98172aace5ull, 0xb23867fb2a35b28eull,
+  0x84c8d4dfd2c63f3bull, 0xc5dd44271ad3cdbaull, 0x936b9fcebb25c996ull,
+  0xdbac6c247d62a584ull, 0xa3ab66580d5fdaf6ull, 0xf3e2f893dec3f126ull,
+  0xb5b5ada8aaff80b8ull, 0x87625f056c7c4a8bull, 0xc9bcff6034c13053ull,
+  0x964e858c91ba2655ull, 0xdff9772470297ebdull, 0xa6dfbd9fb8e5b88full,
+  0xf8a95fcf88747d94ull, 0xb94470938fa89bcfull, 0x8a08f0f8bf0f156bull,
+  0xcdb02555653131b6ull, 0x993fe2c6d07b7facull, 0xe45c10c42a2b3b06ull,
+  0xaa242499697392d3ull, 0xfd87b5f28300ca0eull, 0xbce5086492111aebull,
+  0x8cbccc096f5088ccull, 0xd1b71758e219652cull, 0x9c40000000000000ull,
+  0xe8d4a51000000000ull, 0xad78ebc5ac620000ull, 0x813f3978f8940984ull,
+  0xc097ce7bc90715b3ull, 0x8f7e32ce7bea5c70ull, 0xd5d238a4abe98068ull,
+  0x9f4f2726179a2245ull, 0xed63a231d4c4fb27ull, 0xb0de65388cc8ada8ull,
+  0x83c7088e1aab65dbull, 0xc45d1df942711d9aull, 0x924d692ca61be758ull,
+  0xda01ee641a708deaull, 0xa26da3999aef774aull, 0xf209787bb47d6b85ull,
+  0xb454e4a179dd1877ull, 0x865b86925b9bc5c2ull, 0xc83553c5c8965d3dull,
+  0x952ab45cfa97a0b3ull, 0xde469fbd99a05fe3ull, 0xa59bc234db398c25ull,
+  0xf6c69a72a3989f5cull, 0xb7dcbf5354e9beceull, 0x88fcf317f22241e2ull,
+  0xcc20ce9bd35c78a5ull, 0x98165af37b2153dfull, 0xe2a0b5dc971f303aull,
+  0xa8d9d1535ce3b396ull, 0xfb9b7cd9a4a7443cull, 0xbb764c4ca7a44410ull,
+  0x8bab8eefb6409c1aull, 0xd01fef10a657842cull, 0x9b10a4e5e9913129ull,
+  0xe7109bfba19c0c9dull, 0xac2820d9623bf429ull, 0x80444b5e7aa7cf85ull,
+  0xbf21e44003acdd2dull, 0x8e679c2f5e44ff8full, 0xd433179d9c8cb841ull,
+  0x9e19db92b4e31ba9ull, 0xeb96bf6ebadf77d9ull, 0xaf87023b9bf0ee6bull
+};
+
+// Binary exponents of cached powers of 10 corresponding to significands
+// in POW10_SIGNIFICANDS.
+const int16_t POW10_EXPONENTS[] = {
+  -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954,
+  -927, -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635,
+  -608, -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316,
+  -289, -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30, 56,
+  83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348, 375, 402, 428, 455,
+  481, 508, 534, 561, 588, 614, 641, 667, 694, 720, 747, 774, 800, 827, 853,
+  880, 907, 933, 960, 986, 1013, 1039, 1066
+};
+
+// A floating-point number f * pow(2, e) with a 64-bit significand.
+struct DiyFp {
+  uint64_t f;
+  int e;
+
+  DiyFp(uint64_t f = 0, int e = 0) : f(f), e(e) {}
+};
+
+const int DOUBLE_SIGNIFICAND_SIZE = 52;
+const uint64_t DOUBLE_HIDDEN_BIT = static_cast<uint64_t>(1) << 52;
+const int DOUBLE_EXPONENT_BIAS = 0x3FF + DOUBLE_SIGNIFICAND_SIZE;
+const int DOUBLE_MIN_EXPONENT = 1 - DOUBLE_EXPONENT_BIAS;
+
+// Decomposes a finite positive double into an integer significand and
+// a binary exponent.
+DiyFp Decompose(double value) {
+  uint64_t bits = 0;
+  std::memcpy(&bits, &value, sizeof(value));
+  uint64_t f = bits & (DOUBLE_HIDDEN_BIT - 1);
+  int biased_e = static_cast<int>(bits >> DOUBLE_SIGNIFICAND_SIZE);
+  if (biased_e == 0)
+    return DiyFp(f, DOUBLE_MIN_EXPONENT);  // Denormal.
+  return DiyFp(f + DOUBLE_HIDDEN_BIT, biased_e - DOUBLE_EXPONENT_BIAS);
+}
+
+DiyFp Normalize(DiyFp value) {
+  const uint64_t top_bit = static_cast<uint64_t>(1) << 63;
+  const uint64_t top_11_bits = ~static_cast<uint64_t>(0) << 53;
+  while ((value.f & top_11_bits) == 0) {
+    value.f <<= 11;
+    value.e -= 11;
+  }
+  while ((value.f & top_bit) == 0) {
+    value.f <<= 1;
+    --value.e;
+  }
+  return value;
+}
+
+// Returns a * b with the result significand rounded to 64 bits.
+DiyFp Multiply(DiyFp a, DiyFp b) {
+  const uint64_t mask = 0xffffffff;
+  uint64_t a_hi = a.f >> 32, a_lo = a.f & mask;
+  uint64_t b_hi = b.f >> 32, b_lo = b.f & mask;
+  uint64_t hi_lo = a_hi * b_lo, lo_hi = a_lo * b_hi;
+  uint64_t mid = ((a_lo * b_lo) >> 32) + (hi_lo & mask) + (lo_hi & mask);
+  mid += 1u << 31;  // Round.
+  return DiyFp(a_hi * b_hi + (hi_lo >> 32) + (lo_hi >> 32) + (mid >> 32),
+      a.e + b.e + 64);
+}
+
+// Grisu works with scaled numbers whose binary exponent is in the range
+// [MIN_TARGET_EXPONENT, MAX_TARGET_EXPONENT] so that the integral part
+// fits in 32 bits.
+enum { MIN_TARGET_EXPONENT = -60, MAX_TARGET_EXPONENT = -32 };
+
+// Returns a cached power of ten c = 10^pow10_exponent such that
+// MIN_TARGET_EXPONENT <= c.e + w.e + 64 <= MAX_TARGET_EXPONENT.
+DiyFp GetCachedPower(const DiyFp &w, int &pow10_exponent) {
+  const int64_t one_over_log2_10 = 0x4d104d42;  // 2^32 / log2(10)
+  int min_exponent = MIN_TARGET_EXPONENT - (w.e + 64);
+  // Compute ceil((min_exponent + 63) * log10(2)).
+  int k = static_cast<int>(
+      ((min_exponent + 63) * one_over_log2_10 +
+       ((static_cast<int64_t>(1) << 32) - 1)) >> 32);
+  const int first_exponent = -348, exponent_step = 8;
+  int index = (k - first_exponent - 1) / exponent_step + 1;
+  pow10_exponent = first_exponent + index * exponent_step;
+  return DiyFp(POW10_SIGNIFICANDS[index], POW10_EXPONENTS[index]);
+}
+
+// Adjusts the last digit of the shortest representation produced by Grisu
+// moving it closer to the exact value. Returns false if the result can't
+// be proven to be the closest shortest representation.
+bool RoundWeed(char *buffer, int length, uint64_t distance_too_high_w,
+    uint64_t unsafe_interval, uint64_t rest, uint64_t ten_kappa,
+    uint64_t unit) {
+  uint64_t small_distance = distance_too_high_w - unit;
+  uint64_t big_distance = distance_too_high_w + unit;
+  while (rest < small_distance && unsafe_interval - rest >= ten_kappa &&
+         (rest + ten_kappa < small_distance ||
+          small_distance - rest >= rest + ten_kappa - small_distance)) {
+    --buffer[length - 1];
+    rest += ten_kappa;
+  }
+  if (rest < big_distance && unsafe_interval - rest >= ten_kappa &&
+      (rest + ten_kappa < big_distance ||
+       big_distance - rest > rest + ten_kappa - big_distance)) {
+    return false;
+  }
+  return 2 * unit <= rest && rest <= unsafe_interval - 4 * unit;
+}
+
+// Rounds the digits generated by Grisu in the counted mode. Returns false
+// if the rounding direction can't be determined.
+bool RoundWeedCounted(char *buffer, int length, uint64_t rest,
+    uint64_t ten_kappa, uint64_t unit, int &kappa) {
+  if (unit >= ten_kappa || ten_kappa - unit <= unit)
+    return false;
+  if (ten_kappa - rest > rest && ten_kappa - 2 * rest >= 2 * unit)
+    return true;
+  if (rest > unit && ten_kappa - (rest - unit) <= rest - unit) {
+    ++buffer[length - 1];
+    for (int i = length - 1; i > 0 && buffer[i] > '9'; --i) {
+      buffer[i] = '0';
+      ++buffer[i - 1];
+    }
+    if (buffer[0] > '9') {
+      buffer[0] = '1';
+      ++kappa;
+    }
+    return true;
+  }
+  return false;
+}
+
+// Generates the shortest sequence of digits of a positive double using
+// the Grisu3 algorithm by Florian Loitsch. Returns false if the algorithm
+// fails in which case a slower exact algorithm should be used.
+// On success the value is equal to 0.DIGITS * 10^point.
+bool GrisuShortest(double value, char *buffer, int &length, int &point) {
+  DiyFp v = Decompose(value);
+  DiyFp w = Normalize(v);
+  // The boundaries are the midpoints between value and its neighbours.
+  bool lower_closer = v.f == DOUBLE_HIDDEN_BIT && v.e > DOUBLE_MIN_EXPONENT;
+  DiyFp plus = Normalize(DiyFp((v.f << 1) + 1, v.e - 1));
+  DiyFp minus = lower_closer ?
+      DiyFp((v.f << 2) - 1, v.e - 2) : DiyFp((v.f << 1) - 1, v.e - 1);
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+
+  int pow10_exponent = 0;
+  DiyFp cached_power = GetCachedPower(w, pow10_exponent);
+  w = Multiply(w, cached_power);
+  DiyFp low = Multiply(minus, cached_power);
+  DiyFp high = Multiply(plus, cached_power);
+
+  // The scaled boundaries are imprecise by at most one unit so widen the
+  // interval to be on the safe side.
+  uint64_t unit = 1;
+  uint64_t too_low = low.f - unit, too_high = high.f + unit;
+  uint64_t unsafe_interval = too_high - too_low;
+  int shift = -w.e;
+  uint64_t one = static_cast<uint64_t>(1) << shift;
+  uint32_t integrals = static_cast<uint32_t>(too_high >> shift);
+  uint64_t fractionals = too_high & (one - 1);
+  int kappa = static_cast<int>(CountDigits(integrals));
+  uint32_t divisor = POWERS_OF_10_32[kappa - 1];
+  length = 0;
+  while (kappa > 0) {
+    buffer[length++] = static_cast<char>('0' + integrals / divisor);
+    integrals %= divisor;
+    --kappa;
+    uint64_t rest = (static_cast<uint64_t>(integrals) << shift) + fractionals;
+    if (rest < unsafe_interval) {
+      point = length + kappa - pow10_exponent;
+      return RoundWeed(buffer, length, too_high - w.f, unsafe_interval, rest,
+          static_cast<uint64_t>(divisor) << shift, unit);
+    }
+    divisor /= 10;
+  }
+  for (;;) {
+    fractionals *= 10;
+    unit *= 10;
+    unsafe_interval *= 10;
+    buffer[length++] = static_cast<char>('0' + (fractionals >> shift));
+    fractionals &= one - 1;
+    --kappa;
+    if (fractionals < unsafe_interval) {
+      point = length + kappa - pow10_exponent;
+      return RoundWeed(buffer, length, (too_high - w.f) * unit,
+          unsafe_interval, fractionals, one, unit);
+    }
+  }
+}
+
+// Generates digits of a positive double rounded to num_digits significant
+// digits or, if fixed is true, to num_digits digits after the decimal point
+// using Grisu. Returns false if the algorithm fails.
+bool GrisuCounted(double value, int num_digits, bool fixed,
+    char *buffer, int &length, int &point) {
+  DiyFp w = Normalize(Decompose(value));
+  int pow10_exponent = 0;
+  w = Multiply(w, GetCachedPower(w, pow10_exponent));
+
+  // The scaled value is imprecise by less than one unit.
+  uint64_t error = 1;
+  int shift = -w.e;
+  uint64_t one = static_cast<uint64_t>(1) << shift;
+  uint32_t integrals = static_cast<uint32_t>(w.f >> shift);
+  uint64_t fractionals = w.f & (one - 1);
+  int kappa = static_cast<int>(CountDigits(integrals));
+  uint32_t divisor = POWERS_OF_10_32[kappa - 1];
+  if (fixed) {
+    num_digits += kappa - pow10_exponent;
+    if (num_digits <= 0) return false;
+  }
+  length = 0;
+  while (kappa > 0) {
+    buffer[length++] = static_cast<char>('0' + integrals / divisor);
+    integrals %= divisor;
+    --kappa;
+    if (--num_digits == 0) {
+      uint64_t rest = (static_cast<uint64_t>(integrals) << shift) +
+          fractionals;
+      bool result = RoundWeedCounted(buffer, length, rest,
+          static_cast<uint64_t>(divisor) << shift, error, kappa);
+      point = length + kappa - pow10_exponent;
+      return result;
+    }
+    divisor /= 10;
+  }
+  while (num_digits > 0 && fractionals > error) {
+    fractionals *= 10;
+    error *= 10;
+    buffer[length++] = static_cast<char>('0' + (fractionals >> shift));
+    fractionals &= one - 1;
+    --kappa;
+    --num_digits;
+  }
+  if (num_digits != 0) return false;
+  bool result = RoundWeedCounted(buffer, length, fractionals, one,
+      error, kappa);
+  point = length + kappa - pow10_exponent;
+  return result;
+}
+
+// An arbitrary-precision unsigned integer with a fixed capacity that is
+// sufficient for the exact digit generation of any double.
+class Bignum {
+ private:
+  enum { CAPACITY = 40 };
+  uint32_t bigits_[CAPACITY];  // Least significant bigit first.
+  int size_;
+
+ public:
+  explicit Bignum(uint64_t value = 0) : size_(0) {
+    for (; value != 0; value >>= 32)
+      bigits_[size_++] = static_cast<uint32_t>(value);
+  }
+
+  bool IsZero() const { return size_ == 0; }
+
+  void MultiplyBy(uint32_t value) {
+    uint64_t carry = 0;
+    for (int i = 0; i < size_; ++i) {
+      uint64_t result = static_cast<uint64_t>(bigits_[i]) * value + carry;
+      bigits_[i] = static_cast<uint32_t>(result);
+      carry = result >> 32;
+    }
+    if (carry != 0) {
+      assert(size_ < CAPACITY);
+      bigits_[size_++] = static_cast<uint32_t>(carry);
+    }
+  }
+
+  void MultiplyByPow10(int exp) {
+    for (; exp >= 9; exp -= 9)
+      MultiplyBy(POWERS_OF_10_32[9]);
+    if (exp > 0)
+      MultiplyBy(POWERS_OF_10_32[exp]);
+  }
+
+  void ShiftLeft(int shift) {
+    if (size_ == 0) return;
+    int bigit_shift = shift / 32;
+    shift %= 32;
+    if (shift != 0) {
+      uint32_t carry = 0;
+      for (int i = 0; i < size_; ++i) {
+        uint32_t bigit = bigits_[i];
+        bigits_[i] = (bigit << shift) | carry;
+        carry = bigit >> (32 - shift);
+      }
+      if (carry != 0) {
+        assert(size_ < CAPACITY);
+        bigits_[size_++] = carry;
+      }
+    }
+    if (bigit_shift != 0) {
+      assert(size_ + bigit_shift <= CAPACITY);
+      std::copy_backward(bigits_, bigits_ + size_,
+          bigits_ + size_ + bigit_shift);
+      std::fill_n(bigits_, bigit_shift, 0u);
+      size_ += bigit_shift;
+    }
+  }
+
+  void Add(const Bignum &other) {
+    int size = std::max(size_, other.size_);
+    uint64_t carry = 0;
+    for (int i = 0; i < size; ++i) {
+      uint64_t sum = carry + (i < size_ ? bigits_[i] : 0) +
+          (i < other.size_ ? other.bigits_[i] : 0);
+      bigits_[i] = static_cast<uint32_t>(sum);
+      carry = sum >> 32;
+    }
+    size_ = size;
+    if (carry != 0) {
+      assert(size_ < CAPACITY);
+      bigits_[size_++] = static_cast<uint32_t>(carry);
+    }
+  }
+
+  // Subtracts other which should not be greater than this number.
+  void Subtract(const Bignum &other) {
+    uint32_t borrow = 0;
+    for (int i = 0; i < size_; ++i) {
+      uint64_t subtrahend =
+          static_cast<uint64_t>(i < other.size_ ? other.bigits_[i] : 0) + borrow;
+      borrow = bigits_[i] < subtrahend;
+      bigits_[i] = static_cast<uint32_t>(bigits_[i] - subtrahend);
+    }
+    while (size_ > 0 && bigits_[size_ - 1] == 0)
+      --size_;
+  }
+
+  // Divides this number by divisor assuming that the quotient is less
+  // than 10. Returns the quotient and leaves the remainder in this number.
+  int DivideModulo(const Bignum &divisor) {
+    int quotient = 0;
+    while (Compare(*this, divisor) >= 0) {
+      Subtract(divisor);
+      ++quotient;
+    }
+    return quotient;
+  }
+
+  static int Compare(const Bignum &lhs, const Bignum &rhs) {
+    if (lhs.size_ != rhs.size_)
+      return lhs.size_ < rhs.size_ ? -1 : 1;
+    for (int i = lhs.size_ - 1; i >= 0; --i) {
+      if (lhs.bigits_[i] != rhs.bigits_[i])
+        return lhs.bigits_[i] < rhs.bigits_[i] ? -1 : 1;
+    }
+    return 0;
+  }
+
+  // Compares lhs1 + lhs2 with rhs.
+  static int ComparePlus(
+      const Bignum &lhs1, const Bignum &lhs2, const Bignum &rhs) {
+    Bignum sum(lhs1);
+    sum.Add(lhs2);
+    return Compare(sum, rhs);
+  }
+};
+
+// Returns an estimate of ceil(log10(f * 2^e)) that is either exact
+// or one less than the exact value.
+int EstimatePow10(uint64_t f, int e) {
+  int num_bits = 0;
+  for (uint64_t n = f; n != 0; n >>= 1)
+    ++num_bits;
+  return static_cast<int>(
+      std::ceil((e + num_bits - 1) * 0.30102999566398114 - 1e-10));
+}
+
+// Generates the shortest sequence of digits of a positive double that
+// rounds back to the same value using exact arithmetic (the Dragon4
+// algorithm as described by Burger and Dybvig). This is much slower than
+// Grisu and is only used when the latter fails.
+int DragonShortest(double value, char *buffer, int &point) {
+  DiyFp v = Decompose(value);
+  bool even = (v.f & 1) == 0;
+  bool lower_closer = v.f == DOUBLE_HIDDEN_BIT && v.e > DOUBLE_MIN_EXPONENT;
+  // value = r / s, the distances to the boundaries are m_plus / s and
+  // m_minus / s.
+  Bignum r(v.f), s(1), m_plus(1), m_minus(1);
+  int shift = lower_closer ? 2 : 1;
+  r.ShiftLeft(shift);
+  if (v.e >= 0) {
+    r.ShiftLeft(v.e);
+    s.ShiftLeft(shift);
+    m_plus.ShiftLeft(v.e + shift - 1);
+    m_minus.ShiftLeft(v.e);
+  } else {
+    s.ShiftLeft(shift - v.e);
+    m_plus.ShiftLeft(shift - 1);
+  }
+  int k = EstimatePow10(v.f, v.e);
+  if (k >= 0) {
+    s.MultiplyByPow10(k);
+  } else {
+    r.MultiplyByPow10(-k);
+    m_plus.MultiplyByPow10(-k);
+    m_minus.MultiplyByPow10(-k);
+  }
+  // Fix the estimate.
+  int cmp = Bignum::ComparePlus(r, m_plus, s);
+  if (even ? cmp >= 0 : cmp > 0) {
+    s.MultiplyBy(10);
+    ++k;
+  }
+  point = k;
+  int length = 0;
+  for (;;) {
+    r.MultiplyBy(10);
+    m_plus.MultiplyBy(10);
+    m_minus.MultiplyBy(10);
+    int digit = r.DivideModulo(s);
+    cmp = Bignum::Compare(r, m_minus);
+    bool low = even ? cmp <= 0 : cmp < 0;
+    cmp = Bignum::ComparePlus(r, m_plus, s);
+    bool high = even ? cmp >= 0 : cmp > 0;
+    if (low && high) {
+      // Both digits are within the interval, choose the closest one.
+      Bignum twice_r(r);
+      twice_r.ShiftLeft(1);
+      if (Bignum::Compare(twice_r, s) >= 0)
+        ++digit;
+    } else if (high) {
+      ++digit;
+    }
+    buffer[length++] = static_cast<char>('0' + digit);
+    if (low || high)
+      return length;
+  }
+}
+
+// Generates digits of a positive double correctly rounded (ties to even)
+// to num_digits significant digits or, if fixed is true, to num_digits
+// digits after the decimal point using exact arithmetic. Trailing zeros
+// may be omitted. Returns the number of generated digits.
+int DragonCounted(double value, int num_digits, bool fixed,
+    char *buffer, int &point) {
+  DiyFp v = Decompose(value);
+  Bignum r(v.f), s(1);
+  if (v.e >= 0)
+    r.ShiftLeft(v.e);
+  else
+    s.ShiftLeft(-v.e);
+  int k = EstimatePow10(v.f, v.e);
+  if (k >= 0)
+    s.MultiplyByPow10(k);
+  else
+    r.MultiplyByPow10(-k);
+  // Make sure that 0.1 <= r / s < 1.
+  while (Bignum::Compare(r, s) >= 0) {
+    s.MultiplyBy(10);
+    ++k;
+  }
+  point = k;
+  if (fixed)
+    num_digits += k;
+  if (num_digits < 0)
+    return 0;
+  int length = 0;
+  while (length < num_digits) {
+    r.MultiplyBy(10);
+    buffer[length++] = static_cast<char>('0' + r.DivideModulo(s));
+    if (r.IsZero())
+      return length;
+  }
+  // Round the remainder r / s which is less than one unit in the last place.
+  r.ShiftLeft(1);
+  int cmp = Bignum::Compare(r, s);
+  bool odd = length != 0 && (buffer[length - 1] - '0') % 2 != 0;
+  if (cmp < 0 || (cmp == 0 && !odd))
+    return length;
+  int i = length - 1;
+  for (; i >= 0 && buffer[i] == '9'; --i) {}
+  if (i < 0) {
+    buffer[0] = '1';
+    ++point;
+    return 1;
+  }
+  ++buffer[i];
+  return i + 1;
+}
 }
 
-char *BasicFormatter::PrepareFilledBuffer(
+template <typename Char>
+Char *BasicWriter<Char>::PrepareFilledBuffer(
     unsigned size, const FormatSpec &spec, char sign) {
   if (spec.width <= size) {
-    char *p = GrowBuffer(size);
+    Char *p = GrowBuffer(size);
     *p = sign;
     return p + size - 1;
   }
-  char *p = GrowBuffer(spec.width);
-  char *end = p + spec.width;
+  Char *p = GrowBuffer(spec.width);
+  Char *end = p + spec.width;
+  Char fill = static_cast<Char>(spec.fill);
   if (spec.align == ALIGN_LEFT) {
     *p = sign;
     p += size;
-    std::fill(p, end, spec.fill);
+    std::fill(p, end, fill);
   } else if (spec.align == ALIGN_CENTER) {
     p = FillPadding(p, spec.width, size, spec.fill);
     *p = sign;
@@ -195,14 +983,15 @@ char *BasicFormatter::PrepareFilledBuffer(
     } else {
       *(end - size) = sign;
     }
-    std::fill(p, end - size, spec.fill);
+    std::fill(p, end - size, fill);
     p = end;
   }
   return p - 1;
 }
 
+template <typename Char>
 template <typename T>
-void BasicFormatter::FormatInt(T value, const FormatSpec &spec) {
+void BasicWriter<Char>::FormatInt(T value, const FormatSpec &spec) {
   unsigned size = 0;
   char sign = 0;
   typedef typename IntTraits<T>::UnsignedType UnsignedType;
@@ -218,45 +1007,53 @@ void BasicFormatter::FormatInt(T value, const FormatSpec &spec) {
   switch (spec.type) {
   case 0: case 'd': {
     unsigned num_digits = CountDigits(abs_value);
-    char *p = PrepareFilledBuffer(size + num_digits, spec, sign)
-        - num_digits + 1;
-    FormatDecimal(p, abs_value, num_digits);
+    unsigned num_padded_digits = CountPaddedDigits(num_digits, size, spec);
+    unsigned num_seps = CountSeparators(num_padded_digits, spec);
+    unsigned content_size = num_padded_digits + num_seps;
+    Char *p = PrepareFilledBuffer(size + content_size, spec, sign)
+        - content_size + 1;
+    unsigned num_zeros = num_padded_digits - num_digits;
+    std::fill_n(p, num_zeros, '0');
+    FormatDecimal(p + num_zeros, abs_value, num_digits);
+    if (num_seps != 0)
+      GroupDigits(p, num_padded_digits, num_seps, spec.thousands_sep);
     break;
   }
   case 'x': case 'X': {
-    UnsignedType n = abs_value;
     bool print_prefix = (spec.flags & HASH_FLAG) != 0;
     if (print_prefix) size += 2;
-    do {
-      ++size;
-    } while ((n >>= 4) != 0);
-    char *p = PrepareFilledBuffer(size, spec, sign);
-    n = abs_value;
-    const char *digits = spec.type == 'x' ?
-        "0123456789abcdef" : "0123456789ABCDEF";
-    do {
-      *p-- = digits[n & 0xf];
-    } while ((n >>= 4) != 0);
+    unsigned num_digits = HexDigits::count(abs_value);
+    Char *p = PrepareFilledBuffer(size + num_digits, spec, sign)
+        - num_digits + 1;
+    HexDigits::write(p, abs_value, num_digits, spec.type == 'x' ?
+        fmt::sprint::LowerHex::pairs : fmt::sprint::UpperHex::pairs);
     if (print_prefix) {
-      *p-- = spec.type;
-      *p = '0';
+      Char *prefix = p - 2;
+      if (spec.align == ALIGN_NUMERIC && spec.width > size + num_digits) {
+        // The padding goes between the prefix and the digits.
+        p[-1] = p[-2] = static_cast<Char>(spec.fill);
+        prefix = p + num_digits - spec.width + (sign != 0);
+      }
+      prefix[0] = '0';
+      prefix[1] = spec.type;
     }
     break;
   }
   case 'o': {
-    UnsignedType n = abs_value;
     bool print_prefix = (spec.flags & HASH_FLAG) != 0;
     if (print_prefix) ++size;
-    do {
-      ++size;
-    } while ((n >>= 3) != 0);
-    char *p = PrepareFilledBuffer(size, spec, sign);
-    n = abs_value;
-    do {
-      *p-- = '0' + (n & 7);
-    } while ((n >>= 3) != 0);
-    if (print_prefix)
-      *p = '0';
+    unsigned num_digits = OctDigits::count(abs_value);
+    Char *p = PrepareFilledBuffer(size + num_digits, spec, sign)
+        - num_digits + 1;
+    OctDigits::write(p, abs_value, num_digits);
+    if (print_prefix) {
+      Char *prefix = p - 1;
+      if (spec.align == ALIGN_NUMERIC && spec.width > size + num_digits) {
+        p[-1] = static_cast<Char>(spec.fill);
+        prefix = p + num_digits - spec.width + (sign != 0);
+      }
+      *prefix = '0';
+    }
     break;
   }
   default:
@@ -265,8 +1062,9 @@ void BasicFormatter::FormatInt(T value, const FormatSpec &spec) {
   }
 }
 
+template <typename Char>
 template <typename T>
-void BasicFormatter::FormatDouble(
+void BasicWriter<Char>::FormatDouble(
     T value, const FormatSpec &spec, int precision) {
   // Check type.
   char type = spec.type;
@@ -304,33 +1102,47 @@ void BasicFormatter::FormatDouble(
   if (value != value) {
     // Format NaN ourselves because sprintf's output is not consistent
     // across platforms.
-    std::size_t size = 4;
-    const char *nan = upper ? " NAN" : " nan";
-    if (!sign) {
-      --size;
-      ++nan;
-    }
-    char *out = FormatString(nan, size, spec);
-    if (sign)
-      *out = sign;
+    const char *nan = upper ? "NAN" : "nan";
+    Char *out = PrepareFilledBuffer(sign ? 4 : 3, spec, sign) - 2;
+    std::copy(nan, nan + 3, out);
     return;
   }
 
   if (isinf(value)) {
     // Format infinity ourselves because sprintf's output is not consistent
     // across platforms.
-    std::size_t size = 4;
-    const char *inf = upper ? " INF" : " inf";
-    if (!sign) {
-      --size;
-      ++inf;
-    }
-    char *out = FormatString(inf, size, spec);
-    if (sign)
-      *out = sign;
+    const char *inf = upper ? "INF" : "inf";
+    Char *out = PrepareFilledBuffer(sign ? 4 : 3, spec, sign) - 2;
+    std::copy(inf, inf + 3, out);
+    return;
+  }
+
+  if (!IsLongDouble<T>::VALUE) {
+    FormatFiniteDouble(static_cast<double>(value), spec, precision, sign);
     return;
   }
 
+  FormatLongDouble(value, spec, precision, sign, type);
+}
+
+// Long double is formatted with snprintf because its significand
+// doesn't fit into 64 bits used by the digit generation.
+namespace format {
+template <>
+void BasicWriter<char>::FormatLongDouble(long double value,
+    const FormatSpec &spec, int precision, char sign, char type) {
+  if ((spec.flags & RAW_DIGITS_FLAG) == 0 && (spec.thousands_sep ||
+      spec.decimal_point != '.' || *std::localeconv()->decimal_point != '.')) {
+    // snprintf doesn't group digits and uses the decimal point of the
+    // C locale, so format the digits as is and fix them.
+    FormatSpec digits_spec(0, type);
+    digits_spec.flags = (spec.flags & HASH_FLAG) | RAW_DIGITS_FLAG;
+    char inline_buffer[internal::INLINE_BUFFER_SIZE];
+    BasicWriter<char> digits(inline_buffer, sizeof(inline_buffer), 0);
+    digits.FormatLongDouble(value, digits_spec, precision, 0, type);
+    WriteLongDoubleDigits(digits.data(), digits.size(), spec, sign);
+    return;
+  }
   size_t offset = buffer_.size();
   unsigned width = spec.width;
   if (sign) {
@@ -360,8 +1172,7 @@ void BasicFormatter::FormatDouble(
     *format_ptr++ = '.';
     *format_ptr++ = '*';
   }
-  if (IsLongDouble<T>::VALUE)
-    *format_ptr++ = 'L';
+  *format_ptr++ = 'L';
   *format_ptr++ = type;
   *format_ptr = '\0';
 
@@ -386,7 +1197,7 @@ void BasicFormatter::FormatDouble(
           *(start - 1) = sign;
           sign = 0;
         } else {
-          *(start - 1) = spec.fill;
+          *(start - 1) = static_cast<char>(spec.fill);
         }
         ++n;
       }
@@ -398,7 +1209,7 @@ void BasicFormatter::FormatDouble(
       }
       if (spec.fill != ' ' || sign) {
         while (*start == ' ')
-          *start++ = spec.fill;
+          *start++ = static_cast<char>(spec.fill);
         if (sign)
           *(start - 1) = sign;
       }
@@ -408,19 +1219,200 @@ void BasicFormatter::FormatDouble(
     buffer_.reserve(n >= 0 ? offset + n + 1 : 2 * buffer_.capacity());
   }
 }
+}
+
+template <typename Char>
+void BasicWriter<Char>::FormatLongDouble(long double value,
+    const FormatSpec &spec, int precision, char sign, char type) {
+  // Format the digits with snprintf into a narrow buffer and pad them
+  // here since the fill character may not be representable as char.
+  FormatSpec digits_spec(0, type);
+  digits_spec.flags = (spec.flags & HASH_FLAG) | RAW_DIGITS_FLAG;
+  char inline_buffer[internal::INLINE_BUFFER_SIZE];
+  BasicWriter<char> digits(inline_buffer, sizeof(inline_buffer), 0);
+  digits.FormatLongDouble(value, digits_spec, precision, 0, type);
+  WriteLongDoubleDigits(digits.data(), digits.size(), spec, sign);
+}
+
+template <typename Char>
+void BasicWriter<Char>::WriteLongDoubleDigits(
+    const char *digits, std::size_t size, const FormatSpec &spec, char sign) {
+  const char *end = digits + size, *int_end = digits;
+  while (int_end != end && '0' <= *int_end && *int_end <= '9')
+    ++int_end;
+  unsigned num_int_digits = static_cast<unsigned>(int_end - digits);
+  // The decimal point of the C locale may consist of several characters.
+  const char *fraction = int_end;
+  bool has_point = int_end != end && *int_end != 'e' && *int_end != 'E';
+  if (has_point) {
+    const char *locale_point = std::localeconv()->decimal_point;
+    fraction += *locale_point ? std::strlen(locale_point) : 1;
+  }
+  unsigned other_size = static_cast<unsigned>(
+      (has_point ? 1 : 0) + (end - fraction));
+  unsigned num_padded_digits = num_int_digits == 0 ? 0 : CountPaddedDigits(
+      num_int_digits, other_size + (sign ? 1 : 0), spec);
+  unsigned num_seps = CountSeparators(num_padded_digits, spec);
+  std::size_t content_size = num_padded_digits + num_seps + other_size;
+  Char *out = PrepareFilledBuffer(
+      static_cast<unsigned>(content_size) + (sign ? 1 : 0), spec, sign) -
+      content_size + 1;
+  unsigned num_zeros = num_padded_digits - num_int_digits;
+  std::fill_n(out, num_zeros, '0');
+  std::copy(digits, int_end, out + num_zeros);
+  if (num_seps != 0)
+    GroupDigits(out, num_padded_digits, num_seps, spec.thousands_sep);
+  out += num_padded_digits + num_seps;
+  if (has_point)
+    *out++ = static_cast<Char>(spec.decimal_point);
+  std::copy(fraction, end, out);
+}
+
+template <typename Char>
+void BasicWriter<Char>::FormatFiniteDouble(
+    double value, const FormatSpec &spec, int precision, char sign) {
+  // Digits after the decimal point beyond this limit are always zero
+  // since any double has fewer than 1100 of them.
+  enum { MAX_FIXED_PRECISION = 1100 };
+  char type = spec.type;
+  bool upper = type == 'E' || type == 'G';
+  bool hash = (spec.flags & HASH_FLAG) != 0;
+  if (type >= 'A' && type <= 'Z')
+    type += 'a' - 'A';
+  bool shortest = type == 0 && precision < 0 && !hash;
+  if (type == 0)
+    type = 'g';
+  if (precision < 0)
+    precision = 6;
+
+  // Generate digits: value = 0.DIGITS * 10^point.
+  internal::Array<char, 32> digits;
+  int num_digits = 0, point = 1;
+  if (value == 0) {
+    digits.push_back('0');
+    num_digits = 1;
+  } else if (shortest) {
+    digits.resize(20);
+    if (!GrisuShortest(value, &digits[0], num_digits, point))
+      num_digits = DragonShortest(value, &digits[0], point);
+  } else {
+    bool fixed = type == 'f';
+    int requested = std::min(precision, static_cast<int>(MAX_FIXED_PRECISION));
+    int max_num_digits = requested;
+    if (type == 'e') {
+      max_num_digits = ++requested;
+    } else if (fixed) {
+      // Add an upper bound on the number of digits before the decimal point.
+      int exp = 0;
+      std::frexp(value, &exp);
+      if (exp > 0)
+        max_num_digits += exp * 78 / 256 + 1;
+    } else if (requested == 0) {
+      max_num_digits = requested = 1;
+    }
+    digits.resize(max_num_digits + 1);
+    if (!GrisuCounted(value, requested, fixed, &digits[0], num_digits, point))
+      num_digits = DragonCounted(value, requested, fixed, &digits[0], point);
+  }
+
+  // Choose between fixed and exponent notation as printf's %g does.
+  bool exponent_notation = type == 'e';
+  if (type == 'g') {
+    int exp = point - 1;
+    int max_exp = shortest ? 16 : (precision == 0 ? 1 : precision);
+    exponent_notation = exp < -4 || exp >= max_exp;
+    if (hash) {
+      precision = (precision == 0 ? 1 : precision) -
+          (exponent_notation ? 1 : point);
+    } else {
+      while (num_digits > 0 && digits[num_digits - 1] == '0')
+        --num_digits;
+      precision = std::max(num_digits - (exponent_notation ? 1 : point), 0);
+    }
+  }
+
+  unsigned size = sign ? 1 : 0;
+  bool has_point = precision > 0 || hash;
+  if (has_point)
+    size += 1 + precision;
+  unsigned num_int_digits = 1;
+  if (exponent_notation) {
+    int abs_exp = std::abs(point - 1);
+    size += 2 + (abs_exp >= 100 ? 3 : 2);
+  } else if (point > 0) {
+    num_int_digits = static_cast<unsigned>(point);
+  }
+  unsigned num_padded_digits = CountPaddedDigits(num_int_digits, size, spec);
+  unsigned num_zeros = num_padded_digits - num_int_digits;
+  unsigned num_seps = CountSeparators(num_padded_digits, spec);
+  size += num_padded_digits + num_seps;
+  unsigned content_size = size - (sign ? 1 : 0);
+  Char *out = PrepareFilledBuffer(size, spec, sign) - content_size + 1;
+  Char *int_part = out;
+  out = std::fill_n(out, num_zeros, '0');
+
+  if (exponent_notation) {
+    *out++ = digits[0];
+    if (num_seps != 0) {
+      GroupDigits(int_part, num_padded_digits, num_seps, spec.thousands_sep);
+      out += num_seps;
+    }
+    if (has_point) {
+      *out++ = static_cast<Char>(spec.decimal_point);
+      int n = std::min(num_digits - 1, precision);
+      out = std::copy(&digits[0] + 1, &digits[0] + 1 + n, out);
+      out = std::fill_n(out, precision - n, '0');
+    }
+    int exp = point - 1;
+    *out++ = upper ? 'E' : 'e';
+    *out++ = exp < 0 ? '-' : '+';
+    exp = std::abs(exp);
+    if (exp >= 100) {
+      *out++ = static_cast<char>('0' + exp / 100);
+      exp %= 100;
+    }
+    out[0] = DIGITS[exp * 2];
+    out[1] = DIGITS[exp * 2 + 1];
+    return;
+  }
+
+  // Fixed notation.
+  if (point > 0) {
+    int n = std::min(num_digits, point);
+    out = std::copy(&digits[0], &digits[0] + n, out);
+    out = std::fill_n(out, point - n, '0');
+  } else {
+    *out++ = '0';
+  }
+  if (num_seps != 0) {
+    GroupDigits(int_part, num_padded_digits, num_seps, spec.thousands_sep);
+    out += num_seps;
+  }
+  if (has_point) {
+    *out++ = static_cast<Char>(spec.decimal_point);
+    int num_zeros = std::min(std::max(-point, 0), precision);
+    out = std::fill_n(out, num_zeros, '0');
+    int start = std::max(point, 0);
+    int n = std::min(std::max(num_digits - start, 0), precision - num_zeros);
+    out = std::copy(&digits[0] + start, &digits[0] + start + n, out);
+    std::fill_n(out, precision - num_zeros - n, '0');
+  }
+}
 
-char *BasicFormatter::FormatString(
-    const char *s, std::size_t size, const FormatSpec &spec) {
-  char *out = 0;
+template <typename Char>
+Char *BasicWriter<Char>::FormatString(
+    const Char *s, std::size_t size, const FormatSpec &spec) {
+  Char *out = 0;
   if (spec.width > size) {
     out = GrowBuffer(spec.width);
+    Char fill = static_cast<Char>(spec.fill);
     if (spec.align == ALIGN_RIGHT) {
-      std::fill_n(out, spec.width - size, spec.fill);
+      std::fill_n(out, spec.width - size, fill);
       out += spec.width - size;
     } else if (spec.align == ALIGN_CENTER) {
       out = FillPadding(out, spec.width, size, spec.fill);
     } else {
-      std::fill_n(out + size, spec.width - size, spec.fill);
+      std::fill_n(out + size, spec.width - size, fill);
     }
   } else {
     out = GrowBuffer(size);
@@ -429,10 +1421,58 @@ char *BasicFormatter::FormatString(
   return out;
 }
 
-void BasicFormatter::operator<<(int value) {
+template <typename Char>
+void BasicWriter<Char>::Pad(std::size_t start, const FormatSpec &spec) {
+  std::size_t size = buffer_.size() - start;
+  if (spec.width <= size) return;
+  std::size_t padding = spec.width - size;
+  GrowBuffer(padding);
+  Char *content = &buffer_[start];
+  Char fill = static_cast<Char>(spec.fill);
+  if (spec.align == ALIGN_RIGHT) {
+    std::copy_backward(content, content + size, content + spec.width);
+    std::fill_n(content, padding, fill);
+  } else if (spec.align == ALIGN_CENTER) {
+    std::size_t left_padding = padding / 2;
+    std::copy_backward(content, content + size, content + left_padding + size);
+    FillPadding(content, spec.width, size, spec.fill);
+  } else {
+    std::fill_n(content + size, padding, fill);
+  }
+}
+
+template <typename Char>
+template <typename T>
+void BasicWriter<Char>::FormatInts(const T *begin, const T *end, Char sep) {
+  if (begin == end) return;
+  typedef typename IntTraits<T>::UnsignedType UnsignedType;
+  // The maximum number of characters per value including the sign and
+  // the separator.
+  enum { MAX_SIZE = std::numeric_limits<UnsignedType>::digits10 + 3 };
+  std::size_t size = buffer_.size();
+  buffer_.reserve(size + (end - begin) * MAX_SIZE);
+  Char *start = &buffer_[0];
+  Char *out = start + size;
+  for (const T *p = begin; p != end; ++p) {
+    UnsignedType abs_value = *p;
+    if (IntTraits<T>::IsNegative(*p)) {
+      *out++ = '-';
+      abs_value = 0 - abs_value;
+    }
+    unsigned num_digits = CountDigits(abs_value);
+    FormatDecimal(out, abs_value, num_digits);
+    out += num_digits;
+    *out++ = sep;
+  }
+  // Drop the trailing separator.
+  buffer_.resize(out - start - 1);
+}
+
+template <typename Char>
+void BasicWriter<Char>::operator<<(int value) {
   unsigned abs_value = value;
   unsigned num_digits = 0;
-  char *out = 0;
+  Char *out = 0;
   if (value >= 0) {
     num_digits = CountDigits(abs_value);
     out = GrowBuffer(num_digits);
@@ -445,29 +1485,110 @@ void BasicFormatter::operator<<(int value) {
   FormatDecimal(out, abs_value, num_digits);
 }
 
-void BasicFormatter::operator<<(const format::sprint::AppendTransaction<char>& spr) {
-	// Acting optimistically on the buffer
-	buffer_.appendTransact(spr);
+namespace {
+
+// Format string parser. It is shared between Formatter::DoFormat which
+// parses and formats in a single pass and CompiledFormat which stores
+// the result of parsing for later use.
+template <typename Char>
+class FormatParser {
+ private:
+  int next_arg_index_;
+  const Char *field_start_;
+  int field_next_arg_index_;
+
+ public:
+  int num_open_braces;
+
+  FormatParser()
+  : next_arg_index_(0), field_start_(0), field_next_arg_index_(0),
+    num_open_braces(0) {}
+
+  // Starts parsing a replacement field following '{' at s.
+  void StartField(const Char *s) {
+    num_open_braces = 1;
+    field_start_ = s;
+    field_next_arg_index_ = next_arg_index_;
+  }
+
+  FMT_NORETURN void ReportError(const Char *s, const char *message) const;
+
+  // Reports an error in the current field that depends on arguments.
+  FMT_NORETURN void ReportArgError(const char *message) const;
+
+  unsigned ParseUInt(const Char *&s) const;
+
+  // Parses argument index and returns it.
+  unsigned ParseArgIndex(const Char *&s);
+
+  // Parses format specifiers following ':' in a replacement field.
+  // Specifiers that require arguments of particular types are passed
+  // to the handler which is also responsible for getting precision
+  // from an argument.
+  template <typename Handler>
+  void ParseSpec(
+      const Char *&s, FormatSpec &spec, int &precision, Handler &handler);
+};
+
+// Converts a type specifier to char. Characters outside of ASCII are
+// mapped to DEL which is not a valid type.
+inline char ToTypeCode(char c) { return c; }
+
+template <typename Char>
+inline char ToTypeCode(Char c) {
+  return static_cast<unsigned long>(c) < 0x80 ? static_cast<char>(c) : '\x7f';
 }
 
-// Throws Exception(message) if format contains '}', otherwise throws
-// FormatError reporting unmatched '{'. The idea is that unmatched '{'
-// should override other errors.
-void Formatter::ReportError(const char *s, StringRef message) const {
-  for (int num_open_braces = num_open_braces_; *s; ++s) {
+// Reports message if format contains '}', otherwise reports unmatched '{'.
+// The idea is that unmatched '{' should override other errors.
+template <typename Char>
+void FormatParser<Char>::ReportError(
+    const Char *s, const char *message) const {
+  for (int num_open_braces = this->num_open_braces; *s; ++s) {
     if (*s == '{') {
       ++num_open_braces;
     } else if (*s == '}') {
       if (--num_open_braces == 0)
-        throw fmt::FormatError(message);
+        fmt::internal::ReportError(message);
     }
   }
-  throw fmt::FormatError("unmatched '{' in format");
+  fmt::internal::ReportError("unmatched '{' in format");
+}
+
+// Ignores the requirements of format specifiers.
+template <typename Char>
+struct SpecSkipper {
+  void RequireNumeric(const Char *, char) {}
+  void RequireSigned(const Char *, char) {}
+  void RequireDouble(const Char *) {}
+  int GetPrecision(const Char *, unsigned) { return 0; }
+};
+
+// Parses the current field again ignoring arguments, so a syntax error
+// in the field is reported before message as by CompiledFormat.
+template <typename Char>
+void FormatParser<Char>::ReportArgError(const char *message) const {
+  FormatParser parser(*this);
+  parser.next_arg_index_ = field_next_arg_index_;
+  parser.num_open_braces = 1;
+  const Char *s = field_start_;
+  parser.ParseArgIndex(s);
+  if (*s == ':') {
+    ++s;
+    FormatSpec spec;
+    int precision = -1;
+    SpecSkipper<Char> skipper;
+    parser.ParseSpec(s, spec, precision, skipper);
+  }
+  if (*s != '}')
+    fmt::internal::ReportError("unmatched '{' in format");
+  fmt::internal::ReportError(message);
 }
 
 // Parses an unsigned integer advancing s to the end of the parsed input.
 // This function assumes that the first character of s is a digit.
-unsigned Formatter::ParseUInt(const char *&s) const {
+template <typename Char>
+unsigned FormatParser<Char>::ParseUInt(const Char *&s) const {
   assert('0' <= *s && *s <= '9');
   unsigned value = 0;
   do {
@@ -479,8 +1600,8 @@ unsigned Formatter::ParseUInt(const char *&s) const {
   return value;
 }
 
-inline const Formatter::Arg &Formatter::ParseArgIndex(const char *&s) {
-  unsigned arg_index = 0;
+template <typename Char>
+inline unsigned FormatParser<Char>::ParseArgIndex(const Char *&s) {
   if (*s < '0' || *s > '9') {
     if (*s != '}' && *s != ':')
       ReportError(s, "invalid argument index in format string");
@@ -488,257 +1609,1191 @@ inline const Formatter::Arg &Formatter::ParseArgIndex(const char *&s) {
       ReportError(s,
           "cannot switch from manual to automatic argument indexing");
     }
-    arg_index = next_arg_index_++;
-  } else {
-    if (next_arg_index_ > 0) {
-      ReportError(s,
-          "cannot switch from automatic to manual argument indexing");
-    }
-    next_arg_index_ = -1;
-    arg_index = ParseUInt(s);
-    if (arg_index >= args_.size())
-      ReportError(s, "argument index is out of range in format");
+    return next_arg_index_++;
   }
-  return *args_[arg_index];
-}
-
-void Formatter::CheckSign(const char *&s, const Arg &arg) {
-  if (arg.type > LAST_NUMERIC_TYPE) {
-    ReportError(s,
-        Format("format specifier '{0}' requires numeric argument") << *s);
-  }
-  if (arg.type == UINT || arg.type == ULONG) {
+  if (next_arg_index_ > 0) {
     ReportError(s,
-        Format("format specifier '{0}' requires signed argument") << *s);
+        "cannot switch from automatic to manual argument indexing");
   }
-  ++s;
+  next_arg_index_ = -1;
+  return ParseUInt(s);
 }
 
-void Formatter::DoFormat() {
-  const char *start = format_;
-  format_ = 0;
-  next_arg_index_ = 0;
-  const char *s = start;
-  while (*s) {
-    char c = *s++;
-    if (c != '{' && c != '}') continue;
-    if (*s == c) {
-      buffer_.append(start, s);
-      start = ++s;
-      continue;
+template <typename Char>
+template <typename Handler>
+void FormatParser<Char>::ParseSpec(
+    const Char *&s, FormatSpec &spec, int &precision, Handler &handler) {
+  // Parse fill and alignment.
+  if (Char c = *s) {
+    const Char *p = s + 1;
+    spec.align = fmt::ALIGN_DEFAULT;
+    do {
+      switch (*p) {
+      case '<':
+        spec.align = fmt::ALIGN_LEFT;
+        break;
+      case '>':
+        spec.align = fmt::ALIGN_RIGHT;
+        break;
+      case '=':
+        spec.align = fmt::ALIGN_NUMERIC;
+        break;
+      case '^':
+        spec.align = fmt::ALIGN_CENTER;
+        break;
+      }
+      if (spec.align != fmt::ALIGN_DEFAULT) {
+        if (p != s) {
+          if (c == '}') break;
+          if (c == '{')
+            ReportError(s, "invalid fill character '{'");
+          s += 2;
+          spec.fill = c;
+        } else ++s;
+        if (spec.align == fmt::ALIGN_NUMERIC)
+          handler.RequireNumeric(s, '=');
+        break;
+      }
+    } while (--p >= s);
+  }
+
+  // Parse sign.
+  switch (*s) {
+  case '+':
+    handler.RequireSigned(s, static_cast<char>(*s));
+    ++s;
+    spec.flags |= SIGN_FLAG | PLUS_FLAG;
+    break;
+  case '-':
+    handler.RequireSigned(s, static_cast<char>(*s));
+    ++s;
+    break;
+  case ' ':
+    handler.RequireSigned(s, static_cast<char>(*s));
+    ++s;
+    spec.flags |= SIGN_FLAG;
+    break;
+  }
+
+  if (*s == '#') {
+    handler.RequireNumeric(s, '#');
+    spec.flags |= HASH_FLAG;
+    ++s;
+  }
+
+  // Parse width and zero flag.
+  if ('0' <= *s && *s <= '9') {
+    if (*s == '0') {
+      handler.RequireNumeric(s, '0');
+      spec.align = fmt::ALIGN_NUMERIC;
+      spec.fill = '0';
     }
-    if (c == '}')
-      throw FormatError("unmatched '}' in format");
-    num_open_braces_= 1;
-    buffer_.append(start, s - 1);
+    // Zero may be parsed again as a part of the width, but it is simpler
+    // and more efficient than checking if the next char is a digit.
+    unsigned value = ParseUInt(s);
+    if (value > INT_MAX)
+      ReportError(s, "number is too big in format");
+    spec.width = value;
+  }
 
-    const Arg &arg = ParseArgIndex(s);
+  // Parse thousands separator.
+  if (*s == ',' || *s == '_') {
+    handler.RequireNumeric(s, static_cast<char>(*s));
+    spec.thousands_sep = static_cast<char>(*s++);
+  }
 
-    FormatSpec spec;
-    int precision = -1;
-    if (*s == ':') {
+  // Parse precision.
+  if (*s == '.') {
+    ++s;
+    precision = 0;
+    if ('0' <= *s && *s <= '9') {
+      unsigned value = ParseUInt(s);
+      if (value > INT_MAX)
+        ReportError(s, "number is too big in format");
+      precision = value;
+    } else if (*s == '{') {
       ++s;
+      ++num_open_braces;
+      unsigned arg_index = ParseArgIndex(s);
+      precision = handler.GetPrecision(s, arg_index);
+      if (*s++ != '}')
+        fmt::internal::ReportError("unmatched '{' in format");
+      --num_open_braces;
+    } else {
+      ReportError(s, "missing precision in format");
+    }
+    handler.RequireDouble(s);
+  }
 
-      // Parse fill and alignment.
-      if (char c = *s) {
-        const char *p = s + 1;
-        spec.align = ALIGN_DEFAULT;
-        do {
-          switch (*p) {
-          case '<':
-            spec.align = ALIGN_LEFT;
-            break;
-          case '>':
-            spec.align = ALIGN_RIGHT;
-            break;
-          case '=':
-            spec.align = ALIGN_NUMERIC;
-            break;
-          case '^':
-            spec.align = ALIGN_CENTER;
-            break;
-          }
-          if (spec.align != ALIGN_DEFAULT) {
-            if (p != s) {
-              if (c == '}') break;
-              if (c == '{')
-                ReportError(s, "invalid fill character '{'");
-              s += 2;
-              spec.fill = c;
-            } else ++s;
-            if (spec.align == ALIGN_NUMERIC && arg.type > LAST_NUMERIC_TYPE)
-              ReportError(s, "format specifier '=' requires numeric argument");
-            break;
-          }
-        } while (--p >= s);
-      }
+  // Parse type.
+  if (*s != '}' && *s) {
+    spec.type = ToTypeCode(*s++);
+    if (spec.thousands_sep &&
+        (spec.type == 'x' || spec.type == 'X' || spec.type == 'o')) {
+      ReportError(s, "thousands separator requires decimal format");
+    }
+  }
+}
+}
 
-      // Parse sign.
-      switch (*s) {
-      case '+':
-        CheckSign(s, arg);
-        spec.flags |= SIGN_FLAG | PLUS_FLAG;
-        break;
-      case '-':
-        CheckSign(s, arg);
-        break;
-      case ' ':
-        CheckSign(s, arg);
-        spec.flags |= SIGN_FLAG;
-        break;
-      }
+// Checks an argument against the requirements of format specifiers.
+// If the parser is null the errors are reported directly which is used
+// when formatting with a precompiled format.
+template <typename Char>
+class GenericFormatter<Char>::ArgChecker {
+ private:
+  const GenericFormatter &formatter_;
+  Type type_;
+  const FormatParser<Char> *parser_;
 
-      if (*s == '#') {
-        if (arg.type > LAST_NUMERIC_TYPE)
-          ReportError(s, "format specifier '#' requires numeric argument");
-        spec.flags |= HASH_FLAG;
-        ++s;
-      }
+  FMT_NORETURN void ReportError(const Char *, const char *message) const {
+    if (parser_)
+      parser_->ReportArgError(message);
+    fmt::internal::ReportError(message);
+  }
 
-      // Parse width and zero flag.
-      if ('0' <= *s && *s <= '9') {
-        if (*s == '0') {
-          if (arg.type > LAST_NUMERIC_TYPE)
-            ReportError(s, "format specifier '0' requires numeric argument");
-          spec.align = ALIGN_NUMERIC;
-          spec.fill = '0';
-        }
-        // Zero may be parsed again as a part of the width, but it is simpler
-        // and more efficient than checking if the next char is a digit.
-        unsigned value = ParseUInt(s);
-        if (value > INT_MAX)
-          ReportError(s, "number is too big in format");
-        spec.width = value;
-      }
+  FMT_NORETURN void ReportSpecError(
+      const Char *s, const char *format, char spec) const {
+    char message[MAX_ERROR_MESSAGE_SIZE];
+    snprintf(message, sizeof(message), format, spec);
+    ReportError(s, message);
+  }
 
-      // Parse precision.
-      if (*s == '.') {
-        ++s;
-        precision = 0;
-        if ('0' <= *s && *s <= '9') {
-          unsigned value = ParseUInt(s);
-          if (value > INT_MAX)
-            ReportError(s, "number is too big in format");
-          precision = value;
-        } else if (*s == '{') {
-          ++s;
-          ++num_open_braces_;
-          const Arg &precision_arg = ParseArgIndex(s);
-          unsigned long value = 0;
-          switch (precision_arg.type) {
-          case INT:
-            if (precision_arg.int_value < 0)
-              ReportError(s, "negative precision in format");
-            value = precision_arg.int_value;
-            break;
-          case UINT:
-            value = precision_arg.uint_value;
-            break;
-          case LONG:
-            if (precision_arg.long_value < 0)
-              ReportError(s, "negative precision in format");
-            value = precision_arg.long_value;
-            break;
-          case ULONG:
-            value = precision_arg.ulong_value;
-            break;
-          default:
-            ReportError(s, "precision is not integer");
-          }
-          if (value > INT_MAX)
-            ReportError(s, "number is too big in format");
-          precision = value;
-          if (*s++ != '}')
-            throw FormatError("unmatched '{' in format");
-          --num_open_braces_;
-        } else {
-          ReportError(s, "missing precision in format");
-        }
-        if (arg.type != DOUBLE && arg.type != LONG_DOUBLE) {
-          ReportError(s,
-              "precision specifier requires floating-point argument");
-        }
-      }
+ public:
+  ArgChecker(const GenericFormatter &f, Type type,
+             const FormatParser<Char> *parser)
+  : formatter_(f), type_(type), parser_(parser) {}
 
-      // Parse type.
-      if (*s != '}' && *s)
-        spec.type = *s++;
+  void RequireNumeric(const Char *s, char spec) const {
+    if (type_ > LAST_NUMERIC_TYPE) {
+      ReportSpecError(s,
+          "format specifier '%c' requires numeric argument", spec);
     }
+  }
 
-    if (*s++ != '}')
-      throw FormatError("unmatched '{' in format");
-    start = s;
+  void RequireSigned(const Char *s, char spec) const {
+    RequireNumeric(s, spec);
+    if (type_ == UINT || type_ == ULONG || type_ == ULONG_LONG) {
+      ReportSpecError(s,
+          "format specifier '%c' requires signed argument", spec);
+    }
+  }
+
+  void RequireDouble(const Char *s) const {
+    if (type_ != DOUBLE && type_ != LONG_DOUBLE) {
+      ReportError(s,
+          "precision specifier requires floating-point argument");
+    }
+  }
 
-    // Format argument.
-    switch (arg.type) {
+  int GetPrecision(const Char *s, unsigned arg_index) const {
+    if (arg_index >= formatter_.num_args())
+      ReportError(s, "argument index is out of range in format");
+    const Value &precision_arg = formatter_.arg_values_[arg_index];
+    fmt::internal::ULongLong value = 0;
+    switch (formatter_.arg_type(arg_index)) {
     case INT:
-      FormatInt(arg.int_value, spec);
+      if (precision_arg.int_value < 0)
+        ReportError(s, "negative precision in format");
+      value = precision_arg.int_value;
       break;
     case UINT:
-      FormatInt(arg.uint_value, spec);
+      value = precision_arg.uint_value;
       break;
     case LONG:
-      FormatInt(arg.long_value, spec);
+      if (precision_arg.long_value < 0)
+        ReportError(s, "negative precision in format");
+      value = precision_arg.long_value;
       break;
     case ULONG:
-      FormatInt(arg.ulong_value, spec);
+      value = precision_arg.ulong_value;
       break;
-    case DOUBLE:
-      FormatDouble(arg.double_value, spec, precision);
+    case LONG_LONG:
+      if (precision_arg.long_long_value < 0)
+        ReportError(s, "negative precision in format");
+      value = precision_arg.long_long_value;
       break;
-    case LONG_DOUBLE:
-      FormatDouble(arg.long_double_value, spec, precision);
+    case ULONG_LONG:
+      value = precision_arg.ulong_long_value;
       break;
-    case CHAR: {
-      if (spec.type && spec.type != 'c')
-        ReportUnknownType(spec.type, "char");
-      char *out = 0;
-      if (spec.width > 1) {
-        out = GrowBuffer(spec.width);
-        if (spec.align == ALIGN_RIGHT) {
-          std::fill_n(out, spec.width - 1, spec.fill);
-          out += spec.width - 1;
-        } else if (spec.align == ALIGN_CENTER) {
-          out = FillPadding(out, spec.width, 1, spec.fill);
-        } else {
-          std::fill_n(out + 1, spec.width - 1, spec.fill);
-        }
+    default:
+      ReportError(s, "precision is not integer");
+    }
+    if (value > INT_MAX)
+      ReportError(s, "number is too big in format");
+    return static_cast<int>(value);
+  }
+};
+
+// Records the requirements of format specifiers in a field to check
+// them against the arguments when formatting.
+template <typename Char>
+class fmt::BasicCompiledFormat<Char>::SpecRecorder {
+ private:
+  Field &field_;
+  const FormatParser<Char> &parser_;
+
+ public:
+  SpecRecorder(Field &field, const FormatParser<Char> &parser)
+  : field_(field), parser_(parser) {}
+
+  void RequireNumeric(const Char *, char spec) {
+    if (!field_.numeric_spec)
+      field_.numeric_spec = spec;
+  }
+
+  void RequireSigned(const Char *s, char spec) {
+    RequireNumeric(s, spec);
+    field_.signed_spec = spec;
+  }
+
+  void RequireDouble(const Char *) { field_.requires_double = true; }
+
+  int GetPrecision(const Char *s, unsigned arg_index) {
+    if (arg_index >= INT_MAX)
+      parser_.ReportError(s, "argument index is out of range in format");
+    field_.precision_arg_index = arg_index;
+    return 0;
+  }
+};
+
+template <typename Char>
+fmt::BasicCompiledFormat<Char>::BasicCompiledFormat(
+    BasicStringRef<Char> format) : num_args_(0) {
+  FormatParser<Char> parser;
+  const Char *start = format.c_str();
+  const Char *s = start;
+  std::size_t literal_start = 0;
+  while (*(s = FindBrace(s))) {
+    Char c = *s++;
+    if (*s == c) {
+      literals_.append(start, s);
+      start = ++s;
+      continue;
+    }
+    if (c == '}')
+      fmt::internal::ReportError("unmatched '}' in format");
+    parser.num_open_braces = 1;
+    literals_.append(start, s - 1);
+
+    Field field = Field();
+    field.literal_size = literals_.size() - literal_start;
+    literal_start = literals_.size();
+    field.arg_index = parser.ParseArgIndex(s);
+    if (field.arg_index >= INT_MAX)
+      parser.ReportError(s, "argument index is out of range in format");
+    field.precision = -1;
+    field.precision_arg_index = -1;
+    if (*s == ':') {
+      ++s;
+      SpecRecorder recorder(field, parser);
+      parser.ParseSpec(s, field.spec, field.precision, recorder);
+    }
+    if (*s++ != '}')
+      fmt::internal::ReportError("unmatched '{' in format");
+    start = s;
+
+    num_args_ = std::max(num_args_, field.arg_index + 1);
+    if (field.precision_arg_index >= 0) {
+      num_args_ = std::max(num_args_,
+          static_cast<unsigned>(field.precision_arg_index) + 1);
+    }
+    fields_.push_back(field);
+  }
+  literals_.append(start, s);
+}
+
+template <typename Char>
+void GenericFormatter<Char>::FormatArg(
+    Type type, const Value &arg, FormatSpec &spec, int precision) {
+  switch (type) {
+  case INT:
+    this->FormatInt(arg.int_value, spec);
+    break;
+  case UINT:
+    this->FormatInt(arg.uint_value, spec);
+    break;
+  case LONG:
+    this->FormatInt(arg.long_value, spec);
+    break;
+  case ULONG:
+    this->FormatInt(arg.ulong_value, spec);
+    break;
+  case LONG_LONG:
+    this->FormatInt(arg.long_long_value, spec);
+    break;
+  case ULONG_LONG:
+    this->FormatInt(arg.ulong_long_value, spec);
+    break;
+  case DOUBLE:
+    this->FormatDouble(arg.double_value, spec, precision);
+    break;
+  case LONG_DOUBLE:
+    this->FormatDouble(arg.long_double_value, spec, precision);
+    break;
+  case CHAR: {
+    if (spec.type && spec.type != 'c')
+      ReportUnknownType(spec.type, "char");
+    Char *out = 0;
+    if (spec.width > 1) {
+      out = this->GrowBuffer(spec.width);
+      Char fill = static_cast<Char>(spec.fill);
+      if (spec.align == ALIGN_RIGHT) {
+        std::fill_n(out, spec.width - 1, fill);
+        out += spec.width - 1;
+      } else if (spec.align == ALIGN_CENTER) {
+        out = FillPadding(out, spec.width, 1, spec.fill);
       } else {
-        out = GrowBuffer(1);
+        std::fill_n(out + 1, spec.width - 1, fill);
       }
-      *out = arg.int_value;
-      break;
+    } else {
+      out = this->GrowBuffer(1);
     }
-    case STRING: {
-      if (spec.type && spec.type != 's')
-        ReportUnknownType(spec.type, "string");
-      const char *str = arg.string.value;
-      size_t size = arg.string.size;
-      if (size == 0) {
-        if (!str)
-          throw FormatError("string pointer is null");
-        if (*str)
-          size = std::strlen(str);
-      }
-      FormatString(str, size, spec);
-      break;
+    *out = static_cast<Char>(arg.int_value);
+    break;
+  }
+  case STRING: {
+    if (spec.type && spec.type != 's')
+      ReportUnknownType(spec.type, "string");
+    std::size_t size = GetStringSize(arg);
+    if (refs_ && size >= refs_->min_size && spec.width <= size)
+      AddRef(arg.string.value, size);
+    else
+      this->FormatString(arg.string.value, size, spec);
+    break;
+  }
+  case POINTER:
+    if (spec.type && spec.type != 'p')
+      ReportUnknownType(spec.type, "pointer");
+    spec.flags = HASH_FLAG;
+    spec.type = 'x';
+    this->FormatInt(reinterpret_cast<uintptr_t>(arg.pointer_value), spec);
+    break;
+  case CUSTOM:
+    if (spec.type)
+      ReportUnknownType(spec.type, "object");
+    (this->*arg.custom.format)(arg.custom.value, spec);
+    break;
+  default:
+    assert(false);
+    break;
+  }
+}
+
+template <typename Char>
+std::size_t GenericFormatter<Char>::GetStringSize(const Value &arg) {
+  const Char *str = arg.string.value;
+  size_t size = arg.string.size;
+  if (size == 0) {
+    if (!str)
+      fmt::internal::ReportError("string pointer is null");
+    if (*str)
+      size = std::char_traits<Char>::length(str);
+  }
+  return size;
+}
+
+template <typename Char>
+std::size_t GenericFormatter<Char>::CountArg(
+    Type type, const Value &arg, FormatSpec &spec, int precision) {
+  switch (type) {
+  case INT:
+    return CountIntChars(arg.int_value, spec);
+  case UINT:
+    return CountIntChars(arg.uint_value, spec);
+  case LONG:
+    return CountIntChars(arg.long_value, spec);
+  case ULONG:
+    return CountIntChars(arg.ulong_value, spec);
+  case LONG_LONG:
+    return CountIntChars(arg.long_long_value, spec);
+  case ULONG_LONG:
+    return CountIntChars(arg.ulong_long_value, spec);
+  case CHAR:
+    if (spec.type && spec.type != 'c')
+      ReportUnknownType(spec.type, "char");
+    return std::max<std::size_t>(spec.width, 1);
+  case STRING:
+    if (spec.type && spec.type != 's')
+      ReportUnknownType(spec.type, "string");
+    return std::max<std::size_t>(spec.width, GetStringSize(arg));
+  case POINTER:
+    if (spec.type && spec.type != 'p')
+      ReportUnknownType(spec.type, "pointer");
+    spec.flags = HASH_FLAG;
+    spec.type = 'x';
+    return CountIntChars(reinterpret_cast<uintptr_t>(arg.pointer_value), spec);
+  default:
+    break;
+  }
+  // The length of a floating-point number or an object of a custom type
+  // is only known after generating its characters, so format it and
+  // discard the output.
+  std::size_t start = this->buffer_.size();
+  FormatArg(type, arg, spec, precision);
+  std::size_t size = this->buffer_.size() - start;
+  this->buffer_.resize(start);
+  return size;
+}
+
+// Provides access to the cached compiled format for a format string.
+// Only char format strings are cached.
+template <typename Char>
+class fmt::internal::CachedFormatRef {
+ public:
+  explicit CachedFormatRef(const Char *) {}
+  const BasicCompiledFormat<Char> *get() const { return 0; }
+  void Insert() {}
+};
+
+#if FMT_USE_THREAD_LOCAL
+template <>
+class fmt::internal::CachedFormatRef<char> {
+ private:
+  FormatCache &cache_;
+  const char *format_string_;
+  const CompiledFormat *format_;
+
+  // Do not implement!
+  CachedFormatRef(const CachedFormatRef &);
+  void operator=(const CachedFormatRef &);
+
+ public:
+  explicit CachedFormatRef(const char *format)
+  : cache_(GetThreadFormatCache()), format_string_(format), format_(0) {
+    if (cache_.max_size() != 0)
+      format_ = cache_.Acquire(format);
+  }
+
+  ~CachedFormatRef() {
+    if (format_)
+      cache_.Release();
+  }
+
+  const CompiledFormat *get() const { return format_; }
+
+  // Caches the format string after it has been formatted on a miss.
+  // Invalid formats are never cached, so errors are reported by the
+  // interpreter whether the cache is enabled or not.
+  void Insert() {
+    if (cache_.max_size() != 0)
+      cache_.Insert(format_string_);
+  }
+};
+#endif
+
+#if FMT_USE_FORMAT_STATS
+thread_local std::size_t fmt::internal::num_array_grows;
+
+namespace {
+// The writer of the innermost formatting operation whose statistics are
+// being recorded. Nested operations with the same writer, such as
+// formatting with a cached compiled format, are parts of the outer one.
+thread_local const void *stats_writer;
+
+inline fmt::internal::ULongLong ReadCycleCounter() {
+#ifdef FMT_RDTSC
+  return FMT_RDTSC();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Copies the beginning of a format string to text escaping special
+// characters and replacing non-ASCII ones with '?'.
+template <typename Char>
+void CopyFormatText(char *text, const Char *s) {
+  char *end = text + fmt::FormatStats::MAX_TEXT_SIZE - 1;
+  for (; *s && text != end; ++s) {
+    const char *escape = 0;
+    switch (*s) {
+    case '\n': escape = "\\n"; break;
+    case '\t': escape = "\\t"; break;
+    case '"':  escape = "\\\""; break;
+    case '\\': escape = "\\\\"; break;
     }
-    case POINTER:
-      if (spec.type && spec.type != 'p')
-        ReportUnknownType(spec.type, "pointer");
-      spec.flags = HASH_FLAG;
-      spec.type = 'x';
-      FormatInt(reinterpret_cast<uintptr_t>(arg.pointer_value), spec);
-      break;
-    case CUSTOM:
-      if (spec.type)
-        ReportUnknownType(spec.type, "object");
-      (this->*arg.custom.format)(arg.custom.value, spec);
-      break;
-    default:
-      assert(false);
-      break;
+    if (escape) {
+      if (end - text < 2) break;
+      *text++ = escape[0];
+      *text++ = escape[1];
+    } else {
+      *text++ = *s >= 0x20 && *s < 0x7f ? static_cast<char>(*s) : '?';
+    }
+  }
+  *text = '\0';
+}
+}
+
+// Records statistics of a formatting operation writing to writer when
+// it is complete.
+template <typename Char>
+class fmt::internal::FormatStatsScope {
+ private:
+  const BasicWriter<Char> &writer_;
+  const void *format_;
+  const Char *text_;
+  const void *outer_writer_;
+  std::size_t start_size_;
+  std::size_t start_grows_;
+  ULongLong start_cycles_;
+  bool active_;
+  bool sampled_;
+
+  // Do not implement!
+  FormatStatsScope(const FormatStatsScope &);
+  void operator=(const FormatStatsScope &);
+
+ public:
+  // Starts recording an operation with the format. text is the format
+  // string or null for a compiled format. Counting operations are not
+  // recorded.
+  FormatStatsScope(const BasicWriter<Char> &writer, const void *format,
+                   const Char *text, bool counting)
+  : writer_(writer), format_(format), text_(text),
+    outer_writer_(stats_writer), start_size_(writer.size()),
+    start_grows_(num_array_grows), start_cycles_(0),
+    active_(!counting && stats_writer != &writer), sampled_(false) {
+    if (!active_) return;
+    stats_writer = &writer;
+    FormatStats &stats = GetThreadFormatStats();
+    if (++stats.sample_counter_ == FormatStats::SAMPLE_PERIOD) {
+      stats.sample_counter_ = 0;
+      sampled_ = true;
+      start_cycles_ = ReadCycleCounter();
     }
   }
-  buffer_.append(start, s);
+
+  ~FormatStatsScope() {
+    if (!active_) return;
+    ULongLong cycles = sampled_ ? ReadCycleCounter() - start_cycles_ : 0;
+    stats_writer = outer_writer_;
+    FormatStats::Entry &entry = GetThreadFormatStats().GetEntry(format_);
+    if (entry.calls == 0) {
+      entry.compiled = !text_;
+      if (text_)
+        CopyFormatText(entry.text, text_);
+    }
+    ++entry.calls;
+    std::size_t size = writer_.size();
+    if (size > start_size_)
+      entry.bytes += size - start_size_;
+    entry.grows += num_array_grows - start_grows_;
+    if (sampled_) {
+      ++entry.samples;
+      entry.cycles += cycles;
+    }
+  }
+};
+#endif
+
+template <typename Char>
+void GenericFormatter<Char>::DoFormat() {
+  const Char *start = format_;
+  format_ = 0;
+#if FMT_USE_FORMAT_STATS
+  fmt::internal::FormatStatsScope<Char> stats_scope(
+      *this, start, start, count_ != 0);
+#endif
+  fmt::internal::CachedFormatRef<Char> cached_format(start);
+  if (cached_format.get()) {
+    DoFormat(*cached_format.get());
+    return;
+  }
+  FormatParser<Char> parser;
+  const Char *s = start;
+  while (*(s = FindBrace(s))) {
+    Char c = *s++;
+    if (*s == c) {
+      AppendLiteral(start, s);
+      start = ++s;
+      continue;
+    }
+    if (c == '}')
+      fmt::internal::ReportError("unmatched '}' in format");
+    parser.StartField(s);
+    AppendLiteral(start, s - 1);
+
+    unsigned arg_index = parser.ParseArgIndex(s);
+    if (arg_index >= num_args())
+      parser.ReportArgError("argument index is out of range in format");
+    Type type = arg_type(arg_index);
+    const Value &arg = arg_values_[arg_index];
+
+    FormatSpec spec;
+    int precision = -1;
+    if (*s == ':') {
+      ++s;
+      ArgChecker checker(*this, type, &parser);
+      parser.ParseSpec(s, spec, precision, checker);
+    }
+
+    if (*s++ != '}')
+      fmt::internal::ReportError("unmatched '{' in format");
+    start = s;
+
+    if (count_)
+      *count_ += CountArg(type, arg, spec, precision);
+    else
+      FormatArg(type, arg, spec, precision);
+  }
+  AppendLiteral(start, s);
+  cached_format.Insert();
+}
+
+template <typename Char>
+void GenericFormatter<Char>::DoFormat(
+    const BasicCompiledFormat<Char> &format) {
+  typedef typename BasicCompiledFormat<Char>::Field Field;
+  compiled_format_ = 0;
+#if FMT_USE_FORMAT_STATS
+  fmt::internal::FormatStatsScope<Char> stats_scope(
+      *this, &format, static_cast<const Char*>(0), count_ != 0);
+#endif
+  const Char *literal = format.literals_.data();
+  for (typename std::vector<Field>::const_iterator
+       i = format.fields_.begin(), end = format.fields_.end(); i != end; ++i) {
+    const Field &field = *i;
+    AppendLiteral(literal, literal + field.literal_size);
+    literal += field.literal_size;
+    // Arguments are checked field by field to report errors in the same
+    // order as the interpreter.
+    if (field.arg_index >= num_args())
+      fmt::internal::ReportError("argument index is out of range in format");
+    Type type = arg_type(field.arg_index);
+    const Value &arg = arg_values_[field.arg_index];
+    FormatSpec spec = field.spec;
+    int precision = field.precision;
+    if (field.numeric_spec || field.requires_double) {
+      ArgChecker checker(*this, type, 0);
+      if (field.numeric_spec)
+        checker.RequireNumeric(0, field.numeric_spec);
+      if (field.signed_spec)
+        checker.RequireSigned(0, field.signed_spec);
+      if (field.precision_arg_index >= 0)
+        precision = checker.GetPrecision(0, field.precision_arg_index);
+      if (field.requires_double)
+        checker.RequireDouble(0);
+    }
+    if (count_)
+      *count_ += CountArg(type, arg, spec, precision);
+    else
+      FormatArg(type, arg, spec, precision);
+  }
+  AppendLiteral(literal, format.literals_.data() + format.literals_.size());
+}
+
+// Explicit instantiations for the supported character types.
+#define FMT_INSTANTIATE(Char) \
+  template class fmt::BasicWriter<Char>; \
+  template void GenericFormatter<Char>::DoFormat(); \
+  template void GenericFormatter<Char>::DoFormat( \
+      const fmt::BasicCompiledFormat<Char> &format); \
+  template std::size_t GenericFormatter<Char>::GetStringSize( \
+      const GenericFormatter<Char>::Value &arg); \
+  template class fmt::BasicCompiledFormat<Char>; \
+  template void BasicWriter<Char>::FormatInt<int>( \
+      int value, const FormatSpec &spec); \
+  template void BasicWriter<Char>::FormatInt<unsigned>( \
+      unsigned value, const FormatSpec &spec); \
+  template void BasicWriter<Char>::FormatInt<long>( \
+      long value, const FormatSpec &spec); \
+  template void BasicWriter<Char>::FormatInt<unsigned long>( \
+      unsigned long value, const FormatSpec &spec); \
+  template void BasicWriter<Char>::FormatInt<fmt::internal::LongLong>( \
+      fmt::internal::LongLong value, const FormatSpec &spec); \
+  template void BasicWriter<Char>::FormatInt<fmt::internal::ULongLong>( \
+      fmt::internal::ULongLong value, const FormatSpec &spec); \
+  template void BasicWriter<Char>::FormatDouble<double>( \
+      double value, const FormatSpec &spec, int precision); \
+  template void BasicWriter<Char>::FormatDouble<long double>( \
+      long double value, const FormatSpec &spec, int precision); \
+  template void BasicWriter<Char>::FormatInts<int>( \
+      const int *begin, const int *end, Char sep); \
+  template void BasicWriter<Char>::FormatInts<unsigned>( \
+      const unsigned *begin, const unsigned *end, Char sep); \
+  template void BasicWriter<Char>::FormatInts<long>( \
+      const long *begin, const long *end, Char sep); \
+  template void BasicWriter<Char>::FormatInts<unsigned long>( \
+      const unsigned long *begin, const unsigned long *end, Char sep); \
+  template void BasicWriter<Char>::FormatInts<fmt::internal::LongLong>( \
+      const fmt::internal::LongLong *begin, \
+      const fmt::internal::LongLong *end, Char sep); \
+  template void BasicWriter<Char>::FormatInts<fmt::internal::ULongLong>( \
+      const fmt::internal::ULongLong *begin, \
+      const fmt::internal::ULongLong *end, Char sep);
+
+FMT_INSTANTIATE(char)
+FMT_INSTANTIATE(wchar_t)
+#if FMT_USE_CHAR16
+FMT_INSTANTIATE(char16_t)
+#endif
+#undef FMT_INSTANTIATE
+
+namespace {
+// A header stored before each block allocated by BufferCache. The union
+// keeps the block aligned for any object type.
+union BlockHeader {
+  std::size_t size;
+  double align_double;
+  long double align_long_double;
+  void *align_pointer;
+};
+}
+
+fmt::BufferCache::~BufferCache() {
+  while (num_blocks_ != 0)
+    ReleaseBlock(num_blocks_ - 1);
+}
+
+void fmt::BufferCache::ReleaseBlock(std::size_t index) {
+  retained_size_ -= blocks_[index].size;
+  ::operator delete(blocks_[index].ptr);
+  blocks_[index] = blocks_[--num_blocks_];
+}
+
+void fmt::BufferCache::set_max_retained_size(std::size_t size) {
+  max_retained_size_ = size;
+  while (retained_size_ > max_retained_size_) {
+    // Release the smallest block.
+    std::size_t smallest = 0;
+    for (std::size_t i = 1; i < num_blocks_; ++i) {
+      if (blocks_[i].size < blocks_[smallest].size)
+        smallest = i;
+    }
+    ReleaseBlock(smallest);
+  }
+}
+
+void *fmt::BufferCache::Allocate(std::size_t size) {
+  // Find the smallest retained block that is large enough.
+  std::size_t best = num_blocks_;
+  for (std::size_t i = 0; i < num_blocks_; ++i) {
+    if (blocks_[i].size >= size &&
+        (best == num_blocks_ || blocks_[i].size < blocks_[best].size)) {
+      best = i;
+    }
+  }
+  BlockHeader *header = 0;
+  if (best != num_blocks_) {
+    header = static_cast<BlockHeader*>(blocks_[best].ptr);
+    retained_size_ -= blocks_[best].size;
+    blocks_[best] = blocks_[--num_blocks_];
+  } else {
+    header = static_cast<BlockHeader*>(
+        ::operator new(sizeof(BlockHeader) + size));
+    header->size = size;
+  }
+  return header + 1;
+}
+
+void fmt::BufferCache::Deallocate(void *p, std::size_t) {
+  BlockHeader *header = static_cast<BlockHeader*>(p) - 1;
+  std::size_t size = header->size;
+  // Make room by releasing smaller blocks since larger ones are more
+  // likely to be reused by growing buffers.
+  while (num_blocks_ == MAX_BLOCKS ||
+         retained_size_ + size > max_retained_size_) {
+    std::size_t smallest = 0;
+    for (std::size_t i = 1; i < num_blocks_; ++i) {
+      if (blocks_[i].size < blocks_[smallest].size)
+        smallest = i;
+    }
+    if (num_blocks_ == 0 || blocks_[smallest].size >= size ||
+        size > max_retained_size_) {
+      ::operator delete(header);
+      return;
+    }
+    ReleaseBlock(smallest);
+  }
+  Block block = {header, size};
+  blocks_[num_blocks_++] = block;
+  retained_size_ += size;
+}
+
+namespace {
+// Returns the index of the entry for a format string in a cache of the
+// given size.
+inline std::size_t GetEntryIndex(const void *format, std::size_t size) {
+  // Mix the bits since string literals are often aligned.
+  uintptr_t p = reinterpret_cast<uintptr_t>(format);
+  p = (p ^ (p >> 16)) * 0x45d9f3b;
+  return (p ^ (p >> 16)) % size;
+}
+}
+
+const fmt::CompiledFormat *fmt::FormatCache::Acquire(const char *format) {
+  Entry &entry = entries_[GetEntryIndex(format, entries_.size())];
+  if (entry.format == format) {
+    ++hits_;
+    ++num_refs_;
+    return entry.compiled_format;
+  }
+  ++misses_;
+  return 0;
+}
+
+void fmt::FormatCache::Insert(const char *format) {
+  Entry &entry = entries_[GetEntryIndex(format, entries_.size())];
+  // The format may have been inserted by a nested formatting operation
+  // and a replaced format may be in use by an outer one.
+  if (entry.format == format || (entry.compiled_format && num_refs_ != 0))
+    return;
+  CompiledFormat *compiled_format = new CompiledFormat(format);
+  if (entry.compiled_format)
+    delete entry.compiled_format;
+  else
+    ++size_;
+  entry.format = format;
+  entry.compiled_format = compiled_format;
+}
+
+void fmt::FormatCache::set_max_size(std::size_t size) {
+  Clear();
+  std::vector<Entry>(size).swap(entries_);
+}
+
+void fmt::FormatCache::Clear() {
+  for (std::size_t i = 0, n = entries_.size(); i != n; ++i) {
+    delete entries_[i].compiled_format;
+    entries_[i].format = 0;
+    entries_[i].compiled_format = 0;
+  }
+  size_ = hits_ = misses_ = 0;
+}
+
+#if FMT_USE_FORMAT_STATS
+fmt::FormatStats::Entry &fmt::FormatStats::GetEntry(const void *format) {
+  if (2 * (size_ + 1) > entries_.size()) {
+    // Rehash into a larger table keeping the load factor at most 1/2.
+    std::vector<Entry> entries(entries_.empty() ? 64 : 2 * entries_.size());
+    for (std::size_t i = 0, n = entries_.size(); i != n; ++i) {
+      if (!entries_[i].format) continue;
+      std::size_t index = GetEntryIndex(entries_[i].format, entries.size());
+      while (entries[index].format)
+        index = (index + 1) % entries.size();
+      entries[index] = entries_[i];
+    }
+    entries_.swap(entries);
+  }
+  std::size_t index = GetEntryIndex(format, entries_.size());
+  while (entries_[index].format && entries_[index].format != format)
+    index = (index + 1) % entries_.size();
+  Entry &entry = entries_[index];
+  if (!entry.format) {
+    entry.format = format;
+    ++size_;
+  }
+  return entry;
+}
+
+namespace {
+// Returns the estimated total time of the operations with a format.
+double EstimateTime(const fmt::FormatStats::Entry &e) {
+  return e.samples != 0 ?
+      static_cast<double>(e.cycles) * e.calls / e.samples : 0;
+}
+
+bool ComesBefore(const fmt::FormatStats::Entry &lhs,
+                 const fmt::FormatStats::Entry &rhs) {
+  double lhs_time = EstimateTime(lhs), rhs_time = EstimateTime(rhs);
+  return lhs_time != rhs_time ? lhs_time > rhs_time : lhs.calls > rhs.calls;
+}
+}
+
+std::vector<fmt::FormatStats::Entry> fmt::FormatStats::GetEntries() const {
+  std::vector<Entry> entries;
+  entries.reserve(size_);
+  for (std::size_t i = 0, n = entries_.size(); i != n; ++i) {
+    if (entries_[i].format)
+      entries.push_back(entries_[i]);
+  }
+  std::sort(entries.begin(), entries.end(), ComesBefore);
+  return entries;
+}
+
+void fmt::FormatStats::Dump(std::FILE *file) const {
+  std::vector<Entry> entries = GetEntries();
+  std::fprintf(file, "%10s %12s %8s %12s  %s\n",
+               "calls", "bytes", "grows", "cycles/call", "format");
+  for (std::size_t i = 0, n = entries.size(); i != n; ++i) {
+    const Entry &e = entries[i];
+    std::fprintf(file, "%10llu %12llu %8llu %12llu  ",
+        static_cast<internal::ULongLong>(e.calls),
+        static_cast<internal::ULongLong>(e.bytes),
+        static_cast<internal::ULongLong>(e.grows),
+        e.samples != 0 ? e.cycles / e.samples : 0);
+    if (e.compiled)
+      std::fprintf(file, "compiled format %p\n", e.format);
+    else
+      std::fprintf(file, "\"%s\"\n", e.text);
+  }
+}
+
+void fmt::FormatStats::Clear() {
+  std::vector<Entry>().swap(entries_);
+  size_ = 0;
+}
+
+fmt::FormatStats &fmt::GetThreadFormatStats() {
+  static thread_local FormatStats stats;
+  return stats;
+}
+#endif
+
+#if FMT_USE_THREAD_LOCAL
+fmt::FormatCache &fmt::GetThreadFormatCache() {
+  static thread_local FormatCache cache;
+  return cache;
+}
+
+fmt::BufferCache &fmt::GetThreadBufferCache() {
+  static thread_local BufferCache cache;
+  return cache;
+}
+
+fmt::Allocator *fmt::internal::GetTempAllocator() {
+  BufferCache &cache = GetThreadBufferCache();
+  return cache.max_retained_size() != 0 ? &cache : 0;
+}
+#endif
+
+namespace {
+void DefaultErrorHandler(const char *message, int error_code) {
+#if FMT_EXCEPTIONS
+  if (error_code != 0)
+    throw fmt::SystemError(message, error_code);
+  throw fmt::FormatError(message);
+#else
+  std::fprintf(stderr, "%s\n", message);
+  (void)error_code;
+  std::abort();
+#endif
+}
+
+fmt::ErrorHandler error_handler = DefaultErrorHandler;
+
+// Reports a system error with the message followed by the description
+// of error_code.
+FMT_NORETURN void ReportSystemError(const char *message, int error_code) {
+  char full_message[MAX_ERROR_MESSAGE_SIZE];
+  snprintf(full_message, sizeof(full_message),
+      "%s: %s", message, std::strerror(error_code));
+  fmt::internal::ReportError(full_message, error_code);
+}
+
+FMT_NORETURN void ReportWriteError(int error_code) {
+  ReportSystemError("cannot write to file", error_code);
+}
+}
+
+fmt::ErrorHandler fmt::SetErrorHandler(ErrorHandler handler) {
+  ErrorHandler previous = error_handler;
+  error_handler = handler ? handler : DefaultErrorHandler;
+  return previous;
+}
+
+void fmt::internal::ReportError(const char *message, int error_code) {
+  error_handler(message, error_code);
+  // The handler is not supposed to return.
+  std::abort();
+}
+
+void fmt::FileOutput::operator()(const char *data, std::size_t size) const {
+  if (std::fwrite(data, 1, size, file_) != size)
+    ReportWriteError(errno);
+}
+
+void fmt::FdOutput::operator()(const char *data, std::size_t size) const {
+  while (size != 0) {
+    // Windows' _write takes the size as unsigned.
+    std::size_t chunk_size = std::min(size, static_cast<std::size_t>(INT_MAX));
+    int count = static_cast<int>(FMT_POSIX(write)(fd_, data,
+        static_cast<unsigned>(chunk_size)));
+    if (count < 0) {
+      if (errno == EINTR) continue;
+      ReportWriteError(errno);
+    }
+    // Nothing written for a non-zero size would make the loop spin.
+    if (count == 0)
+      ReportWriteError(EIO);
+    data += count;
+    size -= count;
+  }
+}
+
+#ifndef _WIN32
+namespace {
+#ifdef IOV_MAX
+enum { MAX_PIECES = IOV_MAX < 64 ? IOV_MAX : 64 };
+#else
+enum { MAX_PIECES = 16 };
+#endif
+
+// Writes pieces with writev retrying on partial writes and interrupts.
+void WritePieces(int fd, iovec *pieces, std::size_t num_pieces) {
+  while (num_pieces != 0) {
+    ssize_t count = writev(fd, pieces, static_cast<int>(num_pieces));
+    if (count < 0) {
+      if (errno == EINTR) continue;
+      ReportWriteError(errno);
+    }
+    // The pieces are not empty, so nothing written would make the loop spin.
+    if (count == 0)
+      ReportWriteError(EIO);
+    // Skip the written pieces and the written part of a partial one.
+    std::size_t n = count;
+    for (; num_pieces != 0 && n >= pieces->iov_len; --num_pieces, ++pieces)
+      n -= pieces->iov_len;
+    if (n != 0) {
+      pieces->iov_base = static_cast<char*>(pieces->iov_base) + n;
+      pieces->iov_len -= n;
+    }
+  }
+}
+
+// Collects output pieces writing them once MAX_PIECES are collected.
+class PieceWriter {
+ private:
+  int fd_;
+  std::size_t num_pieces_;
+  iovec pieces_[MAX_PIECES];
+
+ public:
+  explicit PieceWriter(int fd) : fd_(fd), num_pieces_(0) {}
+
+  void Add(const char *data, std::size_t size) {
+    if (size == 0) return;
+    if (num_pieces_ == MAX_PIECES)
+      Flush();
+    iovec &piece = pieces_[num_pieces_++];
+    piece.iov_base = const_cast<char*>(data);
+    piece.iov_len = size;
+  }
+
+  void Flush() {
+    WritePieces(fd_, pieces_, num_pieces_);
+    num_pieces_ = 0;
+  }
+};
+}
+#else
+namespace {
+// Writes output pieces one by one since Windows has no writev.
+class PieceWriter {
+ private:
+  fmt::FdOutput output_;
+
+ public:
+  explicit PieceWriter(int fd) : output_(fd) {}
+
+  void Add(const char *data, std::size_t size) { output_(data, size); }
+  void Flush() {}
+};
+}
+#endif
+
+std::size_t fmt::GatherSink::size() const {
+  std::size_t size = formatter_.size();
+  for (std::size_t i = 0, n = refs_.refs.size(); i != n; ++i)
+    size += refs_.refs[i].size;
+  return size;
+}
+
+#ifndef _WIN32
+namespace {
+// Returns true if a file offset fits into off_t which is 32-bit on some
+// systems without large file support.
+inline bool IsValidOffset(fmt::internal::ULongLong offset) {
+  return offset <= static_cast<fmt::internal::ULongLong>(
+      std::numeric_limits<off_t>::max());
+}
+}
+
+fmt::MappedFileSink::MappedFileSink(const char *path, std::size_t chunk_size)
+: fd_(-1), window_(0), window_size_(0), window_offset_(0) {
+  std::size_t page_size = sysconf(_SC_PAGESIZE);
+  chunk_size_ = (std::max<std::size_t>(chunk_size, 1) + page_size - 1) /
+      page_size * page_size;
+  int fd = 0;
+  do {
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  } while (fd < 0 && errno == EINTR);
+  if (fd < 0)
+    ReportSystemError("cannot open file", errno);
+  fd_ = fd;
+  Remap();
+}
+
+void fmt::MappedFileSink::Remap() {
+  std::size_t page_size = sysconf(_SC_PAGESIZE);
+  internal::ULongLong end = size();
+  // Output that didn't fit into the window is in dynamically allocated
+  // memory and is copied to a window starting at the same offset.
+  bool in_window = formatter_.data() == window_;
+  internal::ULongLong offset =
+      in_window ? end / page_size * page_size : window_offset_;
+  std::size_t used = static_cast<std::size_t>(end - offset);
+  std::size_t size = std::max(chunk_size_,
+      (used + chunk_size_ / 2 + page_size - 1) / page_size * page_size);
+  if (!IsValidOffset(offset + size))
+    ReportSystemError("cannot resize file", EFBIG);
+  if (ftruncate(fd_, static_cast<off_t>(offset + size)) != 0)
+    ReportSystemError("cannot resize file", errno);
+  void *window = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd_, static_cast<off_t>(offset));
+  if (window == MAP_FAILED)
+    ReportSystemError("cannot map file", errno);
+  char *data = static_cast<char*>(window);
+  if (!in_window)
+    std::memcpy(data, formatter_.data(), used);
+  if (window_)
+    munmap(window_, window_size_);
+  window_ = data;
+  window_size_ = size;
+  window_offset_ = offset;
+  formatter_.SetWindow(data, size, used);
+}
+
+void fmt::MappedFileSink::Close() {
+  if (fd_ < 0) return;
+  if (formatter_.data() != window_)
+    Remap();
+  internal::ULongLong end = size();
+  munmap(window_, window_size_);
+  window_ = 0;
+  window_size_ = 0;
+  formatter_.SetWindow(0, 0, 0);
+  window_offset_ = end;
+  int fd = fd_;
+  fd_ = -1;
+  int result = -1;
+  int error_code = EFBIG;
+  if (IsValidOffset(end)) {
+    result = ftruncate(fd, static_cast<off_t>(end));
+    error_code = errno;
+  }
+  if (close(fd) != 0 && result == 0) {
+    result = -1;
+    error_code = errno;
+  }
+  if (result != 0)
+    ReportSystemError("cannot close file", error_code);
+}
+#endif
+
+void fmt::GatherSink::Flush() {
+  const char *data = formatter_.data();
+  std::size_t offset = 0;
+  PieceWriter writer(fd_);
+  for (std::size_t i = 0, n = refs_.refs.size(); i != n; ++i) {
+    const internal::OutputRef<char> &ref = refs_.refs[i];
+    writer.Add(data + offset, ref.offset - offset);
+    writer.Add(ref.data, ref.size);
+    offset = ref.offset;
+  }
+  writer.Add(data + offset, formatter_.size() - offset);
+  writer.Flush();
+  formatter_.Clear();
+  refs_.refs.clear();
 }
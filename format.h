@@ -28,40 +28,211 @@
 #ifndef FORMAT_H_
 #define FORMAT_H_
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdio>
 #include <cstring>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <sstream>
+#include <utility>
 #include <vector>
 #include "sprint.h"
 
+// Formatting is performed in destructors of temporary objects and errors
+// are reported by throwing FormatError from there. Since C++11 destructors
+// are implicitly noexcept, so they have to be marked explicitly.
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+# define FMT_DTOR_THROWS noexcept(false)
+#else
+# define FMT_DTOR_THROWS
+#endif
+
+// Errors are reported with exceptions unless they are disabled, for example,
+// with -fno-exceptions. Without exceptions errors are passed to the error
+// handler set with SetErrorHandler.
+#ifndef FMT_EXCEPTIONS
+# if (defined(__GNUC__) && !defined(__EXCEPTIONS)) || \
+     (defined(_MSC_VER) && !defined(_CPPUNWIND))
+#  define FMT_EXCEPTIONS 0
+# else
+#  define FMT_EXCEPTIONS 1
+# endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+# define FMT_NORETURN __attribute__((noreturn))
+#elif defined(_MSC_VER)
+# define FMT_NORETURN __declspec(noreturn)
+#else
+# define FMT_NORETURN
+#endif
+
+#ifndef FMT_USE_VARIADIC_TEMPLATES
+# if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1800)
+#  define FMT_USE_VARIADIC_TEMPLATES 1
+# else
+#  define FMT_USE_VARIADIC_TEMPLATES 0
+# endif
+#endif
+
+#ifndef FMT_USE_RVALUE_REFERENCES
+# if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1600)
+#  define FMT_USE_RVALUE_REFERENCES 1
+# else
+#  define FMT_USE_RVALUE_REFERENCES 0
+# endif
+#endif
+
+// Checking format strings at compile time requires relaxed constexpr
+// functions from C++14.
+#ifndef FMT_USE_FORMAT_CHECK
+# if FMT_USE_VARIADIC_TEMPLATES && (__cplusplus >= 201402L || \
+    (defined(_MSC_VER) && _MSC_VER >= 1910))
+#  define FMT_USE_FORMAT_CHECK 1
+# else
+#  define FMT_USE_FORMAT_CHECK 0
+# endif
+#endif
+
+#ifndef FMT_USE_CHAR16
+# if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#  define FMT_USE_CHAR16 1
+# else
+#  define FMT_USE_CHAR16 0
+# endif
+#endif
+
+#ifndef FMT_USE_THREAD_LOCAL
+# if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#  define FMT_USE_THREAD_LOCAL 1
+# else
+#  define FMT_USE_THREAD_LOCAL 0
+# endif
+#endif
+
+// Collecting statistics of formatting operations should be enabled both
+// when compiling the library and its users.
+#ifndef FMT_USE_FORMAT_STATS
+# define FMT_USE_FORMAT_STATS 0
+#endif
+
+#if FMT_USE_FORMAT_STATS && !FMT_USE_THREAD_LOCAL
+# error "FMT_USE_FORMAT_STATS requires thread_local"
+#endif
+
+#ifndef FMT_USE_STRING_VIEW
+# if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#  define FMT_USE_STRING_VIEW 1
+# else
+#  define FMT_USE_STRING_VIEW 0
+# endif
+#endif
+
+#if FMT_USE_FORMAT_CHECK
+# include <type_traits>
+#endif
+
+#if FMT_USE_STRING_VIEW
+# include <string_view>
+#endif
+
 namespace format {
 
 namespace internal {
 
-// A simple array for POD types with the first SIZE elements stored in
-// the object itself. It supports a subset of std::vector's operations.
-template <typename T, std::size_t SIZE>
-class Array {
+// long long is an extension in C++98 supported by all major compilers.
+#ifdef __GNUC__
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wlong-long"
+#endif
+typedef long long LongLong;
+typedef unsigned long long ULongLong;
+#ifdef __GNUC__
+# pragma GCC diagnostic pop
+#endif
+
+#if FMT_USE_FORMAT_STATS
+// The number of times arrays of the current thread have grown.
+extern thread_local std::size_t num_array_grows;
+#endif
+
+// A simple array for POD types with the first elements stored in the
+// inline storage provided by the owner of the buffer, such as Array.
+// It supports a subset of std::vector's operations. Memory for elements
+// that don't fit is obtained from Allocator which only needs to provide
+// allocate and deallocate.
+template <typename T, typename Allocator = std::allocator<T> >
+class Buffer : private Allocator {
  private:
   std::size_t size_;
   std::size_t capacity_;
   T *ptr_;
-  T data_[SIZE];
+  T *data_;  // Inline storage.
+  std::size_t inline_size_;
 
   void Grow(std::size_t size);
 
+  void Free() {
+    if (ptr_ != data_) this->deallocate(ptr_, capacity_);
+  }
+
+  // Moves the elements from other to this buffer leaving other empty.
+  // Dynamically allocated memory is taken over without copying.
+  void MoveFrom(Buffer &other) {
+    size_ = other.size_;
+    if (other.ptr_ != other.data_) {
+      ptr_ = other.ptr_;
+      capacity_ = other.capacity_;
+      other.ptr_ = other.data_;
+      other.capacity_ = other.inline_size_;
+    } else if (size_ <= inline_size_) {
+      ptr_ = data_;
+      capacity_ = inline_size_;
+      std::copy(other.data_, other.data_ + size_, data_);
+    } else {
+      // The inline storage of other is larger than this one.
+      ptr_ = this->allocate(size_);
+      capacity_ = size_;
+      std::copy(other.data_, other.data_ + size_, ptr_);
+    }
+    other.size_ = 0;
+  }
+
   // Do not implement!
-  Array(const Array &);
-  void operator=(const Array &);
+  Buffer(const Buffer &);
+  void operator=(const Buffer &);
 
  public:
-  Array() : size_(0), capacity_(SIZE), ptr_(data_) {}
-  ~Array() {
-    if (ptr_ != data_) delete [] ptr_;
+  // Constructs an empty buffer with inline storage of size elements
+  // at data. The storage should outlive the buffer.
+  Buffer(T *data, std::size_t size, const Allocator &alloc = Allocator())
+  : Allocator(alloc), size_(0), capacity_(size), ptr_(data),
+    data_(data), inline_size_(size) {}
+  ~Buffer() { Free(); }
+
+#if FMT_USE_RVALUE_REFERENCES
+  // Constructs a buffer with inline storage of size elements at data
+  // taking over the elements of other.
+  Buffer(T *data, std::size_t size, Buffer &&other)
+  : Allocator(static_cast<Allocator&>(other)), data_(data),
+    inline_size_(size) {
+    MoveFrom(other);
+  }
+
+  Buffer &operator=(Buffer &&other) {
+    if (this != &other) {
+      Free();
+      static_cast<Allocator&>(*this) = static_cast<Allocator&>(other);
+      MoveFrom(other);
+    }
+    return *this;
   }
+#endif
+
+  // Returns a copy of the allocator associated with this array.
+  Allocator get_allocator() const { return *this; }
 
   // Returns the size of this array.
   std::size_t size() const { return size_; }
@@ -69,6 +240,11 @@ class Array {
   // Returns the capacity of this array.
   std::size_t capacity() const { return capacity_; }
 
+  // Returns a pointer to the elements which is null for an empty buffer
+  // without storage.
+  T *data() { return ptr_; }
+  const T *data() const { return ptr_; }
+
   // Resizes the array. If T is a POD type new elements are not initialized.
   void resize(std::size_t new_size) {
     if (new_size > capacity_)
@@ -83,6 +259,16 @@ class Array {
 
   void clear() { size_ = 0; }
 
+  // Replaces the inline storage with capacity elements at data the first
+  // size of which become the content. Dynamically allocated memory is
+  // freed without copying the content.
+  void Reset(T *data, std::size_t capacity, std::size_t size) {
+    Free();
+    ptr_ = data_ = data;
+    capacity_ = inline_size_ = capacity;
+    size_ = size;
+  }
+
   void push_back(const T &value) {
     if (size_ == capacity_)
       Grow(size_ + 1);
@@ -106,111 +292,434 @@ class Array {
   //       return size delta, size of buffer incremented. On failure, changes
   //       may linger past size, but size does not change
   //    6. Return false on failure (giving client chance to resize and retry)
-  bool appendTransact( const sprint::AppendTransaction<T>& trans );
+  //  The transaction is dispatched statically to Transaction::AppendTo.
+  template <typename Transaction>
+  bool appendTransact(
+      const sprint::AppendTransaction<Transaction, T> &trans) {
+    typedef sprint::AppendTransaction<Transaction, T> Base;
+    std::size_t sizeDiff =
+        trans.derived().AppendTo(ptr_ + size_, capacity_ - size_);
+    if (sizeDiff == Base::TRANSACTION_FAILED)
+      return false;
+    size_ += sizeDiff;
+    return true;
+  }
 
   T &operator[](std::size_t index) { return ptr_[index]; }
   const T &operator[](std::size_t index) const { return ptr_[index]; }
 };
 
-template <typename T, std::size_t SIZE>
-void Array<T, SIZE>::Grow(std::size_t size) {
-  capacity_ = std::max(size, capacity_ + capacity_ / 2);
-  T *p = new T[capacity_];
+// A buffer with the first SIZE elements stored in the object itself.
+template <typename T, std::size_t SIZE, typename Allocator = std::allocator<T> >
+class Array : public Buffer<T, Allocator> {
+ private:
+  T storage_[SIZE];
+
+ public:
+  explicit Array(const Allocator &alloc = Allocator())
+  : Buffer<T, Allocator>(storage_, SIZE, alloc) {}
+
+#if FMT_USE_RVALUE_REFERENCES
+  Array(Array &&other)
+  : Buffer<T, Allocator>(storage_, SIZE, std::move(other)) {}
+
+  Array &operator=(Array &&other) {
+    Buffer<T, Allocator>::operator=(std::move(other));
+    return *this;
+  }
+#endif
+};
+
+template <typename T, typename Allocator>
+void Buffer<T, Allocator>::Grow(std::size_t size) {
+#if FMT_USE_FORMAT_STATS
+  ++num_array_grows;
+#endif
+  std::size_t new_capacity = std::max(size, capacity_ + capacity_ / 2);
+  T *p = this->allocate(new_capacity);
   std::copy(ptr_, ptr_ + size_, p);
   if (ptr_ != data_)
-    delete [] ptr_;
+    this->deallocate(ptr_, capacity_);
   ptr_ = p;
+  capacity_ = new_capacity;
 }
 
-template <typename T, std::size_t SIZE>
-void Array<T, SIZE>::append(const T *begin, const T *end) {
+template <typename T, typename Allocator>
+void Buffer<T, Allocator>::append(const T *begin, const T *end) {
   std::ptrdiff_t num_elements = end - begin;
   if (size_ + num_elements > capacity_)
-    Grow(num_elements);
+    Grow(size_ + num_elements);
   std::copy(begin, end, ptr_ + size_);
   size_ += num_elements;
 }
 
-template <typename T, std::size_t SIZE>
-bool Array<T, SIZE>::appendTransact( const sprint::AppendTransaction<T>& trans ) {
-	std::size_t sizeDiff = trans.AppendTo( ptr_ + size_, capacity_ - size_);
-	if (sizeDiff != sprint::AppendTransaction<T>::TRANSACTION_FAILED) {
-		size_ += sizeDiff;
-		return true;
-	}
-	return false;
-}
+// A reference to characters outside the output buffer that belong to
+// the output at the given offset in the buffer.
+template <typename Char>
+struct OutputRef {
+  std::size_t offset;
+  const Char *data;
+  std::size_t size;
+};
+
+// References to string arguments and literal text of at least min_size
+// characters recorded by a formatter instead of copying them.
+template <typename Char>
+struct OutputRefs {
+  std::size_t min_size;
+  Array<OutputRef<Char>, 16> refs;
+
+  explicit OutputRefs(std::size_t size) : min_size(size) {}
+};
+
+template <typename Char>
+class BasicArgInserter;
+
+class AsyncRecord;
+
+class BinaryRecord;
 
-class ArgInserter;
+// A type that is never used as an argument.
+template <int N>
+struct Null {};
+
+// Character types that a formatter accepts as arguments in addition
+// to char. An argument of UnsupportedCharType is a compile-time error.
+template <typename Char>
+struct CharTraits {
+  typedef Char CharType;
+  typedef Null<0> UnsupportedCharType;
+};
+
+template <>
+struct CharTraits<char> {
+  typedef Null<1> CharType;
+  typedef wchar_t UnsupportedCharType;
+};
 }
 
 /**
   \rst
-  A string reference. It can be constructed from a C string, ``std::string``
-  or as a result of a formatting operation. It is most useful as a parameter
-  type to allow passing different types of strings in a function, for example::
+  A string reference. It can be constructed from a C string, a pointer and
+  a size, ``std::string``, ``std::string_view`` with C++17 or as a result
+  of a formatting operation. It is most useful as a parameter type to allow
+  passing different types of strings in a function, for example::
 
     TempFormatter<> Format(StringRef format);
 
     Format("{}") << 42;
     Format(std::string("{}")) << 42;
     Format(Format("{{}}")) << 42;
+
+  The size of a C string is computed on the first call to :meth:`size`.
+  Passed as a formatting argument, a string reference with a known size
+  is formatted without scanning for a terminating null character, but
+  format strings should be null-terminated.
+
+  :cpp:class:`format::StringRef` and :cpp:class:`format::WStringRef` are
+  references to strings of ``char`` and ``wchar_t`` respectively.
   \endrst
 */
-class StringRef {
+template <typename Char>
+class BasicStringRef {
  private:
-  const char *data_;
+  const Char *data_;
   mutable std::size_t size_;
 
- public:
-  StringRef(const char *s, std::size_t size = 0) : data_(s), size_(size) {}
-  StringRef(const std::string &s) : data_(s.c_str()), size_(s.size()) {}
+  static const std::size_t UNKNOWN_SIZE = static_cast<std::size_t>(-1);
 
-  operator std::string() const { return std::string(data_, size()); }
+ public:
+  BasicStringRef(const Char *s) : data_(s), size_(UNKNOWN_SIZE) {}
+  BasicStringRef(const Char *s, std::size_t size) : data_(s), size_(size) {}
+  BasicStringRef(const std::basic_string<Char> &s)
+  : data_(s.c_str()), size_(s.size()) {}
+#if FMT_USE_STRING_VIEW
+  BasicStringRef(std::basic_string_view<Char> s)
+  : data_(s.data()), size_(s.size()) {}
+#endif
+
+  operator std::basic_string<Char>() const {
+    return std::basic_string<Char>(data_, size());
+  }
 
-  const char *c_str() const { return data_; }
+  const Char *c_str() const { return data_; }
 
   std::size_t size() const {
-    if (size_ == 0) size_ = std::strlen(data_);
+    if (size_ == UNKNOWN_SIZE) size_ = std::char_traits<Char>::length(data_);
     return size_;
   }
 };
 
+typedef BasicStringRef<char> StringRef;
+typedef BasicStringRef<wchar_t> WStringRef;
+
 class FormatError : public std::runtime_error {
  public:
   explicit FormatError(const std::string &message)
   : std::runtime_error(message) {}
 };
 
+/**
+  \rst
+  An error reported by the operating system, for example, when writing
+  formatted output to a file fails.
+  \endrst
+*/
+class SystemError : public std::runtime_error {
+ private:
+  int error_code_;
+
+ public:
+  SystemError(const std::string &message, int error_code)
+  : std::runtime_error(message), error_code_(error_code) {}
+
+  /**
+    \rst
+    Returns the ``errno`` value describing the error.
+    \endrst
+  */
+  int error_code() const { return error_code_; }
+};
+
+/**
+  \rst
+  A function that reports an error. *message* describes the error and
+  *error_code* is the ``errno`` value for system errors or 0 for format
+  errors. The handler must not return: it can throw an exception,
+  ``longjmp`` or terminate the program. If it does return, the library
+  calls ``std::abort``.
+  \endrst
+*/
+typedef void (*ErrorHandler)(const char *message, int error_code);
+
+/**
+  \rst
+  Sets the function that reports errors and returns the previous one.
+  The default handler throws :cpp:class:`format::FormatError` or
+  :cpp:class:`format::SystemError` or, if exceptions are disabled with
+  ``FMT_EXCEPTIONS`` set to 0, prints the message to ``stderr`` and
+  aborts. Passing a null pointer restores the default handler.
+  Errors are reported without allocating memory up to the handler, so a
+  handler that doesn't throw keeps error paths allocation-free. The
+  handler is shared by all threads and should be set before formatting.
+  \endrst
+*/
+ErrorHandler SetErrorHandler(ErrorHandler handler);
+
+namespace internal {
+// Passes an error to the error handler.
+FMT_NORETURN void ReportError(const char *message, int error_code = 0);
+}
+
 enum Alignment {
   ALIGN_DEFAULT, ALIGN_LEFT, ALIGN_RIGHT, ALIGN_CENTER, ALIGN_NUMERIC
 };
 
+// Format specifiers. The fill character is stored as wchar_t to
+// accommodate all supported character types. Type codes and separators
+// are ASCII. If thousands_sep is not zero, it separates groups of three
+// digits of decimal integers and of the integer part of floating-point
+// numbers. decimal_point is written regardless of the C locale.
 struct FormatSpec {
   Alignment align;
   unsigned flags;
   unsigned width;
   char type;
-  char fill;
+  char thousands_sep;
+  char decimal_point;
+  wchar_t fill;
+
+  FormatSpec(unsigned width = 0, char type = 0, wchar_t fill = ' ')
+  : align(ALIGN_DEFAULT), flags(0), width(width), type(type),
+    thousands_sep(0), decimal_point('.'), fill(fill) {}
+};
+
+/**
+  \rst
+  An interface for allocating memory for buffers of a
+  :cpp:class:`format::Formatter`. It allows backing formatting with an
+  arena or a pool, for example::
+
+    class Arena : public fmt::Allocator {
+     public:
+      void *Allocate(std::size_t size);   // allocates from the arena
+      void Deallocate(void *, std::size_t) {}  // memory is freed at once
+    };
+
+    Arena arena;
+    fmt::Formatter out(&arena);
+  \endrst
+*/
+class Allocator {
+ public:
+  virtual ~Allocator() {}
+
+  // Allocates size bytes suitably aligned for any object type.
+  virtual void *Allocate(std::size_t size) = 0;
+
+  // Deallocates memory returned by Allocate. size is the same as
+  // passed to Allocate.
+  virtual void Deallocate(void *p, std::size_t size) = 0;
+};
+
+/**
+  \rst
+  An allocator that retains memory freed by formatters and reuses it for
+  later allocations, so that repeated formatting of messages of similar
+  size doesn't allocate in steady state. At most a few blocks with total
+  size up to the limit are retained; larger blocks are preferred since
+  buffers grow. Not thread-safe.
+  \endrst
+*/
+class BufferCache : public Allocator {
+ private:
+  enum { MAX_BLOCKS = 8 };
+
+  struct Block {
+    void *ptr;
+    std::size_t size;
+  };
+
+  Block blocks_[MAX_BLOCKS];
+  std::size_t num_blocks_;
+  std::size_t retained_size_;
+  std::size_t max_retained_size_;
+
+  void ReleaseBlock(std::size_t index);
+
+  // Do not implement!
+  BufferCache(const BufferCache &);
+  void operator=(const BufferCache &);
+
+ public:
+  /**
+    \rst
+    Constructs a cache that retains up to *max_retained_size* bytes.
+    \endrst
+  */
+  explicit BufferCache(std::size_t max_retained_size = 0)
+  : num_blocks_(0), retained_size_(0),
+    max_retained_size_(max_retained_size) {}
+
+  ~BufferCache();
+
+  /**
+    \rst
+    Returns the total size of retained blocks.
+    \endrst
+  */
+  std::size_t retained_size() const { return retained_size_; }
+
+  /**
+    \rst
+    Returns the maximum total size of retained blocks.
+    \endrst
+  */
+  std::size_t max_retained_size() const { return max_retained_size_; }
+
+  /**
+    \rst
+    Sets the maximum total size of retained blocks releasing retained
+    memory that exceeds it. Passing 0 disables retention.
+    \endrst
+  */
+  void set_max_retained_size(std::size_t size);
+
+  void *Allocate(std::size_t size);
+  void Deallocate(void *p, std::size_t size);
+};
+
+#if FMT_USE_THREAD_LOCAL
+/**
+  \rst
+  Returns the buffer cache of the current thread used by formatters
+  returned from ``Format`` and ``Print``. The cache is disabled by default
+  and is enabled by setting its limit, for example::
+
+    fmt::GetThreadBufferCache().set_max_retained_size(1 << 16);
+  \endrst
+*/
+BufferCache &GetThreadBufferCache();
+#endif
+
+namespace internal {
+
+// Returns the allocator for temporary formatters: the thread buffer cache
+// if it is enabled or null otherwise.
+#if FMT_USE_THREAD_LOCAL
+Allocator *GetTempAllocator();
+#else
+inline Allocator *GetTempAllocator() { return 0; }
+#endif
+
+// An allocator for Array that uses format::Allocator if it is not null
+// and the global operator new otherwise.
+template <typename T>
+class AllocatorRef {
+ private:
+  Allocator *allocator_;
+
+ public:
+  explicit AllocatorRef(Allocator *a = 0) : allocator_(a) {}
 
-  FormatSpec(unsigned width = 0, char type = 0, char fill = ' ')
-  : align(ALIGN_DEFAULT), flags(0), width(width), type(type), fill(fill) {}
+  Allocator *get() const { return allocator_; }
+
+  T *allocate(std::size_t n) {
+    std::size_t size = n * sizeof(T);
+    return static_cast<T*>(
+        allocator_ ? allocator_->Allocate(size) : ::operator new(size));
+  }
+
+  void deallocate(T *p, std::size_t n) {
+    if (allocator_)
+      allocator_->Deallocate(p, n * sizeof(T));
+    else
+      ::operator delete(p);
+  }
 };
+}
+
+template <typename Char>
+class BasicCompiledFormat;
+
+typedef BasicCompiledFormat<char> CompiledFormat;
+typedef BasicCompiledFormat<wchar_t> WCompiledFormat;
+
+template <typename Char>
+class BasicArgFormatter;
 
-class BasicFormatter {
+template <typename Char>
+class BasicFormatBuf;
+
+template <typename Output>
+class BufferedSink;
+
+class GatherSink;
+class MappedFileSink;
+
+/**
+  \rst
+  A buffer of characters of type *Char* with functions that write
+  formatted values to it. :cpp:class:`format::BasicFormatter` is
+  ``BasicWriter<char>``. The inline part of the buffer is provided by
+  a derived class such as :cpp:class:`format::InlineFormatter`.
+  \endrst
+*/
+template <typename Char>
+class BasicWriter {
  protected:
-  enum { INLINE_BUFFER_SIZE = 500 };
-  mutable internal::Array<char, INLINE_BUFFER_SIZE> buffer_;  // Output buffer.
+  // Output buffer.
+  mutable internal::Buffer<Char, internal::AllocatorRef<Char> > buffer_;
 
   // Grows the buffer by n characters and returns a pointer to the newly
   // allocated area.
-  char *GrowBuffer(std::size_t n) {
+  Char *GrowBuffer(std::size_t n) {
     std::size_t size = buffer_.size();
     buffer_.resize(size + n);
     return &buffer_[size];
   }
 
-  char *PrepareFilledBuffer(unsigned size, const FormatSpec &spec, char sign);
+  Char *PrepareFilledBuffer(unsigned size, const FormatSpec &spec, char sign);
 
   // Formats an integer.
   template <typename T>
@@ -220,9 +729,86 @@ class BasicFormatter {
   template <typename T>
   void FormatDouble(T value, const FormatSpec &spec, int precision);
 
-  char *FormatString(const char *s, std::size_t size, const FormatSpec &spec);
+  // Formats a finite non-negative double without using snprintf.
+  void FormatFiniteDouble(
+      double value, const FormatSpec &spec, int precision, char sign);
+
+  // Formats a finite non-negative long double using snprintf.
+  void FormatLongDouble(long double value, const FormatSpec &spec,
+                        int precision, char sign, char type);
+
+  // Writes the unpadded output of snprintf for a long double replacing
+  // the decimal point and grouping digits according to spec.
+  void WriteLongDoubleDigits(const char *digits, std::size_t size,
+                             const FormatSpec &spec, char sign);
+
+  // Pads the output written since the position start according to spec.
+  void Pad(std::size_t start, const FormatSpec &spec);
+
+  template <typename OtherChar>
+  friend class BasicWriter;
+
+  friend class BasicFormatBuf<Char>;
+
+  Char *FormatString(const Char *s, std::size_t size, const FormatSpec &spec);
+
+  // Constructs a formatter with an empty output buffer using size
+  // characters at inline_buffer before allocating memory. If allocator
+  // is not null it is used to allocate memory when the output doesn't
+  // fit into the inline buffer.
+  BasicWriter(Char *inline_buffer, std::size_t size, Allocator *allocator)
+  : buffer_(inline_buffer, size, internal::AllocatorRef<Char>(allocator)) {}
+
+#if FMT_USE_RVALUE_REFERENCES
+  // Constructs a formatter with an inline buffer taking over the output
+  // buffer of other without copying if it is dynamically allocated.
+  // other is left empty.
+  BasicWriter(Char *inline_buffer, std::size_t size, BasicWriter &&other)
+  : buffer_(inline_buffer, size, std::move(other.buffer_)) {}
+#endif
 
  public:
+  /**
+    \rst
+    Constructs a formatter with an empty output buffer. The formatter has
+    no inline buffer, so memory is allocated on the first write, using
+    *allocator* if it is not null.
+    \endrst
+   */
+  explicit BasicWriter(Allocator *allocator = 0)
+  : buffer_(0, 0, internal::AllocatorRef<Char>(allocator)) {}
+
+#if FMT_USE_RVALUE_REFERENCES
+  /**
+    \rst
+    Constructs a formatter taking over the output buffer of *other*
+    leaving *other* empty.
+    \endrst
+   */
+  BasicWriter(BasicWriter &&other)
+  : buffer_(0, 0, std::move(other.buffer_)) {}
+#endif
+
+#if FMT_USE_RVALUE_REFERENCES
+  /**
+    \rst
+    Replaces the output buffer with the buffer of *other* leaving
+    *other* empty.
+    \endrst
+   */
+  BasicWriter &operator=(BasicWriter &&other) {
+    buffer_ = std::move(other.buffer_);
+    return *this;
+  }
+#endif
+
+  /**
+    \rst
+    Returns the allocator passed to the constructor.
+    \endrst
+   */
+  Allocator *allocator() const { return buffer_.get_allocator().get(); }
+
   /**
     \rst
     Returns the number of characters written to the output buffer.
@@ -236,7 +822,7 @@ class BasicFormatter {
     character is appended.
     \endrst
    */
-  const char *data() const { return &buffer_[0]; }
+  const Char *data() const { return buffer_.data(); }
 
   /**
     \rst
@@ -244,7 +830,7 @@ class BasicFormatter {
     character appended.
     \endrst
    */
-  const char *c_str() const {
+  const Char *c_str() const {
     std::size_t size = buffer_.size();
     buffer_.reserve(size + 1);
     buffer_[size] = '\0';
@@ -253,25 +839,57 @@ class BasicFormatter {
 
   /**
     \rst
-    Returns the content of the output buffer as an ``std::string``.
+    Returns the content of the output buffer as an ``std::basic_string``.
     \endrst
    */
-  std::string str() const { return std::string(&buffer_[0], buffer_.size()); }
+  std::basic_string<Char> str() const {
+    return std::basic_string<Char>(buffer_.data(), buffer_.size());
+  }
 
   void operator<<(int value);
 
-  void operator<<(char value) {
+  void operator<<(Char value) {
     *GrowBuffer(1) = value;
   }
 
-  void operator<<(const char *value) {
-    std::size_t size = std::strlen(value);
-    std::strncpy(GrowBuffer(size), value, size);
+  void operator<<(const Char *value) {
+    std::size_t size = std::char_traits<Char>::length(value);
+    std::char_traits<Char>::copy(GrowBuffer(size), value, size);
+  }
+
+  void operator<<(BasicStringRef<Char> value) {
+    std::size_t size = value.size();
+    std::char_traits<Char>::copy(GrowBuffer(size), value.c_str(), size);
+  }
+
+  /**
+    \rst
+    Appends the output of a transaction such as ``sprint::asHexL`` to
+    the buffer. If the remaining capacity is too small, the buffer is grown
+    by the size the transaction requires and the transaction is retried.
+    \endrst
+  */
+  template <typename Transaction>
+  void operator<<(const sprint::AppendTransaction<Transaction, Char> &spr) {
+    // Acting optimistically on the buffer.
+    if (buffer_.appendTransact(spr)) return;
+    buffer_.reserve(buffer_.size() + spr.derived().RequiredSize());
+    if (!buffer_.appendTransact(spr))
+      internal::ReportError("append transaction failed after growing buffer");
   }
 
-  void operator <<(const sprint::AppendTransaction<char>& spr);
+  /**
+    \rst
+    Formats integers from the range [*begin*, *end*) in decimal separated
+    by *sep* and appends them to the buffer. The buffer capacity is checked
+    once for the whole range. *T* can be ``int``, ``unsigned``, ``long``,
+    ``unsigned long``, ``long long`` or ``unsigned long long``.
+    \endrst
+   */
+  template <typename T>
+  void FormatInts(const T *begin, const T *end, Char sep);
 
-  BasicFormatter &Write(int value, const FormatSpec &spec) {
+  BasicWriter &Write(int value, const FormatSpec &spec) {
     FormatInt(value, spec);
     return *this;
   }
@@ -281,12 +899,18 @@ class BasicFormatter {
   }
 };
 
+typedef BasicWriter<char> BasicFormatter;
+
 /**
   \rst
-  The :cpp:class:`format::Formatter` class provides string formatting
-  functionality similar to Python's `str.format
-  <http://docs.python.org/3/library/stdtypes.html#str.format>`__.
+  A formatter that writes to a buffer of characters of type *Char*
+  providing string formatting functionality similar to Python's
+  `str.format <http://docs.python.org/3/library/stdtypes.html#str.format>`__.
   The output is stored in a memory buffer that grows dynamically.
+  Argument strings and the format string have the same character type
+  as the buffer; ``char`` arguments are accepted by all formatters.
+  The inline part of the buffer is provided by
+  :cpp:class:`format::InlineFormatter`.
 
   **Example**::
 
@@ -305,48 +929,34 @@ class BasicFormatter {
   The buffer can be accessed using :meth:`data` or :meth:`c_str`.
   \endrst
  */
-class Formatter : public BasicFormatter {
+template <typename Char>
+class GenericFormatter : public BasicWriter<Char> {
  private:
   enum Type {
     // Numeric types should go first.
-    INT, UINT, LONG, ULONG, DOUBLE, LONG_DOUBLE,
+    INT, UINT, LONG, ULONG, LONG_LONG, ULONG_LONG, DOUBLE, LONG_DOUBLE,
     LAST_NUMERIC_TYPE = LONG_DOUBLE,
-    CHAR, STRING, WSTRING, POINTER, CUSTOM
+    CHAR, STRING, POINTER, CUSTOM
   };
 
-  typedef void (Formatter::*FormatFunc)(
+  typedef void (GenericFormatter::*FormatFunc)(
       const void *arg, const FormatSpec &spec);
 
-  // A format argument.
-  class Arg {
-   private:
-    // This method is private to disallow formatting of arbitrary pointers.
-    // If you want to output a pointer cast it to const void*. Do not implement!
-    template <typename T>
-    Arg(const T *value);
-
-    // This method is private to disallow formatting of arbitrary pointers.
-    // If you want to output a pointer cast it to void*. Do not implement!
-    template <typename T>
-    Arg(T *value);
-
-    // This method is private to disallow formatting of wide characters.
-    // If you want to output a wide character cast it to integer type.
-    // Do not implement!
-    Arg(wchar_t value);
-
-   public:
-    Type type;
+  // The value of a format argument. Values are stored by the formatter
+  // in an array separately from their types.
+  struct Value {
     union {
       int int_value;
       unsigned uint_value;
       double double_value;
       long long_value;
       unsigned long ulong_value;
+      internal::LongLong long_long_value;
+      internal::ULongLong ulong_long_value;
       long double long_double_value;
       const void *pointer_value;
       struct {
-        const char *value;
+        const Char *value;
         std::size_t size;
       } string;
       struct {
@@ -354,100 +964,288 @@ class Formatter : public BasicFormatter {
         FormatFunc format;
       } custom;
     };
-    mutable Formatter *formatter;
+  };
+
+  // A format argument. It is only used to capture a value of a supported
+  // type which is then copied into the formatter, so it is trivially
+  // destructible.
+  class Arg : public Value {
+   private:
+    // This method is private to disallow formatting of arbitrary pointers.
+    // If you want to output a pointer cast it to const void*. Do not implement!
+    template <typename T>
+    Arg(const T *value);
+
+    // This method is private to disallow formatting of arbitrary pointers.
+    // If you want to output a pointer cast it to void*. Do not implement!
+    template <typename T>
+    Arg(T *value);
+
+    // This method is private to disallow formatting of wide characters
+    // with a narrow formatter. If you want to output a wide character
+    // cast it to integer type. Do not implement!
+    Arg(typename internal::CharTraits<Char>::UnsupportedCharType value);
+
+    // Sets a string of known size that need not be null-terminated.
+    // Size 0 means that the size is computed when formatting, so an empty
+    // string is replaced with a null-terminated one.
+    void SetString(const Char *value, std::size_t size) {
+      static const Char EMPTY = 0;
+      this->string.value = size != 0 ? value : &EMPTY;
+      this->string.size = size;
+    }
+
+   public:
+    Type type;
+
+    // Integers narrower than int are formatted as int or unsigned, not
+    // as custom types, and signed char and unsigned char as numbers.
+    Arg(signed char value) : type(INT) {
+      this->int_value = value;
+    }
+    Arg(unsigned char value) : type(UINT) {
+      this->uint_value = value;
+    }
+    Arg(short value) : type(INT) {
+      this->int_value = value;
+    }
+    Arg(unsigned short value) : type(UINT) {
+      this->uint_value = value;
+    }
+    Arg(int value) : type(INT) {
+      this->int_value = value;
+    }
+    Arg(unsigned value) : type(UINT) {
+      this->uint_value = value;
+    }
+    Arg(long value) : type(LONG) {
+      this->long_value = value;
+    }
+    Arg(unsigned long value) : type(ULONG) {
+      this->ulong_value = value;
+    }
+    Arg(internal::LongLong value) : type(LONG_LONG) {
+      this->long_long_value = value;
+    }
+    Arg(internal::ULongLong value) : type(ULONG_LONG) {
+      this->ulong_long_value = value;
+    }
+    Arg(double value) : type(DOUBLE) {
+      this->double_value = value;
+    }
+    Arg(long double value) : type(LONG_DOUBLE) {
+      this->long_double_value = value;
+    }
+    Arg(char value) : type(CHAR) {
+      this->int_value = value;
+    }
+    Arg(typename internal::CharTraits<Char>::CharType value) : type(CHAR) {
+      this->int_value = value;
+    }
+
+    Arg(const Char *value) : type(STRING) {
+      this->string.value = value;
+      this->string.size = 0;
+    }
 
-    Arg(int value) : type(INT), int_value(value), formatter(0) {}
-    Arg(unsigned value) : type(UINT), uint_value(value), formatter(0) {}
-    Arg(long value) : type(LONG), long_value(value), formatter(0) {}
-    Arg(unsigned long value) : type(ULONG), ulong_value(value), formatter(0) {}
-    Arg(double value) : type(DOUBLE), double_value(value), formatter(0) {}
-    Arg(long double value)
-    : type(LONG_DOUBLE), long_double_value(value), formatter(0) {}
-    Arg(char value) : type(CHAR), int_value(value), formatter(0) {}
+    Arg(Char *value) : type(STRING) {
+      this->string.value = value;
+      this->string.size = 0;
+    }
 
-    Arg(const char *value) : type(STRING), formatter(0) {
-      string.value = value;
-      string.size = 0;
+    Arg(const void *value) : type(POINTER) {
+      this->pointer_value = value;
     }
 
-    Arg(char *value) : type(STRING), formatter(0) {
-      string.value = value;
-      string.size = 0;
+    Arg(void *value) : type(POINTER) {
+      this->pointer_value = value;
     }
 
-    Arg(const void *value)
-    : type(POINTER), pointer_value(value), formatter(0) {}
+    Arg(const std::basic_string<Char> &value) : type(STRING) {
+      this->string.value = value.c_str();
+      this->string.size = value.size();
+    }
 
-    Arg(void *value) : type(POINTER), pointer_value(value), formatter(0) {}
+    Arg(BasicStringRef<Char> value) : type(STRING) {
+      SetString(value.c_str(), value.size());
+    }
 
-    Arg(const std::string &value) : type(STRING), formatter(0) {
-      string.value = value.c_str();
-      string.size = value.size();
+#if FMT_USE_STRING_VIEW
+    Arg(std::basic_string_view<Char> value) : type(STRING) {
+      SetString(value.data(), value.size());
     }
+#endif
 
     template <typename T>
-    Arg(const T &value) : type(CUSTOM), formatter(0) {
-      custom.value = &value;
-      custom.format = &Formatter::FormatCustomArg<T>;
-    }
-
-    ~Arg() {
-      // Format is called here to make sure that a referred object is
-      // still alive, for example:
-      //
-      //   Print("{0}") << std::string("test");
-      //
-      // Here an Arg object refers to a temporary std::string which is
-      // destroyed at the end of the statement. Since the string object is
-      // constructed before the Arg object, it will be destroyed after,
-      // so it will be alive in the Arg's destructor where Format is called.
-      // Note that the string object will not necessarily be alive when
-      // the destructor of ArgInserter is called.
-      formatter->CompleteFormatting();
+    Arg(const T &value) : type(CUSTOM) {
+      this->custom.value = &value;
+      this->custom.format = &GenericFormatter::FormatCustomArg<T>;
     }
   };
 
   enum { NUM_INLINE_ARGS = 10 };
-  internal::Array<const Arg*, NUM_INLINE_ARGS> args_;  // Format arguments.
 
-  const char *format_;  // Format string.
-  int num_open_braces_;
-  int next_arg_index_;
+  // Format arguments. Types are stored separately from values to keep
+  // the values, which have stricter alignment, packed.
+  internal::Array<unsigned char, NUM_INLINE_ARGS,
+      internal::AllocatorRef<unsigned char> > arg_types_;
+  internal::Array<Value, NUM_INLINE_ARGS,
+      internal::AllocatorRef<Value> > arg_values_;
+
+  const Char *format_;  // Format string.
+  const BasicCompiledFormat<Char> *compiled_format_;
+
+  // If not null, DoFormat adds the output size to *count_ instead of
+  // writing the output.
+  std::size_t *count_;
+
+  // If not null, long strings are referenced in *refs_ instead of
+  // being copied to the buffer.
+  internal::OutputRefs<Char> *refs_;
 
-  friend class internal::ArgInserter;
-  friend class ArgFormatter;
+  // Checks arguments against the requirements of format specifiers.
+  class ArgChecker;
 
+  friend class internal::BasicArgInserter<Char>;
+  friend class BasicArgFormatter<Char>;
+  friend class BasicCompiledFormat<Char>;
+  friend class internal::AsyncRecord;
+  friend class internal::BinaryRecord;
+  friend class GatherSink;
+
+  // Copies an argument into the formatter.
   void Add(const Arg &arg) {
-    args_.push_back(&arg);
+    arg_types_.push_back(static_cast<unsigned char>(arg.type));
+    arg_values_.push_back(arg);
+  }
+
+  void ClearArgs() {
+    arg_types_.clear();
+    arg_values_.clear();
   }
 
-  void ReportError(const char *s, StringRef message) const;
+  std::size_t num_args() const { return arg_types_.size(); }
+
+  Type arg_type(std::size_t index) const {
+    return static_cast<Type>(arg_types_[index]);
+  }
 
   // Formats an argument of a custom type, such as a user-defined class.
   template <typename T>
   void FormatCustomArg(const void *arg, const FormatSpec &spec);
 
-  unsigned ParseUInt(const char *&s) const;
+  // Formats a single argument according to spec.
+  void FormatArg(Type type, const Value &arg, FormatSpec &spec, int precision);
 
-  // Parses argument index and returns an argument with this index.
-  const Arg &ParseArgIndex(const char *&s);
+  // Returns the size of a string argument.
+  static std::size_t GetStringSize(const Value &arg);
 
-  void CheckSign(const char *&s, const Arg &arg);
+  // Returns the number of characters FormatArg writes for the argument.
+  // Integers, characters, strings and pointers are not formatted.
+  std::size_t CountArg(
+      Type type, const Value &arg, FormatSpec &spec, int precision);
 
-  void DoFormat();
+  // Records a reference to characters that belong to the output at
+  // the end of the buffer.
+  void AddRef(const Char *s, std::size_t size) {
+    internal::OutputRef<Char> ref = {this->buffer_.size(), s, size};
+    refs_->refs.push_back(ref);
+  }
 
-  void CompleteFormatting() {
-    if (!format_) return;
-    DoFormat();
+  // Literal text is always copied even if refs_ is set because it may
+  // belong to a compiled or a cached format that doesn't outlive the
+  // output.
+  void AppendLiteral(const Char *begin, const Char *end) {
+    if (count_)
+      *count_ += end - begin;
+    else
+      this->buffer_.append(begin, end);
   }
 
+  void DoFormat();
+
+  // Formats the arguments using a precompiled format.
+  void DoFormat(const BasicCompiledFormat<Char> &format);
+
+  void CompleteFormatting() {
+    if (format_)
+      DoFormat();
+    else if (compiled_format_)
+      DoFormat(*compiled_format_);
+  }
+
+  // Completes formatting in the counting mode and returns the size of
+  // the output.
+  std::size_t CountOutput() {
+    struct CountGuard {
+      std::size_t *&count;
+      ~CountGuard() { count = 0; }
+    } guard = {count_};
+    std::size_t count = 0;
+    count_ = &count;
+    CompleteFormatting();
+    return count;
+  }
+
+ protected:
+  // Constructs a formatter with an empty output buffer using size
+  // characters at inline_buffer before allocating memory. If allocator
+  // is not null it is used to allocate memory for the output and
+  // arguments that don't fit into the inline buffers.
+  GenericFormatter(Char *inline_buffer, std::size_t size,
+                   Allocator *allocator)
+  : BasicWriter<Char>(inline_buffer, size, allocator),
+    arg_types_(internal::AllocatorRef<unsigned char>(allocator)),
+    arg_values_(internal::AllocatorRef<Value>(allocator)),
+    format_(0), compiled_format_(0), count_(0), refs_(0) {}
+
+#if FMT_USE_RVALUE_REFERENCES
+  // Constructs a formatter with an inline buffer taking over the output
+  // buffer of other.
+  GenericFormatter(Char *inline_buffer, std::size_t size,
+                   GenericFormatter &&other)
+  : BasicWriter<Char>(inline_buffer, size, std::move(other)),
+    arg_types_(std::move(other.arg_types_)),
+    arg_values_(std::move(other.arg_values_)),
+    format_(0), compiled_format_(0), count_(0), refs_(0) {}
+#endif
+
  public:
   /**
     \rst
-    Constructs a formatter with an empty output buffer.
+    Constructs a formatter with an empty output buffer and no inline
+    buffer. If *allocator* is not null it is used to allocate memory for
+    the output and arguments that don't fit into the inline argument
+    buffers. The allocator should outlive the formatter. Use
+    :cpp:class:`format::InlineFormatter` to avoid allocating memory for
+    short output.
+    \endrst
+   */
+  explicit GenericFormatter(Allocator *allocator = 0)
+  : BasicWriter<Char>(0, 0, allocator),
+    arg_types_(internal::AllocatorRef<unsigned char>(allocator)),
+    arg_values_(internal::AllocatorRef<Value>(allocator)),
+    format_(0), compiled_format_(0), count_(0), refs_(0) {}
+
+#if FMT_USE_RVALUE_REFERENCES
+  /**
+    \rst
+    Constructs a formatter taking over the output buffer of *other*.
     \endrst
    */
-  Formatter() : format_(0) {}
+  GenericFormatter(GenericFormatter &&other)
+  : BasicWriter<Char>(0, 0, std::move(other)),
+    arg_types_(std::move(other.arg_types_)),
+    arg_values_(std::move(other.arg_values_)),
+    format_(0), compiled_format_(0), count_(0), refs_(0) {}
+
+  GenericFormatter &operator=(GenericFormatter &&other) {
+    BasicWriter<Char>::operator=(std::move(other));
+    arg_types_ = std::move(other.arg_types_);
+    arg_values_ = std::move(other.arg_values_);
+    return *this;
+  }
+#endif
 
   /**
     \rst
@@ -456,35 +1254,422 @@ class Formatter : public BasicFormatter {
     using inserter operator ``<<``.
     \endrst
   */
-  internal::ArgInserter operator()(StringRef format);
+  internal::BasicArgInserter<Char> operator()(BasicStringRef<Char> format);
+
+  /**
+    \rst
+    Formats arguments using a precompiled format appending the output to
+    the internal buffer. The format object should outlive the formatting
+    operation.
+    \endrst
+  */
+  internal::BasicArgInserter<Char> operator()(
+      const BasicCompiledFormat<Char> &format);
+
+#if FMT_USE_VARIADIC_TEMPLATES
+  /**
+    \rst
+    Formats arguments using a precompiled format appending the output to
+    the internal buffer. Unlike ``operator()`` the arguments are passed
+    directly and formatting is done before this function returns.
+    \endrst
+  */
+  template <typename... Args>
+  void FormatArgs(const BasicCompiledFormat<Char> &format,
+                  const Args &... args);
+#endif
+};
+
+namespace internal {
+// The default size of the inline buffers of formatters in characters.
+enum { INLINE_BUFFER_SIZE = 500 };
+}
+
+/**
+  \rst
+  A formatter with an inline buffer of *SIZE* characters. Output shorter
+  than *SIZE* characters with at most 10 arguments is formatted without
+  allocating memory, so *SIZE* trades the size of the object, for example,
+  on the stack, against memory allocations for longer output.
+
+  **Example**::
+
+    fmt::InlineFormatter<4096> f;
+    f("{{\"id\": {0}, \"items\": [{1}]}}") << id << items;
+  \endrst
+*/
+template <std::size_t SIZE, typename Char = char>
+class InlineFormatter : public GenericFormatter<Char> {
+ private:
+  Char inline_buffer_[SIZE];
+
+ public:
+  /**
+    \rst
+    Constructs a formatter with an empty output buffer. If *allocator* is
+    not null it is used to allocate memory for the output and arguments
+    that don't fit into the inline buffers. The allocator should outlive
+    the formatter.
+    \endrst
+  */
+  explicit InlineFormatter(Allocator *allocator = 0)
+  : GenericFormatter<Char>(inline_buffer_, SIZE, allocator) {}
+
+#if FMT_USE_RVALUE_REFERENCES
+  /**
+    \rst
+    Constructs a formatter taking over the output buffer of *other*.
+    Formatters can be moved between formatting operations, for example,
+    to return a formatter from a function.
+    \endrst
+  */
+  InlineFormatter(InlineFormatter &&other)
+  : GenericFormatter<Char>(inline_buffer_, SIZE, std::move(other)) {}
+
+  InlineFormatter &operator=(InlineFormatter &&other) {
+    GenericFormatter<Char>::operator=(std::move(other));
+    return *this;
+  }
+#endif
+};
+
+/**
+  \rst
+  :cpp:class:`format::Formatter` formats to a buffer of ``char``,
+  :cpp:class:`format::WFormatter` to a buffer of ``wchar_t`` and,
+  with C++11, :cpp:class:`format::U16Formatter` to a buffer of UTF-16
+  code units ``char16_t``. All of them share the format string parser
+  and the integer and floating-point formatting code and have inline
+  buffers of 500 characters.
+  \endrst
+*/
+typedef InlineFormatter<internal::INLINE_BUFFER_SIZE> Formatter;
+typedef InlineFormatter<internal::INLINE_BUFFER_SIZE, wchar_t> WFormatter;
+#if FMT_USE_CHAR16
+typedef InlineFormatter<internal::INLINE_BUFFER_SIZE, char16_t> U16Formatter;
+#endif
+
+/**
+  \rst
+  A format string that has been parsed once and can be used for formatting
+  many times without parsing it again. Literal text and format specifiers
+  are stored in the object, so the string passed to the constructor need
+  not outlive it. Syntax errors in the format string are reported by the
+  constructor; errors that depend on argument types are reported when
+  formatting.
+
+  **Example**::
+
+    static const fmt::CompiledFormat format("{0:>8} {1:.3f}");
+    std::string s = str(fmt::Format(format) << "pi" << 3.14159);
+    // s == "      pi 3.142"
+
+  :cpp:class:`format::CompiledFormat` and :cpp:class:`format::WCompiledFormat`
+  are precompiled formats for ``char`` and ``wchar_t`` strings respectively.
+  \endrst
+*/
+template <typename Char>
+class BasicCompiledFormat {
+ private:
+  // A replacement field together with the literal text preceding it.
+  struct Field {
+    std::size_t literal_size;
+    unsigned arg_index;
+    FormatSpec spec;
+    int precision;
+    int precision_arg_index;  // -1 if precision is not passed as an argument.
+    char numeric_spec;        // Specifier requiring a numeric argument or 0.
+    char signed_spec;         // Specifier requiring a signed argument or 0.
+    bool requires_double;     // Precision requires a floating-point argument.
+  };
+
+  // Literal text with escaped braces replaced.
+  std::basic_string<Char> literals_;
+  std::vector<Field> fields_;
+  unsigned num_args_;
+
+  // Records the requirements of format specifiers in a field.
+  class SpecRecorder;
+
+  friend class GenericFormatter<Char>;
+
+ public:
+  /**
+    \rst
+    Parses a format string throwing :cpp:class:`format::FormatError` if
+    it is invalid.
+    \endrst
+   */
+  explicit BasicCompiledFormat(BasicStringRef<Char> format);
+
+  /**
+    \rst
+    Returns the number of arguments referred to by the format.
+    \endrst
+   */
+  unsigned num_args() const { return num_args_; }
+};
+
+namespace internal {
+template <typename Char>
+class CachedFormatRef;
+
+template <typename Char>
+class FormatStatsScope;
+}
+
+/**
+  \rst
+  A cache of parsed format strings keyed by their addresses. When the cache
+  of the current thread returned by :cpp:func:`format::GetThreadFormatCache`
+  is enabled, formatting with a ``char`` format string such as
+  ``Format("{0}: {1}") << a << b`` reuses the :cpp:class:`CompiledFormat`
+  parsed on the first use of the same address, giving most of the speed of
+  precompiled formats without changing call sites.
+
+  Since format strings are identified by their addresses only, the cache
+  should only be enabled if all format strings passed to formatters of the
+  thread are not modified or freed while the cache is enabled, for example,
+  if they are string literals. At most :meth:`max_size` formats are cached;
+  a format replaces a previously cached one with a conflicting address.
+  Not thread-safe.
+  \endrst
+*/
+class FormatCache {
+ private:
+  struct Entry {
+    const char *format;
+    CompiledFormat *compiled_format;
+  };
+
+  std::vector<Entry> entries_;
+  std::size_t size_;
+  std::size_t hits_;
+  std::size_t misses_;
+  unsigned num_refs_;  // Number of cached formats being used.
+
+  friend class internal::CachedFormatRef<char>;
+
+  // Returns the compiled format for the format string or null on a miss.
+  // A non-null result should be passed to Release after the use.
+  const CompiledFormat *Acquire(const char *format);
+
+  void Release() { --num_refs_; }
+
+  // Compiles and caches a format string after a miss. The format should
+  // have been formatted without errors so that compiling it doesn't
+  // report any.
+  void Insert(const char *format);
+
+  // Do not implement!
+  FormatCache(const FormatCache &);
+  void operator=(const FormatCache &);
+
+ public:
+  /**
+    \rst
+    Constructs a cache of up to *max_size* formats.
+    \endrst
+  */
+  explicit FormatCache(std::size_t max_size = 0)
+  : entries_(max_size), size_(0), hits_(0), misses_(0), num_refs_(0) {}
+
+  ~FormatCache() { Clear(); }
+
+  /**
+    \rst
+    Returns the number of cached formats.
+    \endrst
+  */
+  std::size_t size() const { return size_; }
+
+  /**
+    \rst
+    Returns the maximum number of cached formats.
+    \endrst
+  */
+  std::size_t max_size() const { return entries_.size(); }
+
+  /**
+    \rst
+    Sets the maximum number of cached formats clearing the cache. Passing 0
+    disables caching. Should not be called during formatting, for example,
+    from a ``Format`` function of a custom type.
+    \endrst
+  */
+  void set_max_size(std::size_t size);
+
+  /**
+    \rst
+    Returns the number of times a cached format was used.
+    \endrst
+  */
+  std::size_t hits() const { return hits_; }
+
+  /**
+    \rst
+    Returns the number of times a format string was not found in the cache.
+    \endrst
+  */
+  std::size_t misses() const { return misses_; }
+
+  /**
+    \rst
+    Removes all cached formats and resets the counters. Should not be
+    called during formatting.
+    \endrst
+  */
+  void Clear();
+};
+
+#if FMT_USE_THREAD_LOCAL
+/**
+  \rst
+  Returns the format cache of the current thread. The cache is disabled by
+  default and is enabled by setting its size, for example::
+
+    fmt::GetThreadFormatCache().set_max_size(256);
+  \endrst
+*/
+FormatCache &GetThreadFormatCache();
+#endif
+
+#if FMT_USE_FORMAT_STATS
+/**
+  \rst
+  Statistics of the formatting operations of a thread grouped by format.
+  They are only collected if the library and the code using it are
+  compiled with ``FMT_USE_FORMAT_STATS`` defined to 1 and help to decide
+  which call sites to convert to precompiled formats and how large the
+  output buffers should be. Formats are identified by the addresses of
+  format strings or of :cpp:class:`format::BasicCompiledFormat` objects.
+  Every :any:`SAMPLE_PERIOD`-th operation of a thread is timed with the
+  processor's cycle counter, or a clock in nanoseconds where it is not
+  available.
+
+  **Example**::
+
+    // At the end of a benchmark or on a signal:
+    fmt::GetThreadFormatStats().Dump(stderr);
+
+  Not thread-safe.
+  \endrst
+*/
+class FormatStats {
+ public:
+  enum { SAMPLE_PERIOD = 16, MAX_TEXT_SIZE = 48 };
+
+  // Statistics of a format.
+  struct Entry {
+    const void *format;  // The address of the format.
+    bool compiled;  // Whether the format is a compiled format.
+    // The beginning of the format string with control characters
+    // escaped or empty for compiled formats.
+    char text[MAX_TEXT_SIZE];
+    std::size_t calls;  // The number of formatting operations.
+    std::size_t bytes;  // The number of characters written.
+    std::size_t grows;  // The number of times buffers have grown.
+    std::size_t samples;  // The number of timed operations.
+    internal::ULongLong cycles;  // The time taken by timed operations.
+  };
+
+ private:
+  std::vector<Entry> entries_;  // An open addressing hash table.
+  std::size_t size_;
+  unsigned sample_counter_;
+
+  template <typename Char>
+  friend class internal::FormatStatsScope;
+
+  // Returns the entry for a format adding it if it is new.
+  Entry &GetEntry(const void *format);
+
+  // Do not implement!
+  FormatStats(const FormatStats &);
+  void operator=(const FormatStats &);
+
+ public:
+  FormatStats() : size_(0), sample_counter_(0) {}
+
+  /**
+    \rst
+    Returns the number of formats.
+    \endrst
+  */
+  std::size_t size() const { return size_; }
+
+  /**
+    \rst
+    Returns the statistics of all formats sorted by the estimated total
+    time in descending order.
+    \endrst
+  */
+  std::vector<Entry> GetEntries() const;
+
+  /**
+    \rst
+    Writes a table of the statistics sorted by the estimated total time
+    to *file*.
+    \endrst
+  */
+  void Dump(std::FILE *file) const;
+
+  /**
+    \rst
+    Removes all statistics.
+    \endrst
+  */
+  void Clear();
 };
 
+/**
+  \rst
+  Returns the formatting statistics of the current thread.
+  \endrst
+*/
+FormatStats &GetThreadFormatStats();
+#endif
+
 namespace internal {
 
 // This is a transient object that normally exists only as a temporary
 // returned by one of the formatting functions. It stores a reference
 // to a formatter and provides operator<< that feeds arguments to the
 // formatter.
-class ArgInserter {
+template <typename Char>
+class BasicArgInserter {
  private:
+  typedef GenericFormatter<Char> Formatter;
+
   mutable Formatter *formatter_;
 
-  friend class format::Formatter;
-  friend class format::StringRef;
+  friend class format::GenericFormatter<Char>;
+  friend class format::BasicStringRef<Char>;
+
+  template <typename Output>
+  friend class format::BufferedSink;
+  friend class format::GatherSink;
+  friend class format::MappedFileSink;
 
   // Do not implement.
-  void operator=(const ArgInserter& other);
+  void operator=(const BasicArgInserter& other);
 
  protected:
-  explicit ArgInserter(Formatter *f = 0) : formatter_(f) {}
+  explicit BasicArgInserter(Formatter *f = 0) : formatter_(f) {}
+
+  void Init(Formatter &f, const Char *format) {
+    const BasicArgInserter &other = f(format);
+    formatter_ = other.formatter_;
+    other.formatter_ = 0;
+  }
 
-  void Init(Formatter &f, const char *format) {
-    const ArgInserter &other = f(format);
+  void Init(Formatter &f, const BasicCompiledFormat<Char> &format) {
+    const BasicArgInserter &other = f(format);
     formatter_ = other.formatter_;
     other.formatter_ = 0;
   }
 
-  ArgInserter(const ArgInserter& other)
+  BasicArgInserter(const BasicArgInserter& other)
   : formatter_(other.formatter_) {
     other.formatter_ = 0;
   }
@@ -499,10 +1684,18 @@ class ArgInserter {
   }
 
   Formatter *formatter() const { return formatter_; }
-  const char *format() const { return formatter_->format_; }
+  const Char *format() const { return formatter_->format_; }
+  const BasicCompiledFormat<Char> *compiled_format() const {
+    return formatter_->compiled_format_;
+  }
 
   void ResetFormatter() const { formatter_ = 0; }
 
+  BasicArgInserter &Add(const typename Formatter::Arg &arg) {
+    formatter_->Add(arg);
+    return *this;
+  }
+
   struct Proxy {
     Formatter *formatter;
     explicit Proxy(Formatter *f) : formatter(f) {}
@@ -511,19 +1704,54 @@ class ArgInserter {
       formatter->CompleteFormatting();
       return formatter;
     }
+
+    std::size_t Count() { return formatter->CountOutput(); }
   };
 
  public:
-  ~ArgInserter() {
+  ~BasicArgInserter() FMT_DTOR_THROWS {
     if (formatter_)
       formatter_->CompleteFormatting();
   }
 
-  // Feeds an argument to a formatter.
-  ArgInserter &operator<<(const Formatter::Arg &arg) {
-    arg.formatter = formatter_;
-    formatter_->Add(arg);
-    return *this;
+  // Feeds an argument of a fundamental type or a C string to a
+  // formatter. The value is copied, so formatting is done once per
+  // message when the inserter is destroyed.
+  BasicArgInserter &operator<<(signed char value) { return Add(value); }
+  BasicArgInserter &operator<<(unsigned char value) { return Add(value); }
+  BasicArgInserter &operator<<(short value) { return Add(value); }
+  BasicArgInserter &operator<<(unsigned short value) { return Add(value); }
+  BasicArgInserter &operator<<(int value) { return Add(value); }
+  BasicArgInserter &operator<<(unsigned value) { return Add(value); }
+  BasicArgInserter &operator<<(long value) { return Add(value); }
+  BasicArgInserter &operator<<(unsigned long value) { return Add(value); }
+  BasicArgInserter &operator<<(LongLong value) { return Add(value); }
+  BasicArgInserter &operator<<(ULongLong value) { return Add(value); }
+  BasicArgInserter &operator<<(double value) { return Add(value); }
+  BasicArgInserter &operator<<(long double value) { return Add(value); }
+  BasicArgInserter &operator<<(char value) { return Add(value); }
+  BasicArgInserter &operator<<(typename CharTraits<Char>::CharType value) {
+    return Add(value);
+  }
+  BasicArgInserter &operator<<(const Char *value) { return Add(value); }
+  BasicArgInserter &operator<<(Char *value) { return Add(value); }
+  BasicArgInserter &operator<<(const void *value) { return Add(value); }
+  BasicArgInserter &operator<<(void *value) { return Add(value); }
+
+  // Feeds an argument of a class type, such as std::string or a
+  // user-defined type, to a formatter. The argument is referenced and
+  // may be a temporary object that is destroyed before this inserter:
+  //
+  //   Print("{0}") << std::string("test");
+  //
+  // Since the string is constructed before the returned inserter, it is
+  // destroyed after it, so the returned inserter completes formatting
+  // on destruction while the string is still alive. The rest of the
+  // inserters find the formatting complete.
+  template <typename T>
+  BasicArgInserter operator<<(const T &value) {
+    formatter_->Add(typename Formatter::Arg(value));
+    return BasicArgInserter(formatter_);
   }
 
   operator Proxy() {
@@ -532,68 +1760,308 @@ class ArgInserter {
     return Proxy(f);
   }
 
-  operator StringRef() {
+  operator BasicStringRef<Char>() {
     const Formatter *f = Format();
-    return StringRef(f->c_str(), f->size());
+    return BasicStringRef<Char>(f->c_str(), f->size());
   }
 
-  // Performs formatting and returns a std::string with the output.
-  friend std::string str(Proxy p) {
+  // Performs formatting and returns a std::basic_string with the output.
+  friend std::basic_string<Char> str(Proxy p) {
     return p.Format()->str();
   }
 
   // Performs formatting and returns a C string with the output.
-  friend const char *c_str(Proxy p) {
+  friend const Char *c_str(Proxy p) {
     return p.Format()->c_str();
   }
+
+  // Returns the size of the output without writing it.
+  friend std::size_t FormattedSize(Proxy p) {
+    return p.Count();
+  }
+
+  // Performs formatting and copies at most size - 1 characters of the
+  // output followed by a terminating null character to buffer.
+  // Returns the size of the whole output.
+  friend std::size_t FormatTo(Char *buffer, std::size_t size, Proxy p) {
+    const Formatter *f = p.Format();
+    std::size_t output_size = f->size();
+    if (size != 0) {
+      std::size_t n = std::min(output_size, size - 1);
+      std::char_traits<Char>::copy(buffer, f->data(), n);
+      buffer[n] = Char();
+    }
+    return output_size;
+  }
 };
 
+typedef BasicArgInserter<char> ArgInserter;
+typedef BasicArgInserter<wchar_t> WArgInserter;
+
 std::string str(ArgInserter::Proxy p);
 const char *c_str(ArgInserter::Proxy p);
+std::size_t FormattedSize(ArgInserter::Proxy p);
+std::size_t FormatTo(char *buffer, std::size_t size, ArgInserter::Proxy p);
+std::wstring str(WArgInserter::Proxy p);
+const wchar_t *c_str(WArgInserter::Proxy p);
+std::size_t FormattedSize(WArgInserter::Proxy p);
+std::size_t FormatTo(wchar_t *buffer, std::size_t size, WArgInserter::Proxy p);
+#if FMT_USE_CHAR16
+std::u16string str(BasicArgInserter<char16_t>::Proxy p);
+const char16_t *c_str(BasicArgInserter<char16_t>::Proxy p);
+std::size_t FormattedSize(BasicArgInserter<char16_t>::Proxy p);
+std::size_t FormatTo(char16_t *buffer, std::size_t size,
+                     BasicArgInserter<char16_t>::Proxy p);
+#endif
 }
 
 using format::internal::str;
 using format::internal::c_str;
+using format::internal::FormattedSize;
+using format::internal::FormatTo;
 
-// ArgFormatter provides access to the format buffer within custom
-// Format functions. It is not desirable to pass Formatter to these
-// functions because Formatter::operator() is not reentrant and
-// therefore can't be used for argument formatting.
-class ArgFormatter {
+/**
+  \rst
+  Provides access to the format buffer within custom ``Format`` functions.
+  It is not desirable to pass Formatter to these functions because
+  ``Formatter::operator()`` is not reentrant and therefore can't be used
+  for argument formatting.
+
+  The output is written directly to the buffer of the formatter, so
+  a ``Format`` function built from these primitives doesn't allocate
+  memory other than for growing the buffer::
+
+    void Format(fmt::ArgFormatter &af, const fmt::FormatSpec &spec,
+                const IPAddress &a) {
+      std::size_t start = af.size();
+      fmt::FormatSpec byte_spec;
+      for (int i = 0; i < 4; ++i) {
+        if (i != 0) af.Append(".", 1);
+        af.Write(a.byte(i), byte_spec);
+      }
+      af.Pad(start, spec);
+    }
+  \endrst
+*/
+template <typename Char>
+class BasicArgFormatter {
  private:
-  Formatter &formatter_;
+  GenericFormatter<Char> &formatter_;
+
+  friend class BasicFormatBuf<Char>;
 
  public:
-  explicit ArgFormatter(Formatter &f) : formatter_(f) {}
+  explicit BasicArgFormatter(GenericFormatter<Char> &f) : formatter_(f) {}
 
-  void Write(const std::string &s, const FormatSpec &spec) {
-    formatter_.FormatString(s.data(), s.size(), spec);
-  }
-};
+  /**
+    \rst
+    Returns the number of characters in the buffer.
+    \endrst
+  */
+  std::size_t size() const { return formatter_.size(); }
 
-// The default formatting function.
-template <typename T>
-void Format(ArgFormatter &af, const FormatSpec &spec, const T &value) {
-  std::ostringstream os;
-  os << value;
-  af.Write(os.str(), spec);
-}
+  /**
+    \rst
+    Appends *n* characters to the buffer and returns a pointer to them
+    for the caller to fill in. The pointer is invalidated by the next
+    write.
+    \endrst
+  */
+  Char *Reserve(std::size_t n) { return formatter_.GrowBuffer(n); }
 
-template <typename T>
-void Formatter::FormatCustomArg(const void *arg, const FormatSpec &spec) {
-  ArgFormatter af(*this);
-  Format(af, spec, *static_cast<const T*>(arg));
-}
+  /**
+    \rst
+    Appends *n* characters from *s* to the buffer without padding.
+    \endrst
+  */
+  void Append(const Char *s, std::size_t n) {
+    std::copy(s, s + n, formatter_.GrowBuffer(n));
+  }
 
-inline internal::ArgInserter Formatter::operator()(StringRef format) {
-  internal::ArgInserter formatter(this);
-  format_ = format.c_str();
-  args_.clear();
-  return formatter;
-}
+  /**
+    \rst
+    Pads the output written since the position *start*, which is a value
+    returned by :meth:`size`, to the width and alignment given by *spec*.
+    \endrst
+  */
+  void Pad(std::size_t start, const FormatSpec &spec) {
+    formatter_.Pad(start, spec);
+  }
 
-// A formatting action that does nothing.
-struct NoAction {
+  void Write(const Char *s, std::size_t n, const FormatSpec &spec) {
+    formatter_.FormatString(s, n, spec);
+  }
+
+  void Write(const std::basic_string<Char> &s, const FormatSpec &spec) {
+    formatter_.FormatString(s.data(), s.size(), spec);
+  }
+
+  /**
+    \rst
+    Writes an integer formatted according to *spec* which can specify
+    the width, alignment, sign and type such as ``'x'`` for hexadecimal.
+    \endrst
+  */
+  void Write(int value, const FormatSpec &spec) {
+    formatter_.FormatInt(value, spec);
+  }
+  void Write(unsigned value, const FormatSpec &spec) {
+    formatter_.FormatInt(value, spec);
+  }
+  void Write(long value, const FormatSpec &spec) {
+    formatter_.FormatInt(value, spec);
+  }
+  void Write(unsigned long value, const FormatSpec &spec) {
+    formatter_.FormatInt(value, spec);
+  }
+  void Write(internal::LongLong value, const FormatSpec &spec) {
+    formatter_.FormatInt(value, spec);
+  }
+  void Write(internal::ULongLong value, const FormatSpec &spec) {
+    formatter_.FormatInt(value, spec);
+  }
+
+  /**
+    \rst
+    Writes a floating-point number formatted according to *spec* with
+    the given precision or, if it is negative, with the default one.
+    \endrst
+  */
+  void Write(double value, const FormatSpec &spec, int precision = -1) {
+    formatter_.FormatDouble(value, spec, precision);
+  }
+  void Write(long double value, const FormatSpec &spec, int precision = -1) {
+    formatter_.FormatDouble(value, spec, precision);
+  }
+};
+
+typedef BasicArgFormatter<char> ArgFormatter;
+typedef BasicArgFormatter<wchar_t> WArgFormatter;
+
+/**
+  \rst
+  A stream buffer that writes to the format buffer directly. The unused
+  capacity of the format buffer is used as the put area, so output of
+  a stream insertion operator is not copied. The output is committed to
+  the format buffer when the stream buffer is destroyed::
+
+    std::size_t start = af.size();
+    {
+      fmt::FormatBuf buf(af);
+      std::ostream os(&buf);
+      os << value;
+    }
+    af.Pad(start, spec);
+  \endrst
+*/
+template <typename Char>
+class BasicFormatBuf : public std::basic_streambuf<Char> {
+ private:
+  typedef typename std::basic_streambuf<Char>::int_type int_type;
+  typedef typename std::basic_streambuf<Char>::traits_type traits_type;
+
+  BasicWriter<Char> &writer_;
+
+  // Makes the unused capacity of the buffer the put area.
+  void SetPutArea() {
+    std::size_t size = writer_.buffer_.size();
+    writer_.buffer_.resize(writer_.buffer_.capacity());
+    Char *data = &writer_.buffer_[0];
+    this->setp(data + size, data + writer_.buffer_.size());
+  }
+
+  // Shrinks the buffer to the characters written.
+  void Commit() {
+    writer_.buffer_.resize(this->pptr() - &writer_.buffer_[0]);
+  }
+
+  // Do not implement!
+  BasicFormatBuf(const BasicFormatBuf &);
+  void operator=(const BasicFormatBuf &);
+
+ protected:
+  int_type overflow(int_type ch) {
+    if (traits_type::eq_int_type(ch, traits_type::eof()))
+      return traits_type::not_eof(ch);
+    Commit();
+    writer_.buffer_.push_back(traits_type::to_char_type(ch));
+    SetPutArea();
+    return ch;
+  }
+
+ public:
+  explicit BasicFormatBuf(BasicArgFormatter<Char> &af)
+  : writer_(af.formatter_) {
+    SetPutArea();
+  }
+
+  ~BasicFormatBuf() { Commit(); }
+};
+
+typedef BasicFormatBuf<char> FormatBuf;
+typedef BasicFormatBuf<wchar_t> WFormatBuf;
+
+// The default formatting function. It requires a stream insertion
+// operator and therefore a standard stream with the character type.
+// The output is written directly to the format buffer.
+template <typename Char, typename T>
+void Format(BasicArgFormatter<Char> &af, const FormatSpec &spec,
+            const T &value) {
+  std::size_t start = af.size();
+  {
+    BasicFormatBuf<Char> buf(af);
+    std::basic_ostream<Char> os(&buf);
+    os << value;
+  }
+  af.Pad(start, spec);
+}
+
+template <typename Char>
+template <typename T>
+void GenericFormatter<Char>::FormatCustomArg(
+    const void *arg, const FormatSpec &spec) {
+  BasicArgFormatter<Char> af(*this);
+  Format(af, spec, *static_cast<const T*>(arg));
+}
+
+template <typename Char>
+inline internal::BasicArgInserter<Char> GenericFormatter<Char>::operator()(
+    BasicStringRef<Char> format) {
+  internal::BasicArgInserter<Char> formatter(this);
+  format_ = format.c_str();
+  compiled_format_ = 0;
+  ClearArgs();
+  return formatter;
+}
+
+template <typename Char>
+inline internal::BasicArgInserter<Char> GenericFormatter<Char>::operator()(
+    const BasicCompiledFormat<Char> &format) {
+  internal::BasicArgInserter<Char> formatter(this);
+  format_ = 0;
+  compiled_format_ = &format;
+  ClearArgs();
+  return formatter;
+}
+
+#if FMT_USE_VARIADIC_TEMPLATES
+template <typename Char>
+template <typename... Args>
+void GenericFormatter<Char>::FormatArgs(
+    const BasicCompiledFormat<Char> &format, const Args &... args) {
+  // The trailing argument avoids a zero-size array and is not added.
+  const Arg arg_array[] = {args..., 0};
+  ClearArgs();
+  for (std::size_t i = 0; i < sizeof...(Args); ++i)
+    Add(arg_array[i]);
+  format_ = 0;
+  DoFormat(format);
+}
+#endif
+
+// A formatting action that does nothing.
+struct NoAction {
+  template <typename Formatter>
   void operator()(const Formatter &) const {}
 };
 
@@ -601,13 +2069,22 @@ struct NoAction {
   \rst
   A formatter with an action performed when formatting is complete.
   Objects of this class normally exist only as temporaries returned
-  by one of the formatting functions which explains the name.
+  by one of the formatting functions which explains the name. The
+  formatter has an inline buffer of *SIZE* characters, so a temporary
+  with a larger *SIZE* formats longer output without allocating memory
+  and one with a smaller *SIZE* takes less stack space::
+
+    std::size_t n = FormatTo(buffer, sizeof(buffer),
+        fmt::TempFormatter<fmt::NoAction, char, 64>("{0}") << 42);
   \endrst
  */
-template <typename Action = NoAction>
-class TempFormatter : public internal::ArgInserter {
+template <typename Action = NoAction, typename Char = char,
+          std::size_t SIZE = internal::INLINE_BUFFER_SIZE>
+class TempFormatter : public internal::BasicArgInserter<Char> {
  private:
-  Formatter formatter_;
+  typedef internal::BasicArgInserter<Char> Base;
+
+  InlineFormatter<SIZE, Char> formatter_;
   Action action_;
 
   // Forbid copying other than from a temporary. Do not implement.
@@ -617,10 +2094,12 @@ class TempFormatter : public internal::ArgInserter {
   TempFormatter& operator=(const TempFormatter &);
 
   struct Proxy {
-    const char *format;
+    const Char *format;
+    const BasicCompiledFormat<Char> *compiled_format;
     Action action;
 
-    Proxy(const char *fmt, Action a) : format(fmt), action(a) {}
+    Proxy(const Char *fmt, const BasicCompiledFormat<Char> *cf, Action a)
+    : format(fmt), compiled_format(cf), action(a) {}
   };
 
  public:
@@ -628,25 +2107,39 @@ class TempFormatter : public internal::ArgInserter {
   // Action should be an unary function object that takes a const
   // reference to Formatter as an argument. See Ignore and Write
   // for examples of action classes.
-  explicit TempFormatter(StringRef format, Action a = Action())
-  : action_(a) {
-    Init(formatter_, format.c_str());
+  explicit TempFormatter(BasicStringRef<Char> format, Action a = Action())
+  : formatter_(internal::GetTempAllocator()), action_(a) {
+    this->Init(formatter_, format.c_str());
+  }
+
+  // Creates an active formatter with a precompiled format and an action.
+  explicit TempFormatter(const BasicCompiledFormat<Char> &format,
+                         Action a = Action())
+  : formatter_(internal::GetTempAllocator()), action_(a) {
+    this->Init(formatter_, format);
   }
 
   TempFormatter(const Proxy &p)
-  : ArgInserter(0), action_(p.action) {
-    Init(formatter_, p.format);
+  : Base(0), formatter_(internal::GetTempAllocator()),
+    action_(p.action) {
+    if (p.compiled_format)
+      this->Init(formatter_, *p.compiled_format);
+    else
+      this->Init(formatter_, p.format);
   }
 
-  ~TempFormatter() {
-    if (formatter())
-      action_(*Format());
+  ~TempFormatter() FMT_DTOR_THROWS {
+    if (this->formatter()) {
+      this->Format();
+      action_(formatter_);
+    }
   }
 
   operator Proxy() {
-    const char *fmt = format();
-    ResetFormatter();
-    return Proxy(fmt, action_);
+    const Char *fmt = this->format();
+    const BasicCompiledFormat<Char> *cf = this->compiled_format();
+    this->ResetFormatter();
+    return Proxy(fmt, cf, action_);
   }
 };
 
@@ -664,6 +2157,12 @@ class TempFormatter : public internal::ArgInserter {
 
     std::string message = str(Format("Elapsed time: {0:.2f} seconds") << 1.23);
 
+  The arguments are formatted at the end of the full expression. Objects
+  of class types such as ``std::string`` may be temporaries, but a C
+  string argument should not point into a temporary object of the same
+  expression, such as ``std::string("abc").c_str()``, which may be
+  destroyed first.
+
   See also `Format String Syntax`_.
   \endrst
 */
@@ -671,9 +2170,41 @@ inline TempFormatter<> Format(StringRef format) {
   return TempFormatter<>(format);
 }
 
+/**
+  \rst
+  Formats arguments using a precompiled format. The format string is not
+  parsed again, so this is faster than ``Format(StringRef)`` when the same
+  format is used many times.
+
+  **Example**::
+
+    static const fmt::CompiledFormat format("{0}: {1}");
+    std::string message = str(Format(format) << "answer" << 42);
+  \endrst
+*/
+inline TempFormatter<> Format(const CompiledFormat &format) {
+  return TempFormatter<>(format);
+}
+
+/**
+  \rst
+  Formats a wide string. The output is a ``std::wstring``::
+
+    std::wstring message = str(Format(L"{0} = {1}") << L"answer" << 42);
+  \endrst
+*/
+inline TempFormatter<NoAction, wchar_t> Format(WStringRef format) {
+  return TempFormatter<NoAction, wchar_t>(format);
+}
+
+// Formats arguments using a precompiled wide format.
+inline TempFormatter<NoAction, wchar_t> Format(const WCompiledFormat &format) {
+  return TempFormatter<NoAction, wchar_t>(format);
+}
+
 // A formatting action that writes formatted output to stdout.
 struct Write {
-  void operator()(const Formatter &f) const {
+  void operator()(const BasicFormatter &f) const {
     std::fwrite(f.data(), 1, f.size(), stdout);
   }
 };
@@ -684,8 +2215,677 @@ struct Write {
 inline TempFormatter<Write> Print(StringRef format) {
   return TempFormatter<Write>(format);
 }
+
+// Formats arguments using a precompiled format and prints the output
+// to stdout.
+inline TempFormatter<Write> Print(const CompiledFormat &format) {
+  return TempFormatter<Write>(format);
+}
+
+/**
+  \rst
+  A formatter that accumulates output of many formatting operations in
+  its buffer and passes the whole buffer to the output in a single call
+  once its size reaches the flush threshold. Formatted text is written
+  directly into the buffer so it gets to the destination with one copy.
+  *Output* is a function object taking ``const char*`` and ``std::size_t``
+  such as :cpp:class:`format::FileOutput` or :cpp:class:`format::FdOutput`.
+
+  **Example**::
+
+    fmt::BufferedSink<fmt::FileOutput> log((fmt::FileOutput(stderr)));
+    log("{0}: {1}\n") << "error" << 42;
+    log.Flush();
+
+  The remaining output is flushed on destruction ignoring exceptions thrown
+  by the error handler, so call :meth:`Flush` explicitly if errors should
+  be reported.
+  \endrst
+*/
+template <typename Output>
+class BufferedSink {
+ private:
+  Formatter formatter_;
+  Output output_;
+  std::size_t flush_threshold_;
+
+  // Do not implement!
+  BufferedSink(const BufferedSink &);
+  void operator=(const BufferedSink &);
+
+ public:
+  enum { DEFAULT_FLUSH_THRESHOLD = 4096 };
+
+  explicit BufferedSink(Output output = Output(),
+      std::size_t flush_threshold = DEFAULT_FLUSH_THRESHOLD)
+  : output_(output), flush_threshold_(flush_threshold) {}
+
+  ~BufferedSink() {
+#if FMT_EXCEPTIONS
+    try {
+      Flush();
+    } catch (...) {}
+#else
+    Flush();
+#endif
+  }
+
+  /**
+    \rst
+    Formats a string appending the output to the buffer. The buffer is
+    flushed first if its size has reached the threshold.
+    \endrst
+  */
+  internal::ArgInserter operator()(StringRef format) {
+    if (formatter_.size() >= flush_threshold_)
+      Flush();
+    return formatter_(format);
+  }
+
+  /**
+    \rst
+    Formats arguments using a precompiled format appending the output to
+    the buffer. The buffer is flushed first if its size has reached the
+    threshold.
+    \endrst
+  */
+  internal::ArgInserter operator()(const CompiledFormat &format) {
+    if (formatter_.size() >= flush_threshold_)
+      Flush();
+    return formatter_(format);
+  }
+
+  /**
+    \rst
+    Returns the number of buffered characters that haven't been passed
+    to the output yet.
+    \endrst
+  */
+  std::size_t size() const { return formatter_.size(); }
+
+  /**
+    \rst
+    Returns the output function object.
+    \endrst
+  */
+  const Output &output() const { return output_; }
+
+  /**
+    \rst
+    Passes the buffered output to the output function and clears the buffer.
+    \endrst
+  */
+  void Flush() {
+    if (formatter_.size() == 0) return;
+    output_(formatter_.data(), formatter_.size());
+    formatter_.Clear();
+  }
+};
+
+/**
+  \rst
+  An output for :cpp:class:`format::BufferedSink` that writes to a ``FILE``
+  with ``std::fwrite``. Throws :cpp:class:`format::SystemError` on error.
+  \endrst
+*/
+class FileOutput {
+ private:
+  std::FILE *file_;
+
+ public:
+  explicit FileOutput(std::FILE *file = stdout) : file_(file) {}
+
+  void operator()(const char *data, std::size_t size) const;
+};
+
+/**
+  \rst
+  An output for :cpp:class:`format::BufferedSink` that writes to a file
+  descriptor with ``write`` retrying on partial writes and interrupts.
+  Throws :cpp:class:`format::SystemError` on error.
+  \endrst
+*/
+class FdOutput {
+ private:
+  int fd_;
+
+ public:
+  explicit FdOutput(int fd = 1) : fd_(fd) {}
+
+  void operator()(const char *data, std::size_t size) const;
+};
+
+/**
+  \rst
+  An output for :cpp:class:`format::BufferedSink` that copies characters
+  to an output iterator, for example, one pointing into a caller's
+  array or a ``std::back_insert_iterator``.
+  \endrst
+*/
+template <typename OutputIterator>
+class IteratorOutput {
+ private:
+  OutputIterator it_;
+
+ public:
+  explicit IteratorOutput(OutputIterator it = OutputIterator()) : it_(it) {}
+
+  void operator()(const char *data, std::size_t size) {
+    it_ = std::copy(data, data + size, it_);
+  }
+
+  // Returns the iterator past the last written character.
+  OutputIterator iterator() const { return it_; }
+};
+
+/**
+  \rst
+  A sink that writes output of many formatting operations to a file
+  descriptor with ``writev`` without copying long strings. String
+  arguments of at least *min_ref_size* characters that need no padding
+  are referenced rather than copied to the buffer, and
+  :meth:`Flush` passes the buffered text and the referenced strings to
+  ``writev`` as separate pieces. This works with sockets as well as with
+  files, so large payloads are sent without copying them::
+
+    fmt::GatherSink sink(socket_fd);
+    sink("HTTP/1.1 200 OK\r\nContent-Length: {0}\r\n\r\n{1}")
+        << body.size() << body;
+    sink.Flush();
+
+  Since referenced strings are not copied, they should not be modified
+  or destroyed until the output is flushed. In particular, temporary
+  strings should not be passed as arguments. Literal text of the format
+  string is always copied. Output is flushed when the
+  buffer reaches the flush threshold and on destruction ignoring
+  exceptions. Write errors are reported as
+  :cpp:class:`format::SystemError`.
+  \endrst
+*/
+class GatherSink {
+ private:
+  Formatter formatter_;
+  internal::OutputRefs<char> refs_;
+  int fd_;
+  std::size_t flush_threshold_;
+
+  // Do not implement!
+  GatherSink(const GatherSink &);
+  void operator=(const GatherSink &);
+
+ public:
+  enum { DEFAULT_MIN_REF_SIZE = 256, DEFAULT_FLUSH_THRESHOLD = 4096 };
+
+  explicit GatherSink(int fd, std::size_t min_ref_size = DEFAULT_MIN_REF_SIZE,
+      std::size_t flush_threshold = DEFAULT_FLUSH_THRESHOLD)
+  : refs_(min_ref_size), fd_(fd), flush_threshold_(flush_threshold) {
+    formatter_.refs_ = &refs_;
+  }
+
+  ~GatherSink() {
+#if FMT_EXCEPTIONS
+    try {
+      Flush();
+    } catch (...) {}
+#else
+    Flush();
+#endif
+  }
+
+  /**
+    \rst
+    Formats a string appending the output to the sink. The sink is
+    flushed first if its buffer has reached the threshold.
+    \endrst
+  */
+  internal::ArgInserter operator()(StringRef format) {
+    if (formatter_.size() >= flush_threshold_)
+      Flush();
+    return formatter_(format);
+  }
+
+  /**
+    \rst
+    Formats arguments using a precompiled format appending the output to
+    the sink. The sink is flushed first if its buffer has reached the
+    threshold.
+    \endrst
+  */
+  internal::ArgInserter operator()(const CompiledFormat &format) {
+    if (formatter_.size() >= flush_threshold_)
+      Flush();
+    return formatter_(format);
+  }
+
+  /**
+    \rst
+    Returns the number of characters that haven't been written yet
+    including the referenced ones.
+    \endrst
+  */
+  std::size_t size() const;
+
+  /**
+    \rst
+    Returns the number of referenced strings that haven't been written
+    yet.
+    \endrst
+  */
+  std::size_t num_refs() const { return refs_.refs.size(); }
+
+  /**
+    \rst
+    Writes the buffered and referenced output in order and clears the sink.
+    \endrst
+  */
+  void Flush();
+};
+
+#ifndef _WIN32
+/**
+  \rst
+  A sink that writes output of many formatting operations to a file
+  through a shared memory mapping. The formatter buffer is a window of
+  the mapped file, so output is formatted directly into the page cache
+  without copying or calling ``write``. When the window is half full, the
+  file is extended with ``ftruncate`` and a new window of *chunk_size*
+  bytes starting at the end of the output is mapped. Output that doesn't
+  fit into the rest of the window is formatted into memory and copied
+  into the next window. The file is truncated to the exact size of the
+  output when the sink is closed::
+
+    fmt::MappedFileSink sink("export.csv");
+    for (std::size_t i = 0; i < rows.size(); ++i)
+      sink("{0},{1},{2}\n") << rows[i].id << rows[i].name << rows[i].value;
+    sink.Close();
+
+  The sink is closed on destruction ignoring exceptions, so call
+  :meth:`Close` explicitly if errors should be reported. Errors are
+  reported as :cpp:class:`format::SystemError`.
+  \endrst
+*/
+class MappedFileSink {
+ private:
+  // A formatter writing to the mapped window.
+  class WindowFormatter : public GenericFormatter<char> {
+   public:
+    WindowFormatter() : GenericFormatter<char>(0, 0, 0) {}
+
+    void SetWindow(char *data, std::size_t capacity, std::size_t size) {
+      this->buffer_.Reset(data, capacity, size);
+    }
+  };
+
+  WindowFormatter formatter_;
+  int fd_;
+  char *window_;
+  std::size_t window_size_;
+  internal::ULongLong window_offset_;  // The file offset of the window.
+  std::size_t chunk_size_;
+
+  // Maps a new window that starts at the page containing the end of
+  // the output.
+  void Remap();
+
+  // Returns the formatter checking if a new window is needed.
+  WindowFormatter &GetFormatter() {
+    if (formatter_.size() >= window_size_ / 2 || formatter_.data() != window_)
+      Remap();
+    return formatter_;
+  }
+
+  // Do not implement!
+  MappedFileSink(const MappedFileSink &);
+  void operator=(const MappedFileSink &);
+
+ public:
+  enum { DEFAULT_CHUNK_SIZE = 1 << 24 };
+
+  /**
+    \rst
+    Creates or truncates the file *path* and maps its first *chunk_size*
+    bytes rounded up to the page size.
+    \endrst
+  */
+  explicit MappedFileSink(
+      const char *path, std::size_t chunk_size = DEFAULT_CHUNK_SIZE);
+
+  ~MappedFileSink() {
+#if FMT_EXCEPTIONS
+    try {
+      Close();
+    } catch (...) {}
+#else
+    Close();
+#endif
+  }
+
+  /**
+    \rst
+    Formats a string appending the output to the file.
+    \endrst
+  */
+  internal::ArgInserter operator()(StringRef format) {
+    return GetFormatter()(format);
+  }
+
+  /**
+    \rst
+    Formats arguments using a precompiled format appending the output to
+    the file.
+    \endrst
+  */
+  internal::ArgInserter operator()(const CompiledFormat &format) {
+    return GetFormatter()(format);
+  }
+
+  /**
+    \rst
+    Returns the size of the output in bytes.
+    \endrst
+  */
+  internal::ULongLong size() const {
+    return window_offset_ + formatter_.size();
+  }
+
+  /**
+    \rst
+    Unmaps the file, truncates it to the size of the output and closes it.
+    Does nothing if the sink is already closed.
+    \endrst
+  */
+  void Close();
+};
+#endif
+
+#if FMT_USE_FORMAT_CHECK
+namespace internal {
+
+// Categories of argument types that determine which format specifiers
+// are allowed. They mirror Formatter::Type and the constructors of
+// Formatter::Arg, so types without a dedicated constructor are custom.
+enum ArgCategory {
+  INT_ARG, UINT_ARG, DOUBLE_ARG, CHAR_ARG, STRING_ARG, POINTER_ARG, CUSTOM_ARG
+};
+
+template <typename T>
+struct ArgCategoryOf { static constexpr ArgCategory VALUE = CUSTOM_ARG; };
+
+#define FMT_ARG_CATEGORY(Type, category) \
+  template <> \
+  struct ArgCategoryOf<Type> { static constexpr ArgCategory VALUE = category; }
+
+FMT_ARG_CATEGORY(signed char, INT_ARG);
+FMT_ARG_CATEGORY(short, INT_ARG);
+FMT_ARG_CATEGORY(int, INT_ARG);
+FMT_ARG_CATEGORY(long, INT_ARG);
+FMT_ARG_CATEGORY(LongLong, INT_ARG);
+FMT_ARG_CATEGORY(unsigned char, UINT_ARG);
+FMT_ARG_CATEGORY(unsigned short, UINT_ARG);
+FMT_ARG_CATEGORY(unsigned, UINT_ARG);
+FMT_ARG_CATEGORY(unsigned long, UINT_ARG);
+FMT_ARG_CATEGORY(ULongLong, UINT_ARG);
+FMT_ARG_CATEGORY(double, DOUBLE_ARG);
+FMT_ARG_CATEGORY(long double, DOUBLE_ARG);
+FMT_ARG_CATEGORY(char, CHAR_ARG);
+FMT_ARG_CATEGORY(char*, STRING_ARG);
+FMT_ARG_CATEGORY(const char*, STRING_ARG);
+FMT_ARG_CATEGORY(std::string, STRING_ARG);
+FMT_ARG_CATEGORY(StringRef, STRING_ARG);
+#if FMT_USE_STRING_VIEW
+FMT_ARG_CATEGORY(std::string_view, STRING_ARG);
+#endif
+FMT_ARG_CATEGORY(void*, POINTER_ARG);
+FMT_ARG_CATEGORY(const void*, POINTER_ARG);
+
+#undef FMT_ARG_CATEGORY
+
+template <typename... Args>
+struct ArgList {};
+
+// Returns the list of argument types. Used in unevaluated context only.
+template <typename... Args>
+ArgList<Args...> MakeArgList(const Args &...);
+
+// Reports an error found when checking a format string. This function is
+// intentionally not constexpr, so calling it during constant evaluation
+// makes a check fail at compile time with the message in the diagnostic.
+inline void ReportFormatStringError(const char *message) {
+  ReportError(message);
+}
+
+// Checks a format string against argument categories. It follows the
+// rules of FormatParser but can be evaluated at compile time.
+class FormatChecker {
+ private:
+  const ArgCategory *types_;
+  unsigned num_args_;
+  int next_arg_index_;
+
+  static constexpr unsigned MAX_INT = static_cast<unsigned>(-1) / 2;
+
+  constexpr unsigned ParseUInt(const char *&s) const {
+    unsigned value = 0;
+    do {
+      unsigned new_value = value * 10 + (*s++ - '0');
+      if (new_value < value)  // Check if value wrapped around.
+        ReportFormatStringError("number is too big in format");
+      value = new_value;
+    } while ('0' <= *s && *s <= '9');
+    if (value > MAX_INT)
+      ReportFormatStringError("number is too big in format");
+    return value;
+  }
+
+  constexpr ArgCategory ParseArg(const char *&s) {
+    unsigned arg_index = 0;
+    if (*s < '0' || *s > '9') {
+      if (*s != '}' && *s != ':')
+        ReportFormatStringError("invalid argument index in format string");
+      if (next_arg_index_ < 0) {
+        ReportFormatStringError(
+            "cannot switch from manual to automatic argument indexing");
+      }
+      arg_index = next_arg_index_++;
+    } else {
+      if (next_arg_index_ > 0) {
+        ReportFormatStringError(
+            "cannot switch from automatic to manual argument indexing");
+      }
+      next_arg_index_ = -1;
+      arg_index = ParseUInt(s);
+    }
+    if (arg_index >= num_args_)
+      ReportFormatStringError("argument index is out of range in format");
+    return types_[arg_index];
+  }
+
+  static constexpr void RequireNumeric(ArgCategory type) {
+    if (type > DOUBLE_ARG)
+      ReportFormatStringError("format specifier requires numeric argument");
+  }
+
+  static constexpr void RequireSigned(ArgCategory type) {
+    RequireNumeric(type);
+    if (type == UINT_ARG)
+      ReportFormatStringError("format specifier requires signed argument");
+  }
+
+  static constexpr void CheckType(ArgCategory type, char code) {
+    const char *codes = "";
+    const char *message = "";
+    switch (type) {
+    case INT_ARG: case UINT_ARG:
+      codes = "dxXo";
+      message = "unknown format code for integer";
+      break;
+    case DOUBLE_ARG:
+      codes = "eEfFgG";
+      message = "unknown format code for double";
+      break;
+    case CHAR_ARG:
+      codes = "c";
+      message = "unknown format code for char";
+      break;
+    case STRING_ARG:
+      codes = "s";
+      message = "unknown format code for string";
+      break;
+    case POINTER_ARG:
+      codes = "p";
+      message = "unknown format code for pointer";
+      break;
+    case CUSTOM_ARG:
+      message = "unknown format code for object";
+      break;
+    }
+    while (*codes && *codes != code)
+      ++codes;
+    if (!*codes)
+      ReportFormatStringError(message);
+  }
+
+  constexpr void CheckSpec(const char *&s, ArgCategory type) {
+    // Check fill and alignment.
+    if (char c = *s) {
+      const char *p = s + 1;
+      do {
+        if (*p == '<' || *p == '>' || *p == '=' || *p == '^') {
+          char align = *p;
+          if (p != s) {
+            if (c == '}') break;
+            if (c == '{')
+              ReportFormatStringError("invalid fill character '{'");
+            s += 2;
+          } else ++s;
+          if (align == '=')
+            RequireNumeric(type);
+          break;
+        }
+      } while (--p >= s);
+    }
+
+    if (*s == '+' || *s == '-' || *s == ' ') {
+      RequireSigned(type);
+      ++s;
+    }
+
+    if (*s == '#') {
+      RequireNumeric(type);
+      ++s;
+    }
+
+    if ('0' <= *s && *s <= '9') {
+      if (*s == '0')
+        RequireNumeric(type);
+      ParseUInt(s);
+    }
+
+    bool grouped = *s == ',' || *s == '_';
+    if (grouped) {
+      RequireNumeric(type);
+      ++s;
+    }
+
+    if (*s == '.') {
+      ++s;
+      if ('0' <= *s && *s <= '9') {
+        ParseUInt(s);
+      } else if (*s == '{') {
+        ++s;
+        ArgCategory precision_type = ParseArg(s);
+        if (precision_type != INT_ARG && precision_type != UINT_ARG)
+          ReportFormatStringError("precision is not integer");
+        if (*s++ != '}')
+          ReportFormatStringError("unmatched '{' in format");
+      } else {
+        ReportFormatStringError("missing precision in format");
+      }
+      if (type != DOUBLE_ARG) {
+        ReportFormatStringError(
+            "precision specifier requires floating-point argument");
+      }
+    }
+
+    if (*s != '}' && *s) {
+      if (grouped && (*s == 'x' || *s == 'X' || *s == 'o'))
+        ReportFormatStringError("thousands separator requires decimal format");
+      CheckType(type, *s++);
+    }
+  }
+
+ public:
+  constexpr FormatChecker(const ArgCategory *types, unsigned num_args)
+  : types_(types), num_args_(num_args), next_arg_index_(0) {}
+
+  // Returns true if the format string is valid and reports an error
+  // otherwise.
+  constexpr bool Check(const char *s) {
+    while (*s) {
+      char c = *s++;
+      if (c != '{' && c != '}') continue;
+      if (*s == c) {
+        ++s;
+        continue;
+      }
+      if (c == '}')
+        ReportFormatStringError("unmatched '}' in format");
+      ArgCategory type = ParseArg(s);
+      if (*s == ':') {
+        ++s;
+        CheckSpec(s, type);
+      }
+      if (*s++ != '}')
+        ReportFormatStringError("unmatched '{' in format");
+    }
+    return true;
+  }
+};
+
+// Checks a format string against the types of arguments. If the format
+// string is invalid, this function is not a constant expression when
+// evaluated at compile time and throws FormatError at run time.
+template <typename... Args>
+constexpr bool CheckFormat(ArgList<Args...>, const char *format) {
+  // The trailing element avoids a zero-size array.
+  const ArgCategory types[] = {
+    ArgCategoryOf<typename std::decay<Args>::type>::VALUE..., CUSTOM_ARG
+  };
+  return FormatChecker(types, sizeof...(Args)).Check(format);
+}
+}
+#endif
 }
 
+#if FMT_USE_FORMAT_CHECK
+/**
+  \rst
+  Formats arguments and returns the result as an ``std::string``. The format
+  string, which should be a string literal, is checked against the argument
+  types at compile time and parsed only once into a static
+  :cpp:class:`format::CompiledFormat`. Requires C++14.
+
+  **Example**::
+
+    std::string s = FMT_FORMAT("{:x} {:.2f}", 255, 3.14159);
+    // s == "ff 3.14"
+
+  A format string that doesn't match the arguments such as
+  ``FMT_FORMAT("{:.2f}", 42)`` makes the program ill-formed.
+  \endrst
+*/
+# define FMT_FORMAT(format_str, ...) \
+  ([&]() -> std::string { \
+    static_assert(::format::internal::CheckFormat( \
+        decltype(::format::internal::MakeArgList(__VA_ARGS__))(), \
+        format_str), "invalid format string"); \
+    static const ::format::CompiledFormat compiled_format(format_str); \
+    ::format::Formatter formatter; \
+    formatter.FormatArgs(compiled_format, __VA_ARGS__); \
+    return formatter.str(); \
+  }())
+#endif
+
 namespace fmt = format;
 
 #endif  // FORMAT_H_
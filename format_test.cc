@@ -32,15 +32,29 @@
 #define _SCL_SECURE_NO_WARNINGS
 
 #include <cctype>
+#include <cerrno>
 #include <cfloat>
 #include <climits>
+#include <cstdlib>
 #include <cstring>
+#include <iterator>
 #include <memory>
 #include <gtest/gtest.h>
 #include "format.h"
+#include "async.h"
+#include "binlog.h"
 
 #include <stdint.h>
 
+#ifndef _WIN32
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+#if FMT_USE_ASYNC
+# include <thread>
+#endif
+
 using std::size_t;
 using std::sprintf;
 
@@ -121,13 +135,16 @@ class TestString {
   }
 };
 
-class TestTransact : public format::sprint::AppendTransaction<char> {
+class TestTransact
+  : public format::sprint::AppendTransaction<TestTransact> {
 public:
 	mutable char count;
 	TestTransact() : count('0') {
 
 	}
 
+	size_t RequiredSize() const { return 1; }
+
 	size_t AppendTo(char* dest, size_t destSize) const {
 		if (destSize >= 1) {
 			*dest = count++;
@@ -243,6 +260,130 @@ TEST(ArrayTest, Append) {
   EXPECT_EQ(15u, array.capacity());
 }
 
+TEST(ArrayTest, AppendLarge) {
+  Array<char, 10> array;
+  array.resize(10);
+  std::string s(100, 'x');
+  array.append(s.data(), s.data() + s.size());
+  EXPECT_EQ(110u, array.size());
+  EXPECT_LE(110u, array.capacity());
+  EXPECT_EQ(s, std::string(&array[10], s.size()));
+}
+
+// An allocator that counts allocations and checks deallocations.
+class TestAllocator : public fmt::Allocator {
+ private:
+  std::vector<void*> blocks_;
+  std::vector<std::size_t> sizes_;
+
+ public:
+  ~TestAllocator() {
+    EXPECT_TRUE(blocks_.empty());
+  }
+
+  std::size_t num_blocks() const { return blocks_.size(); }
+  std::size_t last_size() const { return sizes_.empty() ? 0 : sizes_.back(); }
+
+  void *Allocate(std::size_t size) {
+    void *p = std::malloc(size);
+    blocks_.push_back(p);
+    sizes_.push_back(size);
+    return p;
+  }
+
+  void Deallocate(void *p, std::size_t size) {
+    std::vector<void*>::iterator it =
+        std::find(blocks_.begin(), blocks_.end(), p);
+    ASSERT_TRUE(it != blocks_.end());
+    EXPECT_EQ(sizes_[it - blocks_.begin()], size);
+    sizes_.erase(sizes_.begin() + (it - blocks_.begin()));
+    blocks_.erase(it);
+    std::free(p);
+  }
+};
+
+TEST(ArrayTest, Allocator) {
+  TestAllocator alloc;
+  {
+    typedef fmt::internal::AllocatorRef<int> Ref;
+    Array<int, 2, Ref> array((Ref(&alloc)));
+    EXPECT_EQ(&alloc, array.get_allocator().get());
+    array.push_back(1);
+    array.push_back(2);
+    EXPECT_EQ(0u, alloc.num_blocks());
+    array.push_back(3);
+    EXPECT_EQ(1u, alloc.num_blocks());
+    EXPECT_EQ(3 * sizeof(int), alloc.last_size());
+    array.resize(10);
+    EXPECT_EQ(1u, alloc.num_blocks());
+    EXPECT_EQ(10 * sizeof(int), alloc.last_size());
+    EXPECT_EQ(1, array[0]);
+    EXPECT_EQ(3, array[2]);
+  }
+  EXPECT_EQ(0u, alloc.num_blocks());
+}
+
+#if FMT_USE_RVALUE_REFERENCES
+
+TEST(ArrayTest, MoveCtor) {
+  Array<char, 5> array;
+  const char test[] = "test";
+  array.append(test, test + 4);
+  Array<char, 5> array2(std::move(array));
+  EXPECT_EQ(0u, array.size());
+  EXPECT_EQ("test", std::string(&array2[0], array2.size()));
+  // Move a dynamically allocated array.
+  array2.append(test, test + 4);
+  const char *data = &array2[0];
+  Array<char, 5> array3(std::move(array2));
+  EXPECT_EQ(data, &array3[0]);
+  EXPECT_EQ("testtest", std::string(&array3[0], array3.size()));
+  EXPECT_EQ(0u, array2.size());
+  EXPECT_EQ(5u, array2.capacity());
+}
+
+TEST(ArrayTest, MoveAssignment) {
+  TestAllocator alloc;
+  {
+    typedef fmt::internal::AllocatorRef<int> Ref;
+    Array<int, 2, Ref> array((Ref(&alloc)));
+    array.resize(10);
+    array[9] = 42;
+    Array<int, 2, Ref> array2;
+    array2.resize(5);
+    array2 = std::move(array);
+    EXPECT_EQ(&alloc, array2.get_allocator().get());
+    EXPECT_EQ(10u, array2.size());
+    EXPECT_EQ(42, array2[9]);
+    EXPECT_EQ(1u, alloc.num_blocks());
+  }
+  EXPECT_EQ(0u, alloc.num_blocks());
+}
+
+static Formatter MakeFormatter(const std::string &s) {
+  Formatter f;
+  f("{0}!") << s;
+  return f;
+}
+
+TEST(FormatterTest, Move) {
+  std::string s(1000, 'x');
+  Formatter f(MakeFormatter(s));
+  EXPECT_EQ(s + "!", f.str());
+  const char *data = f.data();
+  Formatter f2(std::move(f));
+  EXPECT_EQ(data, f2.data());
+  EXPECT_EQ(0u, f.size());
+  f("{0}") << 42;
+  EXPECT_EQ("42", f.str());
+  f = std::move(f2);
+  EXPECT_EQ(data, f.data());
+  f("{0}") << 1;
+  EXPECT_EQ(s + "!1", f.str());
+}
+
+#endif
+
 class Foo {
 public:
 	Foo(uint32_t val) {}
@@ -297,8 +438,78 @@ TEST(SprintTest, Hex) {
 	f <<  asHexL<NoPad, uint64_t>(val64);
 	EXPECT_STREQ("abcdabcd12341234", f.c_str());
 
+	f.Clear();
+	f << asHexU<NoPad, uint64_t>(val64);
+	EXPECT_STREQ("ABCDABCD12341234", f.c_str());
+}
+
+TEST(SprintTest, Zero) {
+  using namespace format::sprint;
+  Formatter f;
+  f << asHexL<>(0u);
+  f << asOct<>(0u);
+  f << asBin<>(0u);
+  EXPECT_EQ("000", f.str());
+}
+
+TEST(SprintTest, Pad) {
+  using namespace format::sprint;
+  Formatter f;
+  f << asHexL< Pad<8, '0'> >(0xbeefu);
+  EXPECT_EQ("0000beef", f.str());
+  f.Clear();
+  f << asHexU< Pad<3, ' '> >(0u);
+  EXPECT_EQ("  0", f.str());
+  f.Clear();
+  f << asHexL< Pad<2, '*'> >(0x12345u);
+  EXPECT_EQ("12345", f.str());
+}
+
+TEST(SprintTest, OctAndBin) {
+  using namespace format::sprint;
+  Formatter f;
+  f << asOct<>(0755u);
+  EXPECT_EQ("755", f.str());
+  f.Clear();
+  f << asBin<NoPad, uint8_t>(static_cast<uint8_t>(0xa5));
+  EXPECT_EQ("10100101", f.str());
+  f.Clear();
+  f << asOct<NoPad, uint64_t>(~static_cast<uint64_t>(0));
+  EXPECT_EQ("1777777777777777777777", f.str());
+}
+
+// Checks that sprints are not dropped when they don't fit into the
+// remaining buffer capacity.
+TEST(SprintTest, GrowBuffer) {
+  using namespace format::sprint;
+  for (std::size_t n = 490; n < 520; ++n) {
+    Formatter f;
+    std::string prefix(n, 'x');
+    f << prefix.c_str();
+    f << asHexL< Pad<8, '0'> >(0xabcu);
+    f << asBin<>(0xffffffffu);
+    EXPECT_EQ(prefix + "00000abc" + std::string(32, '1'), f.str());
+  }
+}
 
-	
+TEST(SprintTest, HexDump) {
+  using namespace format::sprint;
+  Formatter f;
+  const unsigned char data[] = {0x00, 0x0f, 0xa5, 0xff};
+  f << HexDump<>(data, sizeof(data));
+  EXPECT_EQ("000fa5ff", f.str());
+  f.Clear();
+  f << HexDump<UpperHex>(data, sizeof(data));
+  EXPECT_EQ("000FA5FF", f.str());
+  f.Clear();
+  f << HexDump<>(data, 0);
+  EXPECT_EQ("", f.str());
+  std::string block(1000, '\x5a');
+  f << HexDump<>(block.data(), block.size());
+  std::string expected;
+  for (std::size_t i = 0; i < block.size(); ++i)
+    expected += "5a";
+  EXPECT_EQ(expected, f.str());
 }
 
 TEST(FormatterTest, Escape) {
@@ -322,6 +533,24 @@ TEST(FormatterTest, UnmatchedBraces) {
   EXPECT_THROW_MSG(Format("{0{}"), FormatError, "unmatched '{' in format");
 }
 
+// Checks that fields and escaped braces are found at every position of
+// a literal and for every alignment of the format string.
+TEST(FormatterTest, LongLiterals) {
+  char buffer[256];
+  for (std::size_t offset = 0; offset < 16; ++offset) {
+    for (std::size_t pos = 0; pos < 48; ++pos) {
+      std::string literal(pos, 'x');
+      std::string format = literal + "{0}" + literal + "}}" + literal;
+      std::strcpy(buffer + offset, format.c_str());
+      EXPECT_EQ(literal + "42" + literal + "}" + literal,
+                str(Format(buffer + offset) << 42));
+      EXPECT_EQ(literal + "42" + literal + "}" + literal,
+                str(Format(fmt::CompiledFormat(buffer + offset)) << 42));
+    }
+  }
+  EXPECT_EQ(std::string(100, '-'), str(Format(std::string(100, '-'))));
+}
+
 TEST(FormatterTest, NoArgs) {
   EXPECT_EQ("test", str(Format("test")));
 }
@@ -344,6 +573,13 @@ TEST(FormatterTest, ArgErrors) {
   EXPECT_THROW_MSG(Format("{0"), FormatError, "unmatched '{' in format");
   EXPECT_THROW_MSG(Format("{0}"), FormatError,
       "argument index is out of range in format");
+  // '{' here is a type code, so the field is terminated.
+  EXPECT_THROW_MSG(Format("{0:5{}"), FormatError,
+      "argument index is out of range in format");
+  EXPECT_THROW_MSG(Format("{0: {}") << "abc", FormatError,
+      "format specifier ' ' requires numeric argument");
+  EXPECT_THROW_MSG(Format("{0: {") << "abc", FormatError,
+      "unmatched '{' in format");
 
   char format[256];
   std::sprintf(format, "{%u", UINT_MAX);
@@ -363,6 +599,8 @@ TEST(FormatterTest, ArgErrors) {
 
 TEST(FormatterTest, AutoArgIndex) {
   EXPECT_EQ("abc", str(Format("{}{}{}") << 'a' << 'b' << 'c'));
+  EXPECT_THROW_MSG(Format("{}{}") << 'a',
+      FormatError, "argument index is out of range in format");
   EXPECT_THROW_MSG(Format("{0}{}") << 'a' << 'b',
       FormatError, "cannot switch from manual to automatic argument indexing");
   EXPECT_THROW_MSG(Format("{}{0}") << 'a' << 'b',
@@ -482,6 +720,9 @@ TEST(FormatterTest, PlusSign) {
   EXPECT_EQ("+42", str(Format("{0:+}") << 42l));
   EXPECT_THROW_MSG(Format("{0:+}") << 42ul,
       FormatError, "format specifier '+' requires signed argument");
+  EXPECT_EQ("+42", str(Format("{0:+}") << 42ll));
+  EXPECT_THROW_MSG(Format("{0:+}") << 42ull,
+      FormatError, "format specifier '+' requires signed argument");
   EXPECT_EQ("+42", str(Format("{0:+}") << 42.0));
   EXPECT_EQ("+42", str(Format("{0:+}") << 42.0l));
   EXPECT_THROW_MSG(Format("{0:+") << 'c',
@@ -560,6 +801,12 @@ TEST(FormatterTest, HashFlag) {
   EXPECT_EQ("42", str(Format("{0:#}") << 42ul));
   EXPECT_EQ("0x42", str(Format("{0:#x}") << 0x42ul));
   EXPECT_EQ("042", str(Format("{0:#o}") << 042ul));
+  EXPECT_EQ("0x000042", str(Format("{0:#08x}") << 0x42));
+  EXPECT_EQ("-0x00042", str(Format("{0:#08x}") << -0x42));
+  EXPECT_EQ("0X**42", str(Format("{0:*=#6X}") << 0x42));
+  EXPECT_EQ("0x42", str(Format("{0:#04x}") << 0x42));
+  EXPECT_EQ("-000042", str(Format("{0:#07o}") << -042));
+  EXPECT_EQ("0**42", str(Format("{0:*=#5o}") << 042));
   EXPECT_EQ("-42.0000", str(Format("{0:#}") << -42.0));
   EXPECT_EQ("-42.0000", str(Format("{0:#}") << -42.0l));
   EXPECT_THROW_MSG(Format("{0:#") << 'c',
@@ -775,7 +1022,7 @@ template <typename T>
 void CheckUnknownTypes(
     const T &value, const char *types, const char *type_name) {
   char format[256], message[256];
-  const char *special = ".0123456789}";
+  const char *special = ".,_0123456789}";
   for (int i = CHAR_MIN; i <= CHAR_MAX; ++i) {
     char c = i;
     if (std::strchr(types, c) || std::strchr(special, c) || !c) continue;
@@ -795,6 +1042,51 @@ TEST(FormatterTest, FormatInt) {
   CheckUnknownTypes(42, "doxX", "integer");
 }
 
+TEST(FormatterTest, FormatDecDigitCounts) {
+  char buffer[256];
+  unsigned long power = 1;
+  for (int i = 0; i < std::numeric_limits<unsigned long>::digits10; ++i) {
+    unsigned long values[] = {power - 1, power, power + 1};
+    for (int j = 0; j < 3; ++j) {
+      sprintf(buffer, "%lu", values[j]);
+      EXPECT_EQ(buffer, str(Format("{0}") << values[j]));
+    }
+    power *= 10;
+  }
+}
+
+TEST(FormatterTest, FormatInts) {
+  Formatter f;
+  f("x:");
+  const int ints[] = {0, 42, -42, INT_MIN, INT_MAX, 100000000};
+  f.FormatInts(ints, ints + sizeof(ints) / sizeof(*ints), ',');
+  char buffer[256];
+  sprintf(buffer, "x:0,42,-42,%d,%d,100000000", INT_MIN, INT_MAX);
+  EXPECT_EQ(buffer, f.str());
+  f.FormatInts(ints, ints, ',');
+  EXPECT_EQ(buffer, f.str());
+
+  f.Clear();
+  const unsigned long ulongs[] = {ULONG_MAX, 1};
+  f.FormatInts(ulongs, ulongs + 2, '\n');
+  sprintf(buffer, "%lu\n1", ULONG_MAX);
+  EXPECT_EQ(buffer, f.str());
+
+  f.Clear();
+  const long longs[] = {LONG_MIN, LONG_MAX};
+  f.FormatInts(longs, longs + 2, ' ');
+  sprintf(buffer, "-%lu %ld",
+      0 - static_cast<unsigned long>(LONG_MIN), LONG_MAX);
+  EXPECT_EQ(buffer, f.str());
+
+  std::vector<unsigned> column(1000, UINT_MAX);
+  f.Clear();
+  f.FormatInts(&column[0], &column[0] + column.size(), ';');
+  sprintf(buffer, "%u", UINT_MAX);
+  EXPECT_EQ((std::strlen(buffer) + 1) * column.size() - 1, f.size());
+  EXPECT_EQ(std::string(buffer) + ";", f.str().substr(0, f.size() / 1000 + 1));
+}
+
 TEST(FormatterTest, FormatDec) {
   EXPECT_EQ("0", str(Format("{0}") << 0));
   EXPECT_EQ("42", str(Format("{0}") << 42));
@@ -818,6 +1110,93 @@ TEST(FormatterTest, FormatDec) {
   EXPECT_EQ(buffer, str(Format("{0}") << ULONG_MAX));
 }
 
+TEST(FormatterTest, FormatLongLong) {
+  char buffer[256];
+  sprintf(buffer, "%lld", LLONG_MIN);
+  EXPECT_EQ(buffer, str(Format("{0}") << LLONG_MIN));
+  sprintf(buffer, "%lld", LLONG_MAX);
+  EXPECT_EQ(buffer, str(Format("{0}") << LLONG_MAX));
+  sprintf(buffer, "%llu", ULLONG_MAX);
+  EXPECT_EQ(buffer, str(Format("{0}") << ULLONG_MAX));
+  sprintf(buffer, "%llx", ULLONG_MAX);
+  EXPECT_EQ(buffer, str(Format("{0:x}") << ULLONG_MAX));
+  sprintf(buffer, "-%llo", 0 - static_cast<unsigned long long>(LLONG_MIN));
+  EXPECT_EQ(buffer, str(Format("{0:o}") << LLONG_MIN));
+  sprintf(buffer, "%+025lld", 1234567890123456789ll);
+  EXPECT_EQ(buffer, str(Format("{0:+025}") << 1234567890123456789ll));
+  EXPECT_EQ("    -42", str(Format("{0:>7}") << -42ll));
+  EXPECT_EQ("1.50", str(Format("{0:.{1}f}") << 1.5 << 2ll));
+  EXPECT_EQ("1.50", str(Format("{0:.{1}f}") << 1.5 << 2ull));
+  EXPECT_THROW_MSG(Format("{0:.{1}f}") << 1.5 << -2ll,
+      FormatError, "negative precision in format");
+  EXPECT_THROW_MSG(Format("{0:.{1}f}") << 1.5 << ULLONG_MAX,
+      FormatError, "number is too big in format");
+
+  fmt::Formatter f;
+  const long long values[] = {LLONG_MIN, 0, LLONG_MAX};
+  f.FormatInts(values, values + 3, ',');
+  sprintf(buffer, "%lld,0,%lld", LLONG_MIN, LLONG_MAX);
+  EXPECT_EQ(buffer, f.str());
+}
+
+TEST(FormatterTest, ThousandsSeparator) {
+  EXPECT_EQ("0", str(Format("{0:,}") << 0));
+  EXPECT_EQ("999", str(Format("{0:,}") << 999));
+  EXPECT_EQ("1,000", str(Format("{0:,}") << 1000));
+  EXPECT_EQ("-123,456", str(Format("{0:,d}") << -123456));
+  EXPECT_EQ("+1_234_567", str(Format("{0:+_}") << 1234567));
+  EXPECT_EQ("1_234_567", str(Format("{0:_}") << 1234567u));
+  EXPECT_EQ("18,446,744,073,709,551,615",
+            str(Format("{0:,}") << ULLONG_MAX));
+  EXPECT_EQ("-9,223,372,036,854,775,808", str(Format("{0:,}") << LLONG_MIN));
+  EXPECT_EQ("  12,345|", str(Format("{0:>8,}|") << 12345));
+  // Zero padding is grouped without a leading separator as in Python.
+  EXPECT_EQ("-0,012,345", str(Format("{0:09,}") << -12345));
+  EXPECT_EQ("01,234", str(Format("{0:06,}") << 1234));
+  EXPECT_EQ("-000,000,001,234,567", str(Format("{0:020,}") << -1234567));
+  EXPECT_EQ("+0_001_234", str(Format("{0:0=+10_}") << 1234));
+  EXPECT_EQ("000001,234", str(Format("{0:0>10,}") << 1234));
+  EXPECT_EQ(20u, FormattedSize(Format("{0:020,}") << -1234567));
+  EXPECT_EQ("00,000,000,001,234.5", str(Format("{0:020,.1f}") << 1234.5));
+  EXPECT_EQ("000,000.50", str(Format("{0:010,.2f}") << 0.5));
+  EXPECT_EQ("-0,000,001,234,567.89",
+            str(Format("{0:020,.2f}") << -1234567.891l));
+  EXPECT_EQ("000,001.5e+20", str(Format("{0:013,}") << 1.5e20));
+  EXPECT_EQ("-0,001.5e-07", str(Format("{0:012,.1e}") << -1.5e-7l));
+  EXPECT_EQ("*12,345**", str(Format("{0:*^9,}") << 12345l));
+  EXPECT_EQ("1,234,567.89", str(Format("{0:,.2f}") << 1234567.891));
+  EXPECT_EQ("1_234.5", str(Format("{0:_}") << 1234.5));
+  EXPECT_EQ("100,000", str(Format("{0:,g}") << 1e5));
+  EXPECT_EQ("1.5e+20", str(Format("{0:,}") << 1.5e20));
+  EXPECT_EQ("0.25", str(Format("{0:,}") << 0.25));
+  EXPECT_EQ("123.000", str(Format("{0:,.3f}") << 123.0));
+  EXPECT_EQ("1,234,567.50", str(Format("{0:,.2f}") << 1234567.5l));
+  EXPECT_EQ(" -1,234.5", str(Format("{0:>9,}") << -1234.5l));
+  EXPECT_EQ(L"1,000,000", str(Format(L"{0:,}") << 1000000));
+  EXPECT_THROW_MSG(Format("{0:,}") << 'c',
+      FormatError, "format specifier ',' requires numeric argument");
+  EXPECT_THROW_MSG(Format("{0:_}") << "abc",
+      FormatError, "format specifier '_' requires numeric argument");
+  EXPECT_THROW_MSG(Format("{0:,x}") << 42,
+      FormatError, "thousands separator requires decimal format");
+  EXPECT_THROW_MSG(fmt::CompiledFormat("{0:,o}"),
+      FormatError, "thousands separator requires decimal format");
+  fmt::CompiledFormat format("{0:,} {1:,.1f}");
+  EXPECT_EQ("1,234 5,678.9", str(Format(format) << 1234 << 5678.9));
+}
+
+TEST(FormatterTest, FormatNarrowInts) {
+  EXPECT_EQ("-42", str(Format("{0}") << static_cast<short>(-42)));
+  EXPECT_EQ("65535", str(Format("{0}")
+      << static_cast<unsigned short>(USHRT_MAX)));
+  EXPECT_EQ("-128", str(Format("{0}") << static_cast<signed char>(-128)));
+  EXPECT_EQ("ff", str(Format("{0:x}") << static_cast<unsigned char>(255)));
+  EXPECT_EQ("+7", str(Format("{0:+}") << static_cast<short>(7)));
+  EXPECT_THROW_MSG(Format("{0:+}") << static_cast<unsigned char>(7),
+      FormatError, "format specifier '+' requires signed argument");
+  EXPECT_EQ("x", str(Format("{0}") << 'x'));
+}
+
 TEST(FormatterTest, FormatHex) {
   EXPECT_EQ("0", str(Format("{0:x}") << 0));
   EXPECT_EQ("42", str(Format("{0:x}") << 0x42));
@@ -840,6 +1219,14 @@ TEST(FormatterTest, FormatHex) {
   EXPECT_EQ(buffer, str(Format("{0:x}") << LONG_MAX));
   sprintf(buffer, "%lx", ULONG_MAX);
   EXPECT_EQ(buffer, str(Format("{0:x}") << ULONG_MAX));
+  for (unsigned i = 0; i < 32; ++i) {
+    unsigned value = 1u << i;
+    sprintf(buffer, "%x", value);
+    EXPECT_EQ(buffer, str(Format("{0:x}") << value));
+    sprintf(buffer, "%#X", value - 1);
+    EXPECT_EQ(value == 1 ? "0X0" : buffer,
+              str(Format("{0:#X}") << value - 1));
+  }
 }
 
 TEST(FormatterTest, FormatOct) {
@@ -861,6 +1248,14 @@ TEST(FormatterTest, FormatOct) {
   EXPECT_EQ(buffer, str(Format("{0:o}") << LONG_MAX));
   sprintf(buffer, "%lo", ULONG_MAX);
   EXPECT_EQ(buffer, str(Format("{0:o}") << ULONG_MAX));
+  for (unsigned i = 0; i < 32; ++i) {
+    unsigned value = 1u << i;
+    sprintf(buffer, "%o", value);
+    EXPECT_EQ(buffer, str(Format("{0:o}") << value));
+    sprintf(buffer, "%#o", value - 1);
+    EXPECT_EQ(value == 1 ? "00" : buffer,
+              str(Format("{0:#o}") << value - 1));
+  }
 }
 
 TEST(FormatterTest, FormatDouble) {
@@ -880,6 +1275,54 @@ TEST(FormatterTest, FormatDouble) {
   EXPECT_EQ("+0000392.6", str(Format("{0:+010.4g}") << 392.65));
 }
 
+TEST(FormatterTest, FormatShortestDouble) {
+  EXPECT_EQ("0.1", str(Format("{}") << 0.1));
+  EXPECT_EQ("-0", str(Format("{}") << -0.0));
+  EXPECT_EQ("3.141592653589793", str(Format("{}") << 3.141592653589793));
+  EXPECT_EQ("1e+23", str(Format("{}") << 1e23));
+  EXPECT_EQ("1e-05", str(Format("{}") << 1e-5));
+  EXPECT_EQ("0.0001", str(Format("{}") << 1e-4));
+  EXPECT_EQ("1000000000000000", str(Format("{}") << 1e15));
+  EXPECT_EQ("1e+16", str(Format("{}") << 1e16));
+  EXPECT_EQ("5e-324", str(Format("{}") << 5e-324));
+  EXPECT_EQ("2.2250738585072014e-308",
+      str(Format("{}") << 2.2250738585072014e-308));
+  EXPECT_EQ("1.7976931348623157e+308",
+      str(Format("{}") << 1.7976931348623157e308));
+  EXPECT_EQ("    0.3", str(Format("{:>7}") << 0.3));
+}
+
+TEST(FormatterTest, FormatDoublePrecision) {
+  const double values[] = {
+    0.0, 0.5, 1.5, 2.5, 0.125, 0.375, 9.5, 0.05, 392.65, 1e23,
+    123456789012345678.0, 5e-324, 2.2250738585072009e-308,
+    1.7976931348623157e308, 1.0 / 3
+  };
+  const char *types[] = {"e", "E", "f", "g", "G", "#g", "#e", "#f"};
+  char buffer[1200];
+  for (std::size_t i = 0; i < sizeof(values) / sizeof(*values); ++i) {
+    for (std::size_t j = 0; j < sizeof(types) / sizeof(*types); ++j) {
+      for (int precision = 0; precision < 20; ++precision) {
+        const char *type = types[j];
+        const char *flags = *type == '#' ? "#" : "";
+        if (*flags) ++type;
+        std::string format =
+            str(Format("{{:{}.{}{}}}") << flags << precision << type);
+        std::string printf_format =
+            str(Format("%{}.{}{}") << flags << precision << type);
+        sprintf(buffer, printf_format.c_str(), values[i]);
+        EXPECT_EQ(buffer, str(Format(format) << values[i])) << format;
+      }
+    }
+  }
+  sprintf(buffer, "%.400e", 0.1);
+  EXPECT_EQ(buffer, str(Format("{:.400e}") << 0.1));
+  sprintf(buffer, "%.1074f", 5e-324);
+  EXPECT_EQ(buffer, str(Format("{:.1074f}") << 5e-324));
+  sprintf(buffer, "%f", 1e300);
+  EXPECT_EQ(buffer, str(Format("{:f}") << 1e300));
+}
+
 TEST(FormatterTest, FormatNaN) {
   double nan = std::numeric_limits<double>::quiet_NaN();
   EXPECT_EQ("nan", str(Format("{}") << nan));
@@ -890,6 +1333,8 @@ TEST(FormatterTest, FormatNaN) {
   EXPECT_EQ("nan    ", str(Format("{:<7}") << nan));
   EXPECT_EQ("  nan  ", str(Format("{:^7}") << nan));
   EXPECT_EQ("    nan", str(Format("{:>7}") << nan));
+  EXPECT_EQ("    nan", str(Format("{:7}") << nan));
+  EXPECT_EQ("-000nan", str(Format("{:07}") << -nan));
 }
 
 TEST(FormatterTest, FormatInfinity) {
@@ -902,6 +1347,8 @@ TEST(FormatterTest, FormatInfinity) {
   EXPECT_EQ("inf    ", str(Format("{:<7}") << inf));
   EXPECT_EQ("  inf  ", str(Format("{:^7}") << inf));
   EXPECT_EQ("    inf", str(Format("{:>7}") << inf));
+  EXPECT_EQ("    inf", str(Format("{:7}") << inf));
+  EXPECT_EQ("-000inf", str(Format("{:07}") << -inf));
 }
 
 TEST(FormatterTest, FormatLongDouble) {
@@ -946,6 +1393,27 @@ TEST(FormatterTest, FormatPointer) {
 
 TEST(FormatterTest, FormatString) {
   EXPECT_EQ("test", str(Format("{0}") << std::string("test")));
+  // Temporary strings are alive until the formatting is complete
+  // wherever they appear among the arguments.
+  EXPECT_EQ("1ab2cd3", str(Format("{0}{1}{2}{3}{4}")
+      << 1 << std::string("ab") << 2 << std::string("cd") << 3));
+  EXPECT_EQ("ab1", str(Format("{1}{0}") << 1 << std::string("ab")));
+}
+
+TEST(FormatterTest, FormatStringRef) {
+  // The strings are not null-terminated.
+  const char data[] = {'a', 'b', 'c', 'x'};
+  EXPECT_EQ("[abc]", str(Format("[{0}]") << StringRef(data, 3)));
+  EXPECT_EQ("[]", str(Format("[{0}]") << StringRef(data, 0)));
+  EXPECT_EQ("[ ab]", str(Format("[{0:>3}]") << StringRef(data, 2)));
+  EXPECT_EQ(5u, FormattedSize(Format("[{0}]") << StringRef(data, 3)));
+  EXPECT_EQ("abc", str(Format("{0}") << StringRef("abc")));
+  CheckUnknownTypes(StringRef(data, 3), "s", "string");
+#if FMT_USE_STRING_VIEW
+  EXPECT_EQ("[bc]", str(Format("[{0}]") << std::string_view(data + 1, 2)));
+  EXPECT_EQ("[]", str(Format("[{0}]") << std::string_view()));
+  EXPECT_EQ(2u, StringRef(std::string_view(data + 1, 2)).size());
+#endif
 }
 
 TEST(ArgFormatterTest, Write) {
@@ -963,6 +1431,65 @@ TEST(ArgFormatterTest, Write) {
   EXPECT_EQ("1234  56", formatter.str());
 }
 
+TEST(ArgFormatterTest, Primitives) {
+  Formatter formatter;
+  fmt::ArgFormatter format(formatter);
+  std::memcpy(format.Reserve(2), "ab", 2);
+  format.Append("cd", 2);
+  EXPECT_EQ(4u, format.size());
+  format.Write("ef", 1, fmt::FormatSpec(3));
+  format.Write(-42, fmt::FormatSpec(4));
+  format.Write(255u, fmt::FormatSpec(0, 'X'));
+  format.Write(42L, fmt::FormatSpec(0, 'o'));
+  format.Write(~0ul, fmt::FormatSpec(0, 'x'));
+  EXPECT_EQ(str(Format("abcde   -42FF52{:x}") << ~0ul), formatter.str());
+  formatter.Clear();
+  format.Write(1.5, fmt::FormatSpec(6));
+  format.Write(0.25, fmt::FormatSpec(0, 'e'), 1);
+  format.Write(1.5L, fmt::FormatSpec(0, 'f'), 2);
+  EXPECT_EQ("   1.52.5e-011.50", formatter.str());
+}
+
+TEST(ArgFormatterTest, DecimalPoint) {
+  Formatter formatter;
+  fmt::ArgFormatter format(formatter);
+  fmt::FormatSpec spec(0, 'f');
+  spec.thousands_sep = '.';
+  spec.decimal_point = ',';
+  format.Write(1234567.891, spec, 2);
+  format.Append(" ", 1);
+  format.Write(1234.5L, spec, 1);
+  format.Append(" ", 1);
+  spec.type = 'e';
+  format.Write(1.5, spec, 1);
+  format.Append(" ", 1);
+  spec.type = 0;
+  format.Write(1234567, spec);
+  EXPECT_EQ("1.234.567,89 1.234,5 1,5e+00 1.234.567", formatter.str());
+}
+
+TEST(ArgFormatterTest, Pad) {
+  Formatter formatter;
+  fmt::ArgFormatter format(formatter);
+  format.Append("x", 1);
+  fmt::FormatSpec spec(5, 0, '*');
+  format.Append("ab", 2);
+  format.Pad(1, spec);
+  EXPECT_EQ("xab***", formatter.str());
+  spec.align = fmt::ALIGN_RIGHT;
+  format.Append("cd", 2);
+  format.Pad(6, spec);
+  EXPECT_EQ("xab******cd", formatter.str());
+  spec.align = fmt::ALIGN_CENTER;
+  format.Append("ef", 2);
+  format.Pad(11, spec);
+  EXPECT_EQ("xab******cd*ef**", formatter.str());
+  spec.width = 1;
+  format.Append("gh", 2);
+  format.Pad(16, spec);
+  EXPECT_EQ("xab******cd*ef**gh", formatter.str());
+}
+
 class Date {
   int year_, month_, day_;
  public:
@@ -978,10 +1505,37 @@ TEST(FormatterTest, FormatUsingIOStreams) {
   EXPECT_EQ("a string", str(Format("{0}") << TestString("a string")));
   std::string s = str(fmt::Format("The date is {0}") << Date(2012, 12, 9));
   EXPECT_EQ("The date is 2012-12-9", s);
+  EXPECT_EQ("[2012-12-9  ]", str(Format("[{0:<11}]") << Date(2012, 12, 9)));
+  EXPECT_EQ("[  2012-12-9]", str(Format("[{0:>11}]") << Date(2012, 12, 9)));
+  EXPECT_EQ("[*2012-12-9*]", str(Format("[{0:*^11}]") << Date(2012, 12, 9)));
   Date date(2012, 12, 9);
   CheckUnknownTypes(date, "", "object");
 }
 
+class LongText {};
+
+std::ostream &operator<<(std::ostream &os, LongText) {
+  for (int i = 0; i < 1000; ++i)
+    os << static_cast<char>('a' + i % 26);
+  return os;
+}
+
+TEST(FormatterTest, FormatBufGrowsBuffer) {
+  std::string expected;
+  for (int i = 0; i < 1000; ++i)
+    expected += static_cast<char>('a' + i % 26);
+  EXPECT_EQ("<" + expected + ">" + expected.substr(0, 3),
+      str(Format("<{0}>{1}") << LongText() << expected.substr(0, 3)));
+  Formatter f;
+  {
+    fmt::ArgFormatter af(f);
+    fmt::FormatBuf buf(af);
+    std::ostream os(&buf);
+    os << 42 << ' ' << LongText();
+  }
+  EXPECT_EQ("42 " + expected, f.str());
+}
+
 class Answer {};
 
 void Format(fmt::ArgFormatter &af, const fmt::FormatSpec &spec, Answer) {
@@ -1009,6 +1563,312 @@ TEST(FormatterTest, FormatterCtor) {
   EXPECT_EQ("part1part2", format.str());
 }
 
+TEST(FormatterTest, Allocator) {
+  TestAllocator alloc;
+  {
+    Formatter f(&alloc);
+    EXPECT_EQ(&alloc, f.allocator());
+    f("{0}") << 42;
+    EXPECT_EQ(0u, alloc.num_blocks());
+    std::string s(1000, 'x');
+    f("{0}{1}{2}{3}{4}{5}{6}{7}{8}{9}{10}")
+        << s << 0 << 1 << 2 << 3 << 4 << 5 << 6 << 7 << 8 << 9;
+    // The output, argument types and argument values.
+    EXPECT_EQ(3u, alloc.num_blocks());
+    EXPECT_EQ("42" + s + "0123456789", f.str());
+  }
+  EXPECT_EQ(0u, alloc.num_blocks());
+  EXPECT_EQ(0, Formatter().allocator());
+}
+
+TEST(FormatterTest, InlineBufferSize) {
+  EXPECT_LT(sizeof(fmt::InlineFormatter<16>), sizeof(Formatter));
+  EXPECT_GT(sizeof(fmt::InlineFormatter<4096>), 4096u);
+  TestAllocator alloc;
+  {
+    fmt::InlineFormatter<4096> f(&alloc);
+    std::string s(3000, 'x');
+    f("{0}{1}") << s << 42;
+    EXPECT_EQ(0u, alloc.num_blocks());
+    EXPECT_EQ(s + "42", f.str());
+    fmt::InlineFormatter<16> small(&alloc);
+    small("{0}") << "0123456789";
+    EXPECT_EQ(0u, alloc.num_blocks());
+    small("{0}") << "0123456789";
+    EXPECT_EQ(1u, alloc.num_blocks());
+    EXPECT_STREQ("01234567890123456789", small.c_str());
+  }
+  EXPECT_EQ(0u, alloc.num_blocks());
+}
+
+TEST(FormatterTest, NoInlineBuffer) {
+  TestAllocator alloc;
+  {
+    fmt::BasicFormatter writer(&alloc);
+    EXPECT_EQ(0u, writer.size());
+    EXPECT_EQ("", writer.str());
+    fmt::GenericFormatter<char> f(&alloc);
+    f("{0}") << 42;
+    EXPECT_EQ(1u, alloc.num_blocks());
+    EXPECT_EQ("42", f.str());
+  }
+  EXPECT_EQ(0u, alloc.num_blocks());
+#if FMT_USE_RVALUE_REFERENCES
+  fmt::GenericFormatter<char> f;
+  f("{0}") << "abc";
+  fmt::GenericFormatter<char> moved(std::move(f));
+  EXPECT_EQ("abc", moved.str());
+  EXPECT_EQ(0u, f.size());
+#endif
+}
+
+#if FMT_USE_RVALUE_REFERENCES
+TEST(FormatterTest, MoveInlineBuffer) {
+  fmt::InlineFormatter<64> large;
+  large("{0}") << "abcdefgh";
+  fmt::InlineFormatter<4> small;
+  // The output doesn't fit into the inline buffer of small.
+  static_cast<fmt::GenericFormatter<char>&>(small) = std::move(large);
+  EXPECT_EQ("abcdefgh", small.str());
+  EXPECT_EQ(0u, large.size());
+  fmt::InlineFormatter<4> f(std::move(small));
+  EXPECT_EQ("abcdefgh", f.str());
+  EXPECT_EQ(0u, small.size());
+}
+#endif
+
+TEST(FormatterTest, TempFormatterSize) {
+  char buffer[16];
+  EXPECT_EQ(2u, FormatTo(buffer, sizeof(buffer),
+      fmt::TempFormatter<fmt::NoAction, char, 64>("{0}") << 42));
+  EXPECT_STREQ("42", buffer);
+  std::string s(100, 'x');
+  EXPECT_EQ(s, str(fmt::TempFormatter<fmt::NoAction, char, 8>("{0}") << s));
+}
+
+TEST(BufferCacheTest, Reuse) {
+  fmt::BufferCache cache(1000);
+  void *p = cache.Allocate(300);
+  EXPECT_EQ(0u, cache.retained_size());
+  cache.Deallocate(p, 300);
+  EXPECT_EQ(300u, cache.retained_size());
+  void *q = cache.Allocate(200);
+  EXPECT_EQ(p, q);
+  EXPECT_EQ(0u, cache.retained_size());
+  void *r = cache.Allocate(400);
+  std::memset(r, 'x', 400);
+  cache.Deallocate(r, 400);
+  // The block keeps its original size.
+  cache.Deallocate(q, 200);
+  EXPECT_EQ(700u, cache.retained_size());
+  // The smaller block is released to make room for a larger one.
+  void *big = cache.Allocate(600);
+  cache.Deallocate(big, 600);
+  EXPECT_EQ(1000u, cache.retained_size());
+  EXPECT_EQ(big, cache.Allocate(500));
+  cache.Deallocate(big, 500);
+  // Blocks larger than the limit are not retained.
+  cache.Deallocate(cache.Allocate(2000), 2000);
+  EXPECT_EQ(1000u, cache.retained_size());
+  cache.set_max_retained_size(600);
+  EXPECT_EQ(600u, cache.retained_size());
+  cache.set_max_retained_size(0);
+  EXPECT_EQ(0u, cache.retained_size());
+}
+
+TEST(BufferCacheTest, Formatter) {
+  fmt::BufferCache cache(1 << 16);
+  std::string s(5000, 'x');
+  {
+    Formatter f(&cache);
+    f("{0}") << s;
+  }
+  std::size_t retained_size = cache.retained_size();
+  EXPECT_GE(retained_size, 5000u);
+  for (int i = 0; i < 10; ++i) {
+    Formatter f(&cache);
+    f("{0}") << s;
+    EXPECT_EQ(s, f.str());
+  }
+  EXPECT_EQ(retained_size, cache.retained_size());
+}
+
+#if FMT_USE_THREAD_LOCAL
+TEST(BufferCacheTest, ThreadCache) {
+  fmt::BufferCache &cache = fmt::GetThreadBufferCache();
+  EXPECT_EQ(0u, cache.max_retained_size());
+  std::string s(1000, 'x');
+  EXPECT_EQ(s, str(Format("{0}") << s));
+  EXPECT_EQ(0u, cache.retained_size());
+  cache.set_max_retained_size(1 << 16);
+  EXPECT_EQ(s, str(Format("{0}") << s));
+  std::size_t retained_size = cache.retained_size();
+  EXPECT_GE(retained_size, 1000u);
+  EXPECT_EQ(s + s, str(Format("{0}{1}") << s << s));
+  EXPECT_EQ(s, str(Format(fmt::CompiledFormat("{0}")) << s));
+  EXPECT_GE(cache.retained_size(), retained_size);
+  cache.set_max_retained_size(0);
+  EXPECT_EQ(0u, cache.retained_size());
+}
+
+TEST(FormatCacheTest, ThreadCache) {
+  fmt::FormatCache &cache = fmt::GetThreadFormatCache();
+  EXPECT_EQ(0u, cache.max_size());
+  EXPECT_EQ("42", str(Format("{0}") << 42));
+  EXPECT_EQ(0u, cache.size());
+  EXPECT_EQ(0u, cache.misses());
+  cache.set_max_size(16);
+  const char *format = "{0}:{1:+.2f}";
+  for (int i = 0; i < 3; ++i)
+    EXPECT_EQ("1:+2.50", str(Format(format) << 1 << 2.5));
+  EXPECT_EQ(1u, cache.size());
+  EXPECT_EQ(1u, cache.misses());
+  EXPECT_EQ(2u, cache.hits());
+  EXPECT_EQ(5u, FormattedSize(Format("{0}{1}") << 42 << "abc"));
+  EXPECT_EQ(2u, cache.misses());
+  cache.Clear();
+  EXPECT_EQ(0u, cache.size());
+  EXPECT_EQ(0u, cache.hits());
+  cache.set_max_size(0);
+}
+
+TEST(FormatCacheTest, Bounded) {
+  fmt::FormatCache &cache = fmt::GetThreadFormatCache();
+  cache.set_max_size(1);
+  const char formats[][4] = {"{0}", "{0}", "{0}"};
+  for (int i = 0; i < 3; ++i)
+    EXPECT_EQ("42", str(Format(formats[i]) << 42));
+  EXPECT_EQ(1u, cache.size());
+  EXPECT_EQ(3u, cache.misses());
+  cache.set_max_size(0);
+}
+
+TEST(FormatCacheTest, Errors) {
+  fmt::FormatCache &cache = fmt::GetThreadFormatCache();
+  cache.set_max_size(16);
+  EXPECT_THROW_MSG(Format("{0") << 42, FormatError, "unmatched '{' in format");
+  EXPECT_THROW_MSG(Format("{1}{") << 42,
+      FormatError, "argument index is out of range in format");
+  EXPECT_EQ(0u, cache.size());
+  const char *format = "{1}";
+  EXPECT_THROW_MSG(Format(format) << 42,
+      FormatError, "argument index is out of range in format");
+  // Formats are cached after they are formatted without errors.
+  EXPECT_EQ(0u, cache.size());
+  EXPECT_EQ("b", str(Format(format) << 'a' << 'b'));
+  EXPECT_EQ(1u, cache.size());
+  EXPECT_THROW_MSG(Format(format) << 42,
+      FormatError, "argument index is out of range in format");
+  EXPECT_EQ(1u, cache.hits());
+  EXPECT_THROW_MSG(Format("{0:d}") << "abc",
+      FormatError, "unknown format code 'd' for string");
+  EXPECT_EQ(1u, cache.size());
+  cache.set_max_size(0);
+}
+
+class Nested {};
+
+void Format(fmt::ArgFormatter &af, const fmt::FormatSpec &spec, Nested) {
+  af.Write(str(Format("[{0}]") << 42), spec);
+}
+
+TEST(FormatCacheTest, Nested) {
+  fmt::FormatCache &cache = fmt::GetThreadFormatCache();
+  // All formats conflict, so the inner one can't replace the outer one.
+  cache.set_max_size(1);
+  for (int i = 0; i < 3; ++i)
+    EXPECT_EQ("<[42]>", str(Format("<{0}>") << Nested()));
+  EXPECT_EQ(1u, cache.size());
+  EXPECT_EQ(2u, cache.hits());
+  cache.set_max_size(0);
+}
+#endif
+
+#if FMT_USE_FORMAT_STATS
+TEST(FormatStatsTest, Counts) {
+  fmt::FormatStats &stats = fmt::GetThreadFormatStats();
+  stats.Clear();
+  const char *format = "{0}\t\"{1}\"";
+  for (int i = 0; i < 3; ++i)
+    EXPECT_EQ("42\t\"abc\"", str(Format(format) << 42 << "abc"));
+  EXPECT_EQ(6u, FormattedSize(Format(format) << 42 << "x"));
+  std::string s(1000, 'x');
+  EXPECT_EQ(s, str(Format("{0}") << s));
+  EXPECT_EQ(2u, stats.size());
+  std::vector<fmt::FormatStats::Entry> entries = stats.GetEntries();
+  ASSERT_EQ(2u, entries.size());
+  if (entries[0].format != format)
+    std::swap(entries[0], entries[1]);
+  EXPECT_EQ(format, entries[0].format);
+  EXPECT_FALSE(entries[0].compiled);
+  EXPECT_STREQ("{0}\\t\\\"{1}\\\"", entries[0].text);
+  EXPECT_EQ(3u, entries[0].calls);
+  EXPECT_EQ(24u, entries[0].bytes);
+  EXPECT_EQ(0u, entries[0].grows);
+  EXPECT_EQ(1u, entries[1].calls);
+  EXPECT_EQ(1000u, entries[1].bytes);
+  EXPECT_GE(entries[1].grows, 1u);
+  stats.Clear();
+  EXPECT_EQ(0u, stats.size());
+}
+
+TEST(FormatStatsTest, CompiledFormat) {
+  fmt::FormatStats &stats = fmt::GetThreadFormatStats();
+  stats.Clear();
+  fmt::CompiledFormat format("{0}");
+  for (int i = 0; i < 2; ++i)
+    EXPECT_EQ("42", str(Format(format) << 42));
+  std::vector<fmt::FormatStats::Entry> entries = stats.GetEntries();
+  ASSERT_EQ(1u, entries.size());
+  EXPECT_EQ(&format, entries[0].format);
+  EXPECT_TRUE(entries[0].compiled);
+  EXPECT_STREQ("", entries[0].text);
+  EXPECT_EQ(2u, entries[0].calls);
+  EXPECT_EQ(4u, entries[0].bytes);
+  stats.Clear();
+}
+
+TEST(FormatStatsTest, CachedFormat) {
+  fmt::FormatStats &stats = fmt::GetThreadFormatStats();
+  stats.Clear();
+  fmt::FormatCache &cache = fmt::GetThreadFormatCache();
+  cache.set_max_size(16);
+  const char *format = "<{0}>";
+  for (int i = 0; i < 3; ++i)
+    EXPECT_EQ("<[42]>", str(Format(format) << Nested()));
+  cache.set_max_size(0);
+  // Cached formats are counted once under the format string and nested
+  // operations are counted separately.
+  EXPECT_EQ(2u, stats.size());
+  std::vector<fmt::FormatStats::Entry> entries = stats.GetEntries();
+  ASSERT_EQ(2u, entries.size());
+  for (std::size_t i = 0; i < entries.size(); ++i) {
+    EXPECT_FALSE(entries[i].compiled);
+    EXPECT_EQ(3u, entries[i].calls);
+  }
+  stats.Clear();
+}
+
+TEST(FormatStatsTest, Dump) {
+  fmt::FormatStats &stats = fmt::GetThreadFormatStats();
+  stats.Clear();
+  for (int i = 0; i < 100; ++i)
+    str(Format("{0}\n") << i);
+  std::FILE *f = std::tmpfile();
+  ASSERT_TRUE(f != 0);
+  stats.Dump(f);
+  std::rewind(f);
+  char buffer[256] = "";
+  ASSERT_TRUE(std::fgets(buffer, sizeof(buffer), f) != 0);
+  EXPECT_TRUE(std::strstr(buffer, "calls") != 0);
+  ASSERT_TRUE(std::fgets(buffer, sizeof(buffer), f) != 0);
+  EXPECT_TRUE(std::strstr(buffer, "100 ") != 0);
+  EXPECT_TRUE(std::strstr(buffer, "\"{0}\\n\"\n") != 0);
+  std::fclose(f);
+  stats.Clear();
+}
+#endif
+
 TEST(FormatterTest, FormatterAppend) {
   Formatter format;
   format("part{0}") << 1;
@@ -1023,6 +1883,15 @@ TEST(FormatterTest, FormatterAppend) {
   EXPECT_EQ("part1part2", format.str());
 }
 
+TEST(FormatterTest, AppendString) {
+  Formatter f;
+  f << "abc";
+  f << std::string("def");
+  f << StringRef("ghijk", 2);
+  f << StringRef("", 0);
+  EXPECT_EQ("abcdefgh", f.str());
+}
+
 TEST(FormatterTest, FormatterExamples) {
   EXPECT_EQ("42", str(Format("{}") << 42));
   EXPECT_EQ("42", str(Format(std::string("{}")) << 42));
@@ -1051,6 +1920,68 @@ TEST(FormatterTest, ArgInserter) {
 TEST(FormatterTest, StrNamespace) {
   fmt::str(Format(""));
   fmt::c_str(Format(""));
+  fmt::FormattedSize(Format(""));
+  fmt::FormatTo(0, 0, Format(""));
+}
+
+// Checks that FormattedSize gives the size of the output of Format.
+#define CHECK_FORMATTED_SIZE(format, args) \
+  EXPECT_EQ(str(Format(format) << args).size(), \
+            FormattedSize(Format(format) << args))
+
+TEST(FormatterTest, FormattedSize) {
+  EXPECT_EQ(0u, FormattedSize(Format("")));
+  EXPECT_EQ(6u, FormattedSize(Format("a{{b}}cd")));
+  CHECK_FORMATTED_SIZE("{0}", 0);
+  CHECK_FORMATTED_SIZE("{0} {1} {2}", 42 << -42 << INT_MIN);
+  CHECK_FORMATTED_SIZE("{0} {1}", UINT_MAX << ULONG_MAX);
+  CHECK_FORMATTED_SIZE("{0} {1:x}", LLONG_MIN << ULLONG_MAX);
+  CHECK_FORMATTED_SIZE("{0:,} {1:_.2f}", -1234567 << 1e10);
+  CHECK_FORMATTED_SIZE("{0} {1}", LONG_MIN << LONG_MAX);
+  CHECK_FORMATTED_SIZE("{0:+} {0: } {0:+d} {1:+}", 42 << -42);
+  CHECK_FORMATTED_SIZE("{0:x} {0:#X} {1:#x} {2:x}", 0 << 0xbeef << -0xbeef);
+  CHECK_FORMATTED_SIZE("{0:o} {0:#o} {1:#o} {2:+o}", 0 << 0777 << 8);
+  CHECK_FORMATTED_SIZE("{0:10} {0:<10} {0:^10} {0:=+10}", 42);
+  CHECK_FORMATTED_SIZE("{0:1} {0:#010x}", 0xbeef);
+  CHECK_FORMATTED_SIZE("{0} {0:5} {0:^5c}", 'x');
+  CHECK_FORMATTED_SIZE("{0} {0:2} {0:>8} {1}{2}", "abc" << "" << std::string("de"));
+  CHECK_FORMATTED_SIZE("{0} {0:20p}", reinterpret_cast<void*>(0xdeadbeef));
+  CHECK_FORMATTED_SIZE("{0} {0:.{1}f} {0:e} {0:20g}", 3.14159 << 7);
+  CHECK_FORMATTED_SIZE("{0} {1:-^12.3}", 1e300 << -1.5l);
+  CHECK_FORMATTED_SIZE("{0} {0:*^20}", Date(2012, 12, 9));
+  EXPECT_EQ(6u, FormattedSize(Format(fmt::CompiledFormat("{0:>4}{1}"))
+      << 42 << "ab"));
+  EXPECT_EQ(5u, FormattedSize(Format(L"{0:>5}") << L"abc"));
+}
+
+TEST(FormatterTest, FormattedSizeDoesNotWrite) {
+  Formatter f;
+  f("abc");
+  EXPECT_EQ(1000u, FormattedSize(f("{0:>1000}") << 42));
+  EXPECT_EQ(1000u, FormattedSize(f("{0:>1000}") << 4.2));
+  EXPECT_EQ("abc", f.str());
+  EXPECT_THROW_MSG(FormattedSize(f("{0:d}") << "abc"),
+      FormatError, "unknown format code 'd' for string");
+  EXPECT_THROW_MSG(FormattedSize(f("{0")),
+      FormatError, "unmatched '{' in format");
+  EXPECT_EQ("abc", f.str());
+  EXPECT_EQ("abc42", str(f("{0}") << 42));
+}
+
+TEST(FormatterTest, FormatTo) {
+  char buffer[8] = "xxxxxxx";
+  EXPECT_EQ(5u, FormatTo(buffer, sizeof(buffer), Format("{0}") << 12345));
+  EXPECT_STREQ("12345", buffer);
+  EXPECT_EQ(10u, FormatTo(buffer, sizeof(buffer), Format("{0:>10}") << 1));
+  EXPECT_STREQ("       ", buffer);
+  EXPECT_EQ(3u, FormatTo(buffer, 1, Format("abc")));
+  EXPECT_STREQ("", buffer);
+  buffer[0] = 'x';
+  EXPECT_EQ(3u, FormatTo(buffer, 0, Format("abc")));
+  EXPECT_EQ('x', buffer[0]);
+  wchar_t wbuffer[4] = {};
+  EXPECT_EQ(5u, FormatTo(wbuffer, 4, Format(L"{0}") << 12345));
+  EXPECT_EQ(std::wstring(L"123"), wbuffer);
 }
 
 TEST(StringRefTest, Ctor) {
@@ -1059,6 +1990,12 @@ TEST(StringRefTest, Ctor) {
 
   EXPECT_STREQ("defg", StringRef(std::string("defg")).c_str());
   EXPECT_EQ(4u, StringRef(std::string("defg")).size());
+
+  const char *data = "abcde";
+  EXPECT_EQ(data, StringRef(data, 2).c_str());
+  EXPECT_EQ(2u, StringRef(data, 2).size());
+  EXPECT_EQ(0u, StringRef(data, 0).size());
+  EXPECT_EQ(0u, StringRef("").size());
 }
 
 TEST(StringRefTest, ConvertToString) {
@@ -1167,6 +2104,933 @@ TEST(TempFormatterTest, Examples) {
   ReportError("File not found: {0}") << path;
 }
 
+TEST(CompiledFormatTest, Literals) {
+  EXPECT_EQ("", str(Format(fmt::CompiledFormat(""))));
+  EXPECT_EQ("test", str(Format(fmt::CompiledFormat("test"))));
+  EXPECT_EQ("{} }{", str(Format(fmt::CompiledFormat("{{}} }}{{"))));
+  EXPECT_EQ("{42}", str(Format(fmt::CompiledFormat("{{{0}}}")) << 42));
+  EXPECT_EQ("before 42 after",
+      str(Format(fmt::CompiledFormat("before {0} after")) << 42));
+}
+
+TEST(CompiledFormatTest, NumArgs) {
+  EXPECT_EQ(0u, fmt::CompiledFormat("test").num_args());
+  EXPECT_EQ(3u, fmt::CompiledFormat("{}{}{}").num_args());
+  EXPECT_EQ(2u, fmt::CompiledFormat("{1}{0}{1}").num_args());
+  EXPECT_EQ(3u, fmt::CompiledFormat("{0:.{2}}").num_args());
+}
+
+TEST(CompiledFormatTest, Reuse) {
+  fmt::CompiledFormat format("{0:>8} {1:.3f}");
+  EXPECT_EQ("      pi 3.142", str(Format(format) << "pi" << 3.14159));
+  EXPECT_EQ("       e 2.718", str(Format(format) << 'e' << 2.71828));
+  Formatter f;
+  for (int i = 0; i < 3; ++i)
+    f(format) << i << i * 0.5;
+  EXPECT_EQ("       0 0.000       1 0.500       2 1.000", f.str());
+}
+
+TEST(CompiledFormatTest, SameOutputAsFormat) {
+  const char *formats[] = {
+    "{0}", "{0:<5}", "{0:>5}", "{0:^5}", "{0:*^7}", "{0:=+8}", "{0:+}",
+    "{0: }", "{0:-}", "{0:#}", "{0:08}"
+  };
+  for (std::size_t i = 0; i < sizeof(formats) / sizeof(*formats); ++i) {
+    fmt::CompiledFormat cf(formats[i]);
+    EXPECT_EQ(str(Format(formats[i]) << 42), str(Format(cf) << 42))
+      << formats[i];
+    EXPECT_EQ(str(Format(formats[i]) << -42l), str(Format(cf) << -42l))
+      << formats[i];
+    EXPECT_EQ(str(Format(formats[i]) << -4.2), str(Format(cf) << -4.2))
+      << formats[i];
+  }
+  const char *int_formats[] = {"{0:d}", "{0:#x}", "{0:#X}", "{0:#o}"};
+  for (std::size_t i = 0; i < sizeof(int_formats) / sizeof(*int_formats); ++i) {
+    EXPECT_EQ(str(Format(int_formats[i]) << 42u),
+        str(Format(fmt::CompiledFormat(int_formats[i])) << 42u))
+      << int_formats[i];
+  }
+  EXPECT_EQ(str(Format("{0:+010.4g}") << 392.65),
+      str(Format(fmt::CompiledFormat("{0:+010.4g}")) << 392.65));
+  EXPECT_EQ(str(Format("{:.{}}") << 1.2345 << 2),
+      str(Format(fmt::CompiledFormat("{:.{}}")) << 1.2345 << 2));
+  EXPECT_EQ("1.2340000000:0042:+3.13:str:0x3e8:X:%",
+      str(Format(fmt::CompiledFormat("{0:0.10f}:{1:04}:{2:+g}:{3}:{4}:{5}:%"))
+          << 1.234 << 42 << 3.13 << "str"
+          << reinterpret_cast<void*>(1000) << 'X'));
+  EXPECT_EQ("def  ",
+      str(Format(fmt::CompiledFormat("{0:<5}")) << TestString("def")));
+}
+
+TEST(CompiledFormatTest, SyntaxErrors) {
+  EXPECT_THROW_MSG(fmt::CompiledFormat("{"),
+      FormatError, "unmatched '{' in format");
+  EXPECT_THROW_MSG(fmt::CompiledFormat("}"),
+      FormatError, "unmatched '}' in format");
+  EXPECT_THROW_MSG(fmt::CompiledFormat("{x}"),
+      FormatError, "invalid argument index in format string");
+  EXPECT_THROW_MSG(fmt::CompiledFormat("{0}{}"), FormatError,
+      "cannot switch from manual to automatic argument indexing");
+  EXPECT_THROW_MSG(fmt::CompiledFormat("{}{0}"), FormatError,
+      "cannot switch from automatic to manual argument indexing");
+  EXPECT_THROW_MSG(fmt::CompiledFormat("{0:{<5}}"),
+      FormatError, "invalid fill character '{'");
+  EXPECT_THROW_MSG(fmt::CompiledFormat("{0:.}"),
+      FormatError, "missing precision in format");
+  EXPECT_THROW_MSG(fmt::CompiledFormat("{0:.2"),
+      FormatError, "unmatched '{' in format");
+  char format[256];
+  std::sprintf(format, "{%u}", UINT_MAX);
+  EXPECT_THROW_MSG(fmt::CompiledFormat cf(format),
+      FormatError, "argument index is out of range in format");
+  std::sprintf(format, "{0:.{%u}}", UINT_MAX);
+  EXPECT_THROW_MSG(fmt::CompiledFormat cf(format),
+      FormatError, "argument index is out of range in format");
+  std::sprintf(format, "{0:%u}", INT_MAX + 1u);
+  EXPECT_THROW_MSG(fmt::CompiledFormat cf(format),
+      FormatError, "number is too big in format");
+}
+
+TEST(CompiledFormatTest, ArgErrors) {
+  EXPECT_THROW_MSG(Format(fmt::CompiledFormat("{0}")),
+      FormatError, "argument index is out of range in format");
+  EXPECT_THROW_MSG(Format(fmt::CompiledFormat("{0:.{1}}")) << 1.2,
+      FormatError, "argument index is out of range in format");
+  EXPECT_THROW_MSG(Format(fmt::CompiledFormat("{0:=5}")) << "abc",
+      FormatError, "format specifier '=' requires numeric argument");
+  EXPECT_THROW_MSG(Format(fmt::CompiledFormat("{0:+#}")) << "abc",
+      FormatError, "format specifier '+' requires numeric argument");
+  EXPECT_THROW_MSG(Format(fmt::CompiledFormat("{0:#}")) << 'c',
+      FormatError, "format specifier '#' requires numeric argument");
+  EXPECT_THROW_MSG(Format(fmt::CompiledFormat("{0:05}")) << "abc",
+      FormatError, "format specifier '0' requires numeric argument");
+  EXPECT_THROW_MSG(Format(fmt::CompiledFormat("{0: }")) << 42u,
+      FormatError, "format specifier ' ' requires signed argument");
+  EXPECT_THROW_MSG(Format(fmt::CompiledFormat("{0:.2}")) << 42,
+      FormatError, "precision specifier requires floating-point argument");
+  // Arguments are checked in the order of fields as by the interpreter.
+  EXPECT_THROW_MSG(Format(fmt::CompiledFormat("{0:.2}{1}")) << 42,
+      FormatError, "precision specifier requires floating-point argument");
+  EXPECT_THROW_MSG(Format(fmt::CompiledFormat("{0:.{1}}")) << 1.2 << -1,
+      FormatError, "negative precision in format");
+  EXPECT_THROW_MSG(Format(fmt::CompiledFormat("{0:.{1}}")) << 1.2 << 'x',
+      FormatError, "precision is not integer");
+  EXPECT_THROW_MSG(Format(fmt::CompiledFormat("{0:.{1}}")) << 42 << 'x',
+      FormatError, "precision is not integer");
+  EXPECT_THROW_MSG(Format(fmt::CompiledFormat("{0:v}")) << 42,
+      FormatError, "unknown format code 'v' for integer");
+}
+
+TEST(CompiledFormatTest, TempFormatter) {
+  int num_calls = 0;
+  fmt::CompiledFormat format("{0}");
+  {
+    fmt::TempFormatter<CountCalls> af(format, CountCalls(num_calls));
+    af << 42;
+    EXPECT_EQ(0, num_calls);
+  }
+  EXPECT_EQ(1, num_calls);
+}
+
+struct WideAnswer {};
+
+void Format(fmt::WArgFormatter &af, const fmt::FormatSpec &spec, WideAnswer) {
+  af.Write(L"42", spec);
+}
+
+TEST(WFormatterTest, Format) {
+  EXPECT_EQ(L"abc", str(Format(L"{0}") << L"abc"));
+  EXPECT_EQ(L"def", str(Format(L"{0}") << std::wstring(L"def")));
+  EXPECT_EQ(L"42 -1 ff 0x2a", str(Format(L"{} {} {:x} {:#x}")
+      << 42 << -1 << 255u << 42L));
+  EXPECT_EQ(L"0.1 1.50 1e+100", str(Format(L"{} {:.2f} {}")
+      << 0.1 << 1.5 << 1e100));
+  EXPECT_EQ(L"ab", str(Format(L"{}{}") << 'a' << L'b'));
+  EXPECT_EQ(L"42", str(Format(L"{0}") << WideAnswer()));
+  EXPECT_EQ(std::wstring(L"  \x2605  "),
+      str(Format(L"{0:^5}") << L'\x2605'));
+  EXPECT_EQ(std::wstring(L"ab\x2605\x2605\x2605"),
+      str(Format(L"{0:\x2605<5}") << L"ab"));
+  EXPECT_EQ(std::wstring(L"\x2605\x2605-42"),
+      str(Format(L"{0:\x2605>5}") << -42));
+  EXPECT_EQ(L"**+1.50***", str(Format(L"{0:*^+10.2f}") << 1.5L));
+  EXPECT_EQ(L"+000001.50", str(Format(L"{0:=+010.2f}") << 1.5L));
+  EXPECT_EQ(L"nan -inf", str(Format(L"{} {}")
+      << std::numeric_limits<double>::quiet_NaN()
+      << -std::numeric_limits<double>::infinity()));
+}
+
+TEST(WFormatterTest, Errors) {
+  EXPECT_THROW_MSG(Format(L"{0"), FormatError, "unmatched '{' in format");
+  EXPECT_THROW_MSG(Format(L"{0}") << (const wchar_t*)0,
+      FormatError, "string pointer is null");
+  EXPECT_THROW_MSG(Format(L"{0:+}") << L"abc",
+      FormatError, "format specifier '+' requires numeric argument");
+  EXPECT_THROW_MSG(Format(L"{0:\x100}") << 42,
+      FormatError, "unknown format code '\\x7f' for integer");
+}
+
+TEST(WFormatterTest, CompiledFormat) {
+  const fmt::WCompiledFormat format(L"{0:>4}|{1:*<3}}}");
+  EXPECT_EQ(2u, format.num_args());
+  EXPECT_EQ(L"  ab|42*}", str(Format(format) << L"ab" << 42));
+}
+
+TEST(WFormatterTest, Formatter) {
+  fmt::WFormatter f;
+  f(L"{0} {1}") << L"part" << 1;
+  f << L'|';
+  f(L"{0:04}") << 7;
+  EXPECT_EQ(L"part 1|0007", f.str());
+  EXPECT_EQ(std::wstring(L"part 1|0007"), f.c_str());
+}
+
+#if FMT_USE_CHAR16
+TEST(WFormatterTest, UTF16) {
+  fmt::U16Formatter f;
+  f(u"{0} {1:>3} {2:x}") << u"été" << u'x' << 255;
+  EXPECT_TRUE(f.str() == u"été   x ff");
+}
+#endif
+
+TEST(BufferedSinkTest, IteratorOutput) {
+  typedef fmt::IteratorOutput<char*> Output;
+  char buffer[256] = "";
+  {
+    fmt::BufferedSink<Output> sink((Output(buffer)), 8);
+    sink("{0}") << "abc";
+    sink("{0:>4}") << 42;
+    EXPECT_EQ(7u, sink.size());
+    EXPECT_STREQ("", buffer);
+    sink("{0}") << 'x';
+    EXPECT_STREQ("", buffer);
+    sink("{0}") << 'y';
+    EXPECT_EQ(1u, sink.size());
+    EXPECT_EQ(buffer + 8, sink.output().iterator());
+    EXPECT_EQ("abc  42x", std::string(buffer, 8));
+    sink(fmt::CompiledFormat("{0}")) << 'z';
+    sink.Flush();
+    EXPECT_EQ(0u, sink.size());
+    EXPECT_EQ("abc  42xyz", std::string(buffer, 10));
+    sink("{0}") << "!";
+  }
+  EXPECT_EQ("abc  42xyz!", std::string(buffer, 11));
+}
+
+TEST(BufferedSinkTest, BackInserter) {
+  typedef std::back_insert_iterator<std::string> Iterator;
+  std::string s;
+  {
+    fmt::BufferedSink< fmt::IteratorOutput<Iterator> > sink(
+        (fmt::IteratorOutput<Iterator>(Iterator(s))));
+    for (int i = 0; i < 1000; ++i)
+      sink("{0} ") << i;
+  }
+  EXPECT_EQ(3890u, s.size());
+  EXPECT_EQ("0 1 2 ", s.substr(0, 6));
+  EXPECT_EQ("998 999 ", s.substr(s.size() - 8));
+}
+
+TEST(BufferedSinkTest, FileOutput) {
+  std::FILE *f = std::tmpfile();
+  ASSERT_TRUE(f != 0);
+  {
+    fmt::BufferedSink<fmt::FileOutput> sink((fmt::FileOutput(f)));
+    sink("{0}, {1}!") << "Hello" << "world";
+    EXPECT_EQ(0, std::ftell(f));
+  }
+  char buffer[256] = "";
+  std::rewind(f);
+  std::fgets(buffer, sizeof(buffer), f);
+  EXPECT_STREQ("Hello, world!", buffer);
+  std::fclose(f);
+}
+
+#ifndef _WIN32
+TEST(BufferedSinkTest, FdOutput) {
+  int fds[2] = {};
+  ASSERT_EQ(0, pipe(fds));
+  {
+    fmt::BufferedSink<fmt::FdOutput> sink((fmt::FdOutput(fds[1])));
+    sink("{0:04}") << 42;
+  }
+  close(fds[1]);
+  char buffer[256] = "";
+  EXPECT_EQ(4, read(fds[0], buffer, sizeof(buffer)));
+  EXPECT_STREQ("0042", buffer);
+  close(fds[0]);
+}
+
+TEST(BufferedSinkTest, WriteError) {
+  fmt::BufferedSink<fmt::FdOutput> sink((fmt::FdOutput(-1)));
+  sink("{0}") << 42;
+  std::string message = str(
+      Format("cannot write to file: {0}") << std::strerror(EBADF));
+  EXPECT_THROW_MSG(sink.Flush(), fmt::SystemError, message.c_str());
+  try {
+    sink.Flush();
+  } catch (const fmt::SystemError &e) {
+    EXPECT_EQ(EBADF, e.error_code());
+  }
+  EXPECT_EQ(2u, sink.size());
+}
+
+// Reads from fd until the end of file.
+static std::string ReadAll(int fd) {
+  std::string result;
+  char buffer[4096];
+  for (;;) {
+    ssize_t count = read(fd, buffer, sizeof(buffer));
+    if (count <= 0) break;
+    result.append(buffer, count);
+  }
+  return result;
+}
+
+TEST(GatherSinkTest, ReferenceLongStrings) {
+  int fds[2] = {};
+  ASSERT_EQ(0, pipe(fds));
+  std::string body(1000, 'x');
+  {
+    fmt::GatherSink sink(fds[1]);
+    sink("Content-Length: {0}\r\n\r\n{1}") << body.size() << body;
+    EXPECT_EQ(1u, sink.num_refs());
+    EXPECT_EQ(24u + body.size(), sink.size());
+    // Padded strings are copied.
+    sink("[{0:>1001}]") << body;
+    EXPECT_EQ(1u, sink.num_refs());
+    sink.Flush();
+    EXPECT_EQ(0u, sink.num_refs());
+    EXPECT_EQ(0u, sink.size());
+    sink("{0}") << 42;
+  }
+  close(fds[1]);
+  EXPECT_EQ("Content-Length: 1000\r\n\r\n" + body + "[ " + body + "]42",
+            ReadAll(fds[0]));
+  close(fds[0]);
+}
+
+TEST(GatherSinkTest, CopyLiterals) {
+  int fds[2] = {};
+  ASSERT_EQ(0, pipe(fds));
+  {
+    fmt::GatherSink sink(fds[1], 2);
+    for (int i = 0; i < 100; ++i)
+      sink("x{0}{{}}") << "ab";
+    // Only the arguments are referenced.
+    EXPECT_EQ(100u, sink.num_refs());
+    {
+      fmt::CompiledFormat format("<{0}>{1} compiled literal");
+      sink(format) << 1 << "cd";
+    }
+    EXPECT_EQ(101u, sink.num_refs());
+    std::string format("string literal {0}\n");
+    sink(format) << 2;
+    format.replace(0, 6, "STRING");
+#if FMT_USE_THREAD_LOCAL
+    // Formatting with another format evicts the cached literal text.
+    fmt::FormatCache &cache = fmt::GetThreadFormatCache();
+    cache.set_max_size(1);
+    sink("cached literal {0}\n") << 3;
+    EXPECT_EQ("evicts 4", str(Format("evicts {0}") << 4));
+    cache.set_max_size(0);
+#else
+    sink("cached literal {0}\n") << 3;
+#endif
+    EXPECT_EQ(101u, sink.num_refs());
+  }
+  close(fds[1]);
+  std::string expected;
+  for (int i = 0; i < 100; ++i)
+    expected += "xab{}";
+  EXPECT_EQ(expected + "<1>cd compiled literalstring literal 2\n"
+            "cached literal 3\n", ReadAll(fds[0]));
+  close(fds[0]);
+}
+
+TEST(GatherSinkTest, WriteError) {
+  fmt::GatherSink sink(-1, 1);
+  sink("{0}") << "abc";
+  std::string message = str(
+      Format("cannot write to file: {0}") << std::strerror(EBADF));
+  EXPECT_THROW_MSG(sink.Flush(), fmt::SystemError, message.c_str());
+  EXPECT_EQ(3u, sink.size());
+}
+
+// Creates a temporary file and returns its name in path.
+static void MakeTempFile(char (&path)[32]) {
+  std::strcpy(path, "/tmp/format-test-XXXXXX");
+  int fd = mkstemp(path);
+  ASSERT_NE(-1, fd);
+  close(fd);
+}
+
+// Returns the content of a file.
+static std::string ReadFile(const char *path) {
+  int fd = open(path, O_RDONLY);
+  std::string content = ReadAll(fd);
+  close(fd);
+  return content;
+}
+
+TEST(MappedFileSinkTest, Write) {
+  char path[32];
+  MakeTempFile(path);
+  std::string expected;
+  {
+    fmt::MappedFileSink sink(path, 1);
+    for (int i = 0; i < 10000; ++i) {
+      sink("{0},{1}\n") << i << i * 0.5;
+      expected += str(Format("{0},{1}\n") << i << i * 0.5);
+    }
+    EXPECT_EQ(expected.size(), sink.size());
+    sink.Close();
+    EXPECT_EQ(expected.size(), sink.size());
+    sink.Close();
+  }
+  EXPECT_EQ(expected, ReadFile(path));
+  unlink(path);
+}
+
+TEST(MappedFileSinkTest, OutputLargerThanWindow) {
+  char path[32];
+  MakeTempFile(path);
+  std::string s(100000, 'x');
+  {
+    fmt::MappedFileSink sink(path, 1);
+    sink("{0}") << 42;
+    sink("[{0}]") << s;
+    sink("{0}") << 42;
+    sink("[{0}]") << s;
+  }
+  EXPECT_EQ("42[" + s + "]42[" + s + "]", ReadFile(path));
+  unlink(path);
+}
+
+TEST(MappedFileSinkTest, Errors) {
+  std::string message = str(Format("cannot open file: {0}")
+      << std::strerror(ENOENT));
+  EXPECT_THROW_MSG(fmt::MappedFileSink("/nonexistent/file"),
+      fmt::SystemError, message.c_str());
+}
+
+// An error reported to RecordError.
+struct RecordedError {
+  char message[256];
+  int error_code;
+};
+
+void RecordError(const char *message, int error_code) {
+  RecordedError error;
+  std::strncpy(error.message, message, sizeof(error.message) - 1);
+  error.message[sizeof(error.message) - 1] = '\0';
+  error.error_code = error_code;
+  throw error;
+}
+
+// Returns the error reported by formatting with the given format string
+// and a single argument.
+template <typename T>
+RecordedError GetError(const char *format, const T &arg) {
+  fmt::ErrorHandler previous = fmt::SetErrorHandler(RecordError);
+  RecordedError error = RecordedError();
+  try {
+    Format(format) << arg;
+  } catch (const RecordedError &e) {
+    error = e;
+  }
+  fmt::SetErrorHandler(previous);
+  return error;
+}
+
+TEST(ErrorHandlerTest, FormatErrors) {
+  RecordedError error = GetError("{0", 42);
+  EXPECT_STREQ("unmatched '{' in format", error.message);
+  EXPECT_EQ(0, error.error_code);
+  EXPECT_STREQ("unknown format code 'v' for integer",
+      GetError("{0:v}", 42).message);
+  EXPECT_STREQ("unknown format code '\\x7f' for double",
+      GetError("{0:\x7f}", 1.0).message);
+  EXPECT_STREQ("format specifier '+' requires numeric argument",
+      GetError("{0:+}", "abc").message);
+  EXPECT_STREQ("format specifier '-' requires signed argument",
+      GetError("{0:-}", 42u).message);
+  EXPECT_STREQ("argument index is out of range in format",
+      GetError("{1}", 42).message);
+  EXPECT_THROW_MSG(Format("{0"), FormatError, "unmatched '{' in format");
+}
+
+TEST(ErrorHandlerTest, SystemError) {
+  fmt::ErrorHandler previous = fmt::SetErrorHandler(RecordError);
+  fmt::BufferedSink<fmt::FdOutput> sink((fmt::FdOutput(-1)));
+  sink("{0}") << 42;
+  RecordedError error = RecordedError();
+  try {
+    sink.Flush();
+  } catch (const RecordedError &e) {
+    error = e;
+  }
+  EXPECT_EQ(str(Format("cannot write to file: {0}") << std::strerror(EBADF)),
+      error.message);
+  EXPECT_EQ(EBADF, error.error_code);
+  EXPECT_EQ(RecordError, fmt::SetErrorHandler(0));
+  EXPECT_THROW(sink.Flush(), fmt::SystemError);
+  fmt::SetErrorHandler(previous);
+}
+#endif
+
+#if FMT_USE_VARIADIC_TEMPLATES
+TEST(CompiledFormatTest, FormatArgs) {
+  fmt::CompiledFormat format("{0} {1:>5} {2:.{3}f} {4}");
+  Formatter f;
+  f.FormatArgs(format, 42, "abc", 3.14159, 2, std::string("def"));
+  EXPECT_EQ("42   abc 3.14 def", f.str());
+  f.FormatArgs(fmt::CompiledFormat(" {}"), 'x');
+  EXPECT_EQ("42   abc 3.14 def x", f.str());
+  EXPECT_THROW_MSG(f.FormatArgs(format, 1, 2),
+      FormatError, "argument index is out of range in format");
+  EXPECT_THROW_MSG(f.FormatArgs(fmt::CompiledFormat("{0:+}"), "abc"),
+      FormatError, "format specifier '+' requires numeric argument");
+}
+#endif
+
+#if FMT_USE_ASYNC
+
+typedef fmt::IteratorOutput< std::back_insert_iterator<std::string> >
+    StringOutput;
+
+TEST(AsyncSinkTest, Format) {
+  std::string s;
+  fmt::CompiledFormat format("[{0:>4}]");
+  {
+    fmt::AsyncSink<StringOutput> sink((StringOutput(std::back_inserter(s))));
+    sink.Format("{0} {1} {2:.2f} {3}\n", "abc", 42, 1.5, 'x');
+    sink.Format("{0}, {1}!\n", std::string("Hello"), Date(2012, 12, 9));
+    sink.Format(format, 42);
+    sink.Format("{}", static_cast<const void*>(0));
+    sink.Flush();
+    EXPECT_EQ("abc 42 1.50 x\nHello, 2012-12-9!\n[  42]0x0", s);
+    sink.Format("!");
+  }
+  EXPECT_EQ("abc 42 1.50 x\nHello, 2012-12-9!\n[  42]0x0!", s);
+}
+
+TEST(AsyncSinkTest, CopiesArgs) {
+  std::string s;
+  fmt::AsyncSink<StringOutput> sink((StringOutput(std::back_inserter(s))));
+  char text[] = "abc";
+  std::string str = "def";
+  sink.Format("{0}{1}{2}", text, str, "");
+  text[0] = 'x';
+  str[0] = 'y';
+  sink.Flush();
+  EXPECT_EQ("abcdef", s);
+}
+
+TEST(AsyncSinkTest, Errors) {
+  std::string s;
+  fmt::AsyncSink<StringOutput> sink(
+      (StringOutput(std::back_inserter(s))), 256);
+  sink.Format("{0:d}", "abc");
+  sink.Format("{0}", 42);
+  sink.Format("{0:+}", 42u);
+  // Only the first error is reported.
+  EXPECT_THROW_MSG(sink.Flush(), FormatError,
+      "unknown format code 'd' for string");
+  sink.Flush();
+  EXPECT_EQ("42", s);
+  EXPECT_THROW_MSG(sink.Format("{0}", std::string(1000, 'x')),
+      FormatError, "format arguments don't fit into the queue");
+}
+
+#ifndef _WIN32
+TEST(AsyncSinkTest, WriteError) {
+  fmt::AsyncSink<fmt::FdOutput> sink((fmt::FdOutput(-1)));
+  sink.Format("{0}", 42);
+  std::string message = str(
+      Format("cannot write to file: {0}") << std::strerror(EBADF));
+  EXPECT_THROW_MSG(sink.Flush(), fmt::SystemError, message.c_str());
+  sink.Flush();
+}
+#endif
+
+TEST(AsyncSinkTest, MultipleProducers) {
+  enum { NUM_THREADS = 4, NUM_RECORDS = 1000 };
+  std::string s;
+  {
+    // A small queue makes producers wait and records wrap around.
+    fmt::AsyncSink<StringOutput> sink(
+        (StringOutput(std::back_inserter(s))), 1024);
+    std::thread threads[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; ++i) {
+      threads[i] = std::thread([&sink, i] {
+        for (int j = 0; j < NUM_RECORDS; ++j)
+          sink.Format("{0} {1} {2}\n", i, j, std::string(j % 100, 'x'));
+      });
+    }
+    for (int i = 0; i < NUM_THREADS; ++i)
+      threads[i].join();
+  }
+  // Records of each thread are formatted in the order of submission.
+  int next[NUM_THREADS] = {};
+  std::istringstream is(s);
+  int thread = 0, record = 0;
+  std::string padding;
+  while (is >> thread >> record) {
+    ASSERT_TRUE(thread >= 0 && thread < NUM_THREADS);
+    EXPECT_EQ(next[thread]++, record);
+    if (record % 100 != 0) {
+      is >> padding;
+      EXPECT_EQ(std::string(record % 100, 'x'), padding);
+    }
+  }
+  for (int i = 0; i < NUM_THREADS; ++i)
+    EXPECT_EQ(NUM_RECORDS, next[i]);
+}
+
+TEST(ConcurrentSinkTest, Print) {
+  std::string s;
+  fmt::CompiledFormat format("[{0:>4}]");
+  {
+    fmt::ConcurrentSink<StringOutput> sink(
+        (StringOutput(std::back_inserter(s))), 256);
+    sink.Print("{0} {1} {2:.2f} {3}\n") << "abc" << 42 << 1.5 << 'x';
+    sink.Print(format) << 42;
+    EXPECT_THROW_MSG(sink.Print("{0:d}") << "abc",
+        FormatError, "unknown format code 'd' for string");
+    // A message that doesn't fit into the queue.
+    sink.Print("<{0}>") << std::string(1000, 'x');
+    sink.Flush();
+    EXPECT_EQ("abc 42 1.50 x\n[  42]<" + std::string(1000, 'x') + ">", s);
+    sink.Print("!");
+  }
+  EXPECT_EQ("abc 42 1.50 x\n[  42]<" + std::string(1000, 'x') + ">!", s);
+}
+
+#ifndef _WIN32
+TEST(ConcurrentSinkTest, WriteError) {
+  fmt::ConcurrentSink<fmt::FdOutput> sink((fmt::FdOutput(-1)));
+  sink.Print("{0}") << 42;
+  std::string message = str(
+      Format("cannot write to file: {0}") << std::strerror(EBADF));
+  EXPECT_THROW_MSG(sink.Flush(), fmt::SystemError, message.c_str());
+  sink.Flush();
+}
+#endif
+
+TEST(ConcurrentSinkTest, MultipleProducers) {
+  enum { NUM_THREADS = 4, NUM_MESSAGES = 1000 };
+  std::string s;
+  {
+    // A small queue makes producers wait and records wrap around.
+    fmt::ConcurrentSink<StringOutput> sink(
+        (StringOutput(std::back_inserter(s))), 1024);
+    std::thread threads[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; ++i) {
+      threads[i] = std::thread([&sink, i] {
+        for (int j = 0; j < NUM_MESSAGES; ++j)
+          sink.Print("{0} {1} {2}\n") << i << j << std::string(j % 300, 'x');
+      });
+    }
+    for (int i = 0; i < NUM_THREADS; ++i)
+      threads[i].join();
+  }
+  // Messages of each thread are written whole in the order of printing.
+  int next[NUM_THREADS] = {};
+  std::istringstream is(s);
+  std::string line;
+  while (std::getline(is, line)) {
+    std::istringstream line_stream(line);
+    int thread = 0, message = 0;
+    std::string padding;
+    line_stream >> thread >> message >> padding;
+    ASSERT_TRUE(thread >= 0 && thread < NUM_THREADS);
+    EXPECT_EQ(next[thread]++, message);
+    EXPECT_EQ(std::string(message % 300, 'x'), padding);
+  }
+  for (int i = 0; i < NUM_THREADS; ++i)
+    EXPECT_EQ(NUM_MESSAGES, next[i]);
+}
+
+TEST(ParallelFormatterTest, FormatRows) {
+  enum { NUM_ROWS = 10000 };
+  std::vector<int> ids(NUM_ROWS);
+  std::vector<double> values(NUM_ROWS);
+  std::vector<std::string> names(NUM_ROWS);
+  Formatter expected;
+  fmt::CompiledFormat format("{0:>5},{1:.2f},{2}\n");
+  for (int i = 0; i < NUM_ROWS; ++i) {
+    ids[i] = i;
+    values[i] = i * 0.25;
+    names[i] = std::string(i % 10, 'x');
+    expected(format) << ids[i] << values[i] << names[i];
+  }
+  fmt::ParallelFormatter pf(3);
+  EXPECT_EQ(3u, pf.num_threads());
+  std::string s;
+  StringOutput out((std::back_inserter(s)));
+  pf.FormatRows(out, format, NUM_ROWS, &ids[0], &values[0], &names[0]);
+  EXPECT_EQ(expected.str(), s);
+  s.clear();
+  pf.FormatRows(out, format, 2, &ids[0], &values[0], &names[0]);
+  EXPECT_EQ("    0,0.00,\n    1,0.25,x\n", s);
+  s.clear();
+  pf.FormatRows(out, format, 0, &ids[0], &values[0], &names[0]);
+  EXPECT_EQ("", s);
+  EXPECT_LE(1u, fmt::ParallelFormatter().num_threads());
+}
+
+TEST(ParallelFormatterTest, Errors) {
+  enum { NUM_ROWS = 5000 };
+  std::vector<int> ints(NUM_ROWS, 42);
+  std::vector<const char*> strings(NUM_ROWS, "abc");
+  strings[4000] = 0;
+  fmt::ParallelFormatter pf(2);
+  std::string s;
+  StringOutput out((std::back_inserter(s)));
+  EXPECT_THROW_MSG(pf.FormatRows(out, fmt::CompiledFormat("{0}{1}\n"),
+      NUM_ROWS, &ints[0], &strings[0]), FormatError,
+      "string pointer is null");
+  // The output of the chunks preceding the failed ones is written.
+  std::size_t num_rows = std::count(s.begin(), s.end(), '\n');
+  EXPECT_EQ(2u * fmt::ParallelFormatter::ROWS_PER_CHUNK, num_rows);
+  EXPECT_THROW_MSG(pf.FormatRows(out, fmt::CompiledFormat("{0:s}"),
+      NUM_ROWS, &ints[0]), FormatError, "unknown format code 's' for integer");
+}
+#endif
+
+#if FMT_USE_VARIADIC_TEMPLATES
+
+typedef fmt::IteratorOutput< std::back_insert_iterator<std::string> >
+    BinaryOutput;
+
+// Decodes a binary log checking that all data is consumed.
+std::string DecodeBinaryLog(const std::string &log) {
+  fmt::BinaryLogDecoder decoder;
+  Formatter f;
+  EXPECT_EQ(log.size(), decoder.Decode(log.data(), log.size(), f));
+  return f.str();
+}
+
+TEST(BinaryLogTest, RoundTrip) {
+  std::string data;
+  {
+    fmt::BinaryLog<BinaryOutput> log((BinaryOutput(std::back_inserter(data))));
+    log.Log("{0} {1} {2} {3} {4} {5}\n",
+        42, 42u, -42l, ULONG_MAX, LLONG_MIN, ULLONG_MAX);
+    log.Log("{0:.2f} {1} {2}{3}\n", 1.5, 2.5l, 'x', "abc");
+    log.Log("{0}|{1}|{2:>5}|{3}\n",
+        std::string("def"), std::string(), StringRef("ghij", 2),
+        static_cast<const void*>(0));
+    log.Log("{0:*^14}\n", Date(2012, 12, 9));
+    log.Log("no args\n");
+    EXPECT_EQ(0u, data.size());
+  }
+  std::string expected = str(Format("42 42 -42 {0} {1} {2}\n")
+      << ULONG_MAX << LLONG_MIN << ULLONG_MAX) +
+      "1.50 2.5 xabc\ndef||   gh|0x0\n**2012-12-9***\nno args\n";
+  EXPECT_EQ(expected, DecodeBinaryLog(data));
+}
+
+TEST(BinaryLogTest, FormatIsWrittenOnce) {
+  std::string data;
+  const char *format = "{0}";
+  {
+    fmt::BinaryLog<BinaryOutput> log((BinaryOutput(std::back_inserter(data))));
+    log.Log(format, 1);
+  }
+  std::size_t size = data.size();
+  data.clear();
+  {
+    fmt::BinaryLog<BinaryOutput> log((BinaryOutput(std::back_inserter(data))));
+    for (int i = 0; i < 100; ++i)
+      log.Log(format, i);
+  }
+  // An argument record of an int takes 11 bytes.
+  EXPECT_EQ(size + 99 * 11, data.size());
+  fmt::BinaryLogDecoder decoder;
+  Formatter f;
+  decoder.Decode(data.data(), data.size(), f);
+  EXPECT_EQ(1u, decoder.num_formats());
+  EXPECT_EQ(190u, f.size());
+}
+
+TEST(BinaryLogTest, Flush) {
+  std::string data;
+  fmt::BinaryLog<BinaryOutput> log(
+      (BinaryOutput(std::back_inserter(data))), 100);
+  log.Log("{0}", std::string(50, 'x'));
+  EXPECT_EQ(0u, data.size());
+  EXPECT_NE(0u, log.size());
+  log.Log("{0}", std::string(50, 'y'));
+  EXPECT_EQ(0u, log.size());
+  EXPECT_EQ(std::string(50, 'x') + std::string(50, 'y'),
+            DecodeBinaryLog(data));
+}
+
+TEST(BinaryLogTest, PartialData) {
+  std::string data;
+  {
+    fmt::BinaryLog<BinaryOutput> log((BinaryOutput(std::back_inserter(data))));
+    log.Log("{0}:{1}\n", "abc", 1.25);
+    log.Log("{0}\n", 'x');
+  }
+  // Decode the data fed one byte at a time.
+  fmt::BinaryLogDecoder decoder;
+  Formatter f;
+  std::string pending;
+  for (std::size_t i = 0; i < data.size(); ++i) {
+    pending += data[i];
+    pending.erase(0, decoder.Decode(pending.data(), pending.size(), f));
+  }
+  EXPECT_EQ("", pending);
+  EXPECT_EQ("abc:1.25\nx\n", f.str());
+}
+
+#if FMT_USE_THREAD_LOCAL
+TEST(BinaryLogTest, FormatCache) {
+  fmt::FormatCache &cache = fmt::GetThreadFormatCache();
+  cache.set_max_size(16);
+  const char *formats[] = {"first {0} format\n", "SECOND {0} format\n"};
+  for (int i = 0; i < 2; ++i) {
+    std::string data;
+    {
+      fmt::BinaryLog<BinaryOutput> log(
+          (BinaryOutput(std::back_inserter(data))));
+      log.Log(formats[i], i);
+    }
+    // The formats of consecutive decoders may be allocated at the same
+    // address so they must not be looked up in the cache.
+    EXPECT_EQ(str(Format(formats[i]) << i), DecodeBinaryLog(data));
+  }
+  EXPECT_EQ(2u, cache.size());
+  EXPECT_EQ(0u, cache.hits());
+  cache.set_max_size(0);
+}
+#endif
+
+TEST(BinaryLogTest, Errors) {
+  std::string data;
+  {
+    fmt::BinaryLog<BinaryOutput> log((BinaryOutput(std::back_inserter(data))));
+    log.Log("{0}", 1);
+    std::size_t size = log.size();
+    EXPECT_THROW_MSG(log.Log("{0}", static_cast<const char*>(0)),
+        FormatError, "string pointer is null");
+    EXPECT_EQ(size, log.size());
+    log.Log("{0:d}", "abc");
+  }
+  fmt::BinaryLogDecoder decoder;
+  Formatter f;
+  EXPECT_THROW_MSG(decoder.Decode(data.data(), data.size(), f),
+      FormatError, "unknown format code 'd' for string");
+  EXPECT_EQ("1", f.str());
+  EXPECT_THROW_MSG(DecodeBinaryLog("x"),
+      FormatError, "invalid binary log record");
+  EXPECT_THROW_MSG(DecodeBinaryLog(data.substr(12)),
+      FormatError, "unknown format ID in binary log");
+}
+#endif
+
+#if FMT_USE_FORMAT_CHECK
+
+template <typename... Args>
+bool CheckFormat(const char *format) {
+  return fmt::internal::CheckFormat(fmt::internal::ArgList<Args...>(), format);
+}
+
+TEST(FormatCheckTest, CompileTime) {
+  static_assert(fmt::internal::CheckFormat(
+      fmt::internal::ArgList<int, double, const char*>(),
+      "{{{0:x}}} {1:+010.{0}e} {2:*^8s}"), "");
+  static_assert(fmt::internal::CheckFormat(
+      fmt::internal::ArgList<>(), "no {{fields}}"), "");
+  EXPECT_EQ("ff 3.14", FMT_FORMAT("{:x} {:.2f}", 255, 3.14159));
+  EXPECT_EQ("  abc|-42  ", FMT_FORMAT("{1:>5}|{0:<5}", -42, "abc"));
+  std::string s("def");
+  EXPECT_EQ("def 0x0", FMT_FORMAT("{} {}", s, static_cast<void*>(0)));
+  EXPECT_EQ("x", FMT_FORMAT("{0:c}", 'x'));
+  EXPECT_EQ("42 2012-12-9", FMT_FORMAT("{} {}", Answer(), Date(2012, 12, 9)));
+  EXPECT_EQ("1.2e+03", FMT_FORMAT("{:.{}}", 1234.5, 2u));
+  EXPECT_EQ("-1 ff", FMT_FORMAT("{} {:x}", -1ll, 255ull));
+  EXPECT_EQ("1,234 5_678.0", FMT_FORMAT("{:,} {:_.1f}", 1234, 5678.0));
+}
+
+TEST(FormatCheckTest, Valid) {
+  EXPECT_TRUE(CheckFormat<>(""));
+  EXPECT_TRUE(CheckFormat<int>("{0:}"));
+  EXPECT_TRUE(CheckFormat<long>("{0:-} {0: } {0:=+10d}"));
+  EXPECT_TRUE(CheckFormat<unsigned long>("{:#X}"));
+  EXPECT_TRUE(CheckFormat<long double>("{:.3G}"));
+  EXPECT_TRUE(CheckFormat<char[4]>("{:s}"));
+  EXPECT_TRUE(CheckFormat<std::string>("{:*<5}"));
+  EXPECT_TRUE(CheckFormat<const void*>("{:p}"));
+  EXPECT_TRUE(CheckFormat<unsigned>("{:>10,d}"));
+}
+
+TEST(FormatCheckTest, SyntaxErrors) {
+  EXPECT_THROW_MSG(CheckFormat<>("}"),
+      FormatError, "unmatched '}' in format");
+  EXPECT_THROW_MSG(CheckFormat<int>("{0"),
+      FormatError, "unmatched '{' in format");
+  EXPECT_THROW_MSG(CheckFormat<int>("{0x}"),
+      FormatError, "unmatched '{' in format");
+  EXPECT_THROW_MSG(CheckFormat<int>("{x}"),
+      FormatError, "invalid argument index in format string");
+  EXPECT_THROW_MSG(CheckFormat<>("{}"), FormatError,
+      "argument index is out of range in format");
+  EXPECT_THROW_MSG((CheckFormat<int, int>("{0} {}")), FormatError,
+      "cannot switch from manual to automatic argument indexing");
+  EXPECT_THROW_MSG((CheckFormat<int, int>("{} {0}")), FormatError,
+      "cannot switch from automatic to manual argument indexing");
+  EXPECT_THROW_MSG(CheckFormat<int>("{1}"),
+      FormatError, "argument index is out of range in format");
+  EXPECT_THROW_MSG(CheckFormat<int>("{0:{<5}}"),
+      FormatError, "invalid fill character '{'");
+  EXPECT_THROW_MSG(CheckFormat<int>("{0:99999999999}"),
+      FormatError, "number is too big in format");
+  EXPECT_THROW_MSG(CheckFormat<double>("{0:.}"),
+      FormatError, "missing precision in format");
+  EXPECT_THROW_MSG((CheckFormat<double, int>("{0:.{1}")),
+      FormatError, "unmatched '{' in format");
+}
+
+TEST(FormatCheckTest, ArgErrors) {
+  EXPECT_THROW_MSG(CheckFormat<const char*>("{0:=5}"),
+      FormatError, "format specifier requires numeric argument");
+  EXPECT_THROW_MSG(CheckFormat<std::string>("{0:+}"),
+      FormatError, "format specifier requires numeric argument");
+  EXPECT_THROW_MSG(CheckFormat<char>("{0:#}"),
+      FormatError, "format specifier requires numeric argument");
+  EXPECT_THROW_MSG(CheckFormat<void*>("{0:05}"),
+      FormatError, "format specifier requires numeric argument");
+  EXPECT_THROW_MSG(CheckFormat<const char*>("{0:,}"),
+      FormatError, "format specifier requires numeric argument");
+  EXPECT_THROW_MSG(CheckFormat<int>("{0:_x}"),
+      FormatError, "thousands separator requires decimal format");
+  EXPECT_THROW_MSG(CheckFormat<unsigned>("{0: }"),
+      FormatError, "format specifier requires signed argument");
+  EXPECT_THROW_MSG(CheckFormat<int>("{0:.2}"), FormatError,
+      "precision specifier requires floating-point argument");
+  EXPECT_THROW_MSG((CheckFormat<double, char>("{0:.{1}}")),
+      FormatError, "precision is not integer");
+  EXPECT_THROW_MSG(CheckFormat<double>("{0:.{1}}"),
+      FormatError, "argument index is out of range in format");
+  EXPECT_THROW_MSG(CheckFormat<int>("{0:f}"),
+      FormatError, "unknown format code for integer");
+  EXPECT_THROW_MSG(CheckFormat<double>("{0:d}"),
+      FormatError, "unknown format code for double");
+  EXPECT_THROW_MSG(CheckFormat<char>("{0:s}"),
+      FormatError, "unknown format code for char");
+  EXPECT_THROW_MSG(CheckFormat<const char*>("{0:c}"),
+      FormatError, "unknown format code for string");
+  EXPECT_THROW_MSG(CheckFormat<void*>("{0:x}"),
+      FormatError, "unknown format code for pointer");
+  EXPECT_THROW_MSG(CheckFormat<Date>("{0:s}"),
+      FormatError, "unknown format code for object");
+}
+#endif
+
 template <typename T>
 std::string str(const T &value) {
   return fmt::str(fmt::Format("{0}") << value);
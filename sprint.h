@@ -11,26 +11,36 @@ namespace format { namespace sprint {
 // - have constructors that hold a copy of whats going to be appended
 //   to the buffer. For complex types, a pointer or reference should be
 //   passed in.
-// - they will implement an size_t appendTo(char*, size_t) that will
+// - derive from AppendTransaction<Derived> which dispatches to them
+//   statically, so there are no virtual calls and AppendTo can be inlined
+// - implement a std::size_t RequiredSize() const that returns the
+//   number of characters AppendTo needs
+// - implement a std::size_t AppendTo(T*, std::size_t) const that will
 //   basically do what sprintf would do
-//   - return the number of bytes written 
-//	 - return -1 on an error
-//   - an expected error: the passed in size_t is insufficient or negative
-//     that means the end-user did not give Ape a big enough buffer. Do
-//     nothing and return -1
+//   - return the number of characters written
+//   - return TRANSACTION_FAILED if the passed in size is insufficient.
+//     The formatter then grows its buffer by RequiredSize() and retries
+//     once, so AppendTo must not change the object.
 //
-template <class T>
+template <class Derived, class T = char>
 class AppendTransaction
 {
-public: 
-	AppendTransaction() {}
-
-	virtual ~AppendTransaction() {}
-
+public:
 	enum {
 		TRANSACTION_FAILED = 0xFFFFFFFF
 	};
-	virtual size_t AppendTo(T* dest, size_t destSize) const = 0;
+
+	typedef T CharType;
+
+	const Derived &derived() const
+	{
+		return static_cast<const Derived&>(*this);
+	}
+
+protected:
+	// Transactions are only used through derived classes.
+	AppendTransaction() {}
+	~AppendTransaction() {}
 };
    
 // Configure pad 
@@ -78,10 +88,13 @@ enum HexCase {
 template <bool>
 class Case {};
 
+// lookup has a digit per nibble, pairs has two digits per byte value:
+// "000102...ff"
 template <>
 class Case<uppercase> {
 public:
 	static char lookup[16];
+	static const char pairs[513];
 };
 
 typedef Case<uppercase> UpperHex;
@@ -90,7 +103,7 @@ template <>
 class Case<lowercase> {
 public:
 	static char lookup[16];
-
+	static const char pairs[513];
 };
 
 typedef Case<lowercase> LowerHex;
@@ -114,6 +127,112 @@ public:
 	};
 };
 
+// Number of significant bits in val, zero has one bit
+inline unsigned bitLength(uint64_t val)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return 64 - __builtin_clzll(val | 1);
+#else
+	unsigned rVal = 1;
+	while ((val >>= 1) != 0)
+		++rVal;
+	return rVal;
+#endif
+}
+
+// Digit kernels shared by the sprints and BasicWriter::FormatInt.
+// count returns the number of digits in val. write writes the numDigits
+// lowest digits of val to dest, most significant first, with a single
+// table lookup for two hex digits, two octal digits or four binary ones.
+template <int _p>
+class Digits;
+
+template <>
+class Digits<hex> {
+public:
+	static inline unsigned count(uint64_t val)
+	{
+		return (bitLength(val) + 3) / 4;
+	}
+
+	// pairs is Case<>::pairs selecting the case of digits
+	template <typename Char, typename unsignedT>
+	static inline void write(Char* dest, unsignedT val,
+			unsigned numDigits, const char* pairs)
+	{
+		Char* cursor = dest + numDigits;
+		for (; numDigits >= 2; numDigits -= 2)
+		{
+			unsigned index = static_cast<unsigned>(val & 0xff) * 2;
+			*--cursor = pairs[index + 1];
+			*--cursor = pairs[index];
+			val = static_cast<unsignedT>(val >> 8);
+		}
+		if (numDigits != 0)
+			*--cursor = pairs[(val & 0xf) * 2 + 1];
+	}
+};
+
+template <>
+class Digits<oct> {
+public:
+	static const char pairs[129];  // "0001...77"
+
+	static inline unsigned count(uint64_t val)
+	{
+		return (bitLength(val) + 2) / 3;
+	}
+
+	template <typename Char, typename unsignedT>
+	static inline void write(Char* dest, unsignedT val,
+			unsigned numDigits, const char* = 0)
+	{
+		Char* cursor = dest + numDigits;
+		for (; numDigits >= 2; numDigits -= 2)
+		{
+			unsigned index = static_cast<unsigned>(val & 077) * 2;
+			*--cursor = pairs[index + 1];
+			*--cursor = pairs[index];
+			val = static_cast<unsignedT>(val >> 6);
+		}
+		if (numDigits != 0)
+			*--cursor = static_cast<Char>('0' + (val & 7));
+	}
+};
+
+template <>
+class Digits<bin> {
+public:
+	static const char quads[65];  // "0000000100100011...1111"
+
+	static inline unsigned count(uint64_t val)
+	{
+		return bitLength(val);
+	}
+
+	template <typename Char, typename unsignedT>
+	static inline void write(Char* dest, unsignedT val,
+			unsigned numDigits, const char* = 0)
+	{
+		Char* cursor = dest + numDigits;
+		for (; numDigits >= 4; numDigits -= 4)
+		{
+			const char* quad = quads + (val & 0xf) * 4;
+			cursor -= 4;
+			cursor[0] = quad[0];
+			cursor[1] = quad[1];
+			cursor[2] = quad[2];
+			cursor[3] = quad[3];
+			val = static_cast<unsignedT>(val >> 4);
+		}
+		for (; numDigits != 0; --numDigits)
+		{
+			*--cursor = static_cast<Char>('0' + (val & 1));
+			val = static_cast<unsignedT>(val >> 1);
+		}
+	}
+};
+
 // force compiler errors for incorrectly sized
 // unsigend arguments. 
 //
@@ -171,44 +290,41 @@ struct UnsignedProxy<uint64_t>
 //  (5) minimize potential code bloat
 //  (6) test
 template <typename PowerT, typename CaseT = LowerHex, typename PadT = NoPad, typename unsignedT=uint32_t>
-class SpBin : public AppendTransaction<char>
+class SpBin : public AppendTransaction< SpBin<PowerT, CaseT, PadT, unsignedT> >
 {
 private:
-	mutable unsignedT m_val;
+	unsignedT m_val;
 public:
 	SpBin(UnsignedProxy<unsignedT> val) : m_val(val.value)
 	{
 	}
 
+	typedef Digits<PowerT::pow> DigitsT;
+
+	// Number of digits in val, zero has one digit
 	static inline std::size_t charLen(unsignedT val)
 	{
-		std::size_t rVal = 0;
-		while (val)
-		{
-			++rVal;
-			val = val >> PowerT::pow;
-		}
-		return rVal;
+		return DigitsT::count(val);
+	}
+
+	std::size_t RequiredSize() const
+	{
+		return PadT::charWidth(charLen(m_val));
 	}
 
 	// Append to dest, returning num chars written
-	size_t AppendTo(char* dest, size_t destLen) const
+	std::size_t AppendTo(char* dest, std::size_t destLen) const
 	{
 		std::size_t charsNeeded = charLen(m_val);
 		std::size_t width = PadT::charWidth(charsNeeded);
 		if (width > destLen)
 		{
-			return 0;
+			return SpBin::TRANSACTION_FAILED;
 		}
-		char* cursor = dest + (width);
-		*cursor-- = '\0';
-		*cursor = '0';
-		while (m_val)
-		{
-			*cursor-- = CaseT::lookup[m_val & PowerT::mask];
-			m_val = m_val >> PowerT::pow;
-		}
-		PadT::pad(cursor, width, charsNeeded);
+		char* digits = dest + width - charsNeeded;
+		DigitsT::write(digits, m_val,
+			static_cast<unsigned>(charsNeeded), CaseT::pairs);
+		PadT::pad(digits - 1, width, charsNeeded);
 		return width;
 	}
 };
@@ -229,7 +345,7 @@ template <typename PadT = NoPad, typename unsignedT=uint32_t>
 class asHexU : public SpBin< Power<4>, UpperHex, PadT, unsignedT> 
 	{ 
 	public:
-		asHexU(UnsignedProxy<unsignedT> val) : SpBin<Power<4>, UpperHex, PadT>(val) {}
+		asHexU(UnsignedProxy<unsignedT> val) : SpBin<Power<4>, UpperHex, PadT, unsignedT>(val) {}
 	};
 
 // Octal Formatting
@@ -237,7 +353,7 @@ template <typename PadT = NoPad, typename unsignedT=uint32_t>
 class asOct : public SpBin< Power<3>, LowerHex, PadT, unsignedT> 
 	{ 
 	public:
-		asOct(UnsignedProxy<unsignedT> val) : SpBin<Power<3>, LowerHex, PadT>(val) {}
+		asOct(UnsignedProxy<unsignedT> val) : SpBin<Power<3>, LowerHex, PadT, unsignedT>(val) {}
 	};
 
 
@@ -246,7 +362,41 @@ template <typename PadT = NoPad, typename unsignedT=uint32_t>
 class asBin : public SpBin< Power<1>, LowerHex, PadT, unsignedT> 
 	{ 
 	public:
-		asBin(UnsignedProxy<unsignedT> val) : SpBin<Power<1>, LowerHex, PadT>(val) {}
+		asBin(UnsignedProxy<unsignedT> val) : SpBin<Power<1>, LowerHex, PadT, unsignedT>(val) {}
 	};
+
+// Hex dump of a memory block, two digits per byte without separators
+template <typename CaseT = LowerHex>
+class HexDump : public AppendTransaction< HexDump<CaseT> >
+{
+private:
+	const unsigned char* m_data;
+	std::size_t m_size;
+public:
+	HexDump(const void* data, std::size_t size)
+		: m_data(static_cast<const unsigned char*>(data)), m_size(size)
+	{
+	}
+
+	std::size_t RequiredSize() const
+	{
+		return m_size * 2;
+	}
+
+	std::size_t AppendTo(char* dest, std::size_t destLen) const
+	{
+		if (m_size * 2 > destLen)
+		{
+			return HexDump::TRANSACTION_FAILED;
+		}
+		for (std::size_t i = 0; i < m_size; ++i)
+		{
+			const char* pair = CaseT::pairs + m_data[i] * 2;
+			dest[i * 2] = pair[0];
+			dest[i * 2 + 1] = pair[1];
+		}
+		return m_size * 2;
+	}
+};
 }}
 #endif
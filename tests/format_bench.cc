@@ -0,0 +1,673 @@
+/*
+ Micro-benchmarks for the format library.
+
+ Each benchmark formats values from a fixed pseudo-random input set with
+ format and, where applicable, with printf and IOStreams for comparison.
+ The number of iterations is increased until a run takes at least the
+ minimum time, then the time and the number of bytes allocated per
+ operation are reported.
+
+ Usage: format_bench [--min_time=<seconds>] [--repetitions=<n>]
+                     [--save=<file>] [--baseline=<file> [--threshold=<ratio>]]
+                     [<filter>]
+
+ Only benchmarks whose names contain <filter> are run. The corpus/
+ benchmarks replay format strings and argument types from format_test.cc.
+ --save writes the time per operation of each benchmark to a file which
+ can be passed as --baseline to a later run. Then the change relative to
+ the baseline is reported and the program exits with status 1 if the time
+ of any benchmark exceeds its baseline multiplied by the threshold, 1.2 by
+ default. With --repetitions each benchmark is run n times and the fastest
+ run is reported which makes comparisons less sensitive to noise.
+
+ Copyright (c) 2012, Victor Zverovich
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice, this
+    list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <new>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+#include <fcntl.h>
+
+#ifdef _WIN32
+# include <windows.h>
+# include <io.h>
+# define FMT_POSIX(call) _##call
+#else
+# include <time.h>
+# include <unistd.h>
+# define FMT_POSIX(call) call
+#endif
+
+#include "../format.h"
+#include "../async.h"
+#include "../binlog.h"
+
+#if _MSC_VER
+# undef snprintf
+# define snprintf _snprintf
+#endif
+
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+# define FMT_THROW_BAD_ALLOC
+# define FMT_NOEXCEPT noexcept
+#else
+# define FMT_THROW_BAD_ALLOC throw(std::bad_alloc)
+# define FMT_NOEXCEPT throw()
+#endif
+
+namespace {
+
+std::size_t num_allocated_bytes;
+
+// Returns the current time in seconds.
+double GetTime() {
+#ifdef _WIN32
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return static_cast<double>(counter.QuadPart) / frequency.QuadPart;
+#else
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+#endif
+}
+
+// Results are accumulated here to keep the compiler from optimizing
+// away the benchmarked code.
+volatile std::size_t sink;
+
+enum { NUM_INPUTS = 1024 };
+
+int ints[NUM_INPUTS];
+double doubles[NUM_INPUTS];
+const char *strings[NUM_INPUTS];
+
+void InitInputs() {
+  static const char *const words[] = {
+    "a", "format", "benchmark", "alignment", "x", "padding", "string", "42"
+  };
+  std::srand(0);
+  for (int i = 0; i < NUM_INPUTS; ++i) {
+    unsigned scale = std::rand() / 100 + 1;
+    // The product is computed in unsigned arithmetic to avoid overflow
+    // and halved to fit in int.
+    unsigned value = static_cast<unsigned>(std::rand()) * std::rand() / scale;
+    ints[i] = static_cast<int>(value / 2);
+    if (i % 2 != 0) ints[i] = -ints[i];
+    doubles[i] = static_cast<double>(std::rand()) / (std::rand() % 1000 + 1);
+    strings[i] = words[i % (sizeof(words) / sizeof(*words))];
+  }
+}
+
+// A class formatted with a custom Format function.
+class Point {
+ private:
+  int x_, y_;
+
+ public:
+  Point(int x, int y) : x_(x), y_(y) {}
+
+  int x() const { return x_; }
+  int y() const { return y_; }
+};
+
+void Format(fmt::ArgFormatter &af, const fmt::FormatSpec &spec, Point p) {
+  std::size_t start = af.size();
+  fmt::FormatSpec int_spec;
+  af.Append("(", 1);
+  af.Write(p.x(), int_spec);
+  af.Append(", ", 2);
+  af.Write(p.y(), int_spec);
+  af.Append(")", 1);
+  af.Pad(start, spec);
+}
+
+// A class formatted with the default Format function that uses
+// the stream insertion operator.
+class Date {
+ private:
+  int year_, month_, day_;
+
+ public:
+  Date(int year, int month, int day) : year_(year), month_(month), day_(day) {}
+
+  friend std::ostream &operator<<(std::ostream &os, const Date &d) {
+    os << d.year_ << '-' << d.month_ << '-' << d.day_;
+    return os;
+  }
+};
+
+// Redirects stdout to the null device while the object exists.
+class NullStdout {
+ private:
+  int saved_fd_;
+
+ public:
+  NullStdout() {
+    std::fflush(stdout);
+    saved_fd_ = FMT_POSIX(dup(1));
+#ifdef _WIN32
+    int fd = FMT_POSIX(open("NUL", _O_WRONLY));
+#else
+    int fd = FMT_POSIX(open("/dev/null", O_WRONLY));
+#endif
+    FMT_POSIX(dup2(fd, 1));
+    FMT_POSIX(close(fd));
+  }
+
+  ~NullStdout() {
+    std::fflush(stdout);
+    FMT_POSIX(dup2(saved_fd_, 1));
+    FMT_POSIX(close(saved_fd_));
+  }
+};
+
+// Defines a benchmark function which formats a value from an array of
+// inputs per iteration. The code in the body can refer to the value as
+// `value`.
+#define BENCHMARK_VALUES(name, inputs, setup, body) \
+  void name(std::size_t num_iterations) { \
+    setup; \
+    for (std::size_t i = 0; i < num_iterations; ++i) { \
+      const FMT_TYPEOF_INPUT_##inputs &value = inputs[i % NUM_INPUTS]; \
+      body; \
+    } \
+  }
+
+#define FMT_TYPEOF_INPUT_ints int
+#define FMT_TYPEOF_INPUT_doubles double
+#define FMT_TYPEOF_INPUT_strings char *const
+
+// Benchmarks using a reused formatter.
+#define BENCHMARK_FORMAT(name, inputs, format) \
+  BENCHMARK_VALUES(name, inputs, fmt::Formatter f, \
+    f.Clear(); f(format) << value; sink += f.size())
+
+// Benchmarks using snprintf into a stack buffer.
+#define BENCHMARK_PRINTF(name, inputs, format) \
+  BENCHMARK_VALUES(name, inputs, char buffer[256], \
+    sink += snprintf(buffer, sizeof(buffer), format, value))
+
+// Benchmarks using a reused std::ostringstream.
+#define BENCHMARK_IOSTREAMS(name, inputs, manipulators) \
+  BENCHMARK_VALUES(name, inputs, std::ostringstream os, \
+    os.str(std::string()); os << manipulators << value; \
+    sink += os.str().size())
+
+BENCHMARK_FORMAT(FormatInt, ints, "{}")
+BENCHMARK_PRINTF(PrintfInt, ints, "%d")
+BENCHMARK_IOSTREAMS(IOStreamsInt, ints, std::dec)
+
+BENCHMARK_VALUES(FormattedSizeInt, ints, fmt::Formatter f,
+  sink += FormattedSize(f("{}") << value))
+
+BENCHMARK_FORMAT(FormatHex, ints, "{:x}")
+BENCHMARK_PRINTF(PrintfHex, ints, "%x")
+BENCHMARK_IOSTREAMS(IOStreamsHex, ints, std::hex)
+
+BENCHMARK_FORMAT(FormatOct, ints, "{:o}")
+BENCHMARK_PRINTF(PrintfOct, ints, "%o")
+BENCHMARK_IOSTREAMS(IOStreamsOct, ints, std::oct)
+
+BENCHMARK_VALUES(FormatHexTransaction, ints, fmt::Formatter f,
+  f.Clear(); f << fmt::sprint::asHexL<>(static_cast<uint32_t>(value) | 1);
+  sink += f.size())
+
+// Dumps 256 bytes of the inputs per iteration.
+BENCHMARK_VALUES(FormatHexDump, ints, fmt::Formatter f,
+  static_cast<void>(value); f.Clear();
+  f << fmt::sprint::HexDump<>(ints + i % (NUM_INPUTS - 64), 256);
+  sink += f.size())
+
+BENCHMARK_VALUES(FormatInts, ints, fmt::Formatter f,
+  f.Clear(); f.FormatInts(&value, &value + 1, ' '); sink += f.size())
+
+BENCHMARK_FORMAT(FormatDoubleShortest, doubles, "{}")
+BENCHMARK_PRINTF(PrintfDoubleShortest, doubles, "%.17g")
+BENCHMARK_IOSTREAMS(IOStreamsDoubleShortest, doubles, std::setprecision(17))
+
+BENCHMARK_FORMAT(FormatDoubleE, doubles, "{:.6e}")
+BENCHMARK_PRINTF(PrintfDoubleE, doubles, "%.6e")
+BENCHMARK_IOSTREAMS(IOStreamsDoubleE, doubles,
+  std::scientific << std::setprecision(6))
+
+BENCHMARK_FORMAT(FormatDoubleF, doubles, "{:.6f}")
+BENCHMARK_PRINTF(PrintfDoubleF, doubles, "%.6f")
+BENCHMARK_IOSTREAMS(IOStreamsDoubleF, doubles,
+  std::fixed << std::setprecision(6))
+
+BENCHMARK_FORMAT(FormatDoubleG, doubles, "{:g}")
+BENCHMARK_PRINTF(PrintfDoubleG, doubles, "%g")
+BENCHMARK_IOSTREAMS(IOStreamsDoubleG, doubles, std::setprecision(6))
+
+BENCHMARK_FORMAT(FormatStringLeft, strings, "{:<20}")
+BENCHMARK_PRINTF(PrintfStringLeft, strings, "%-20s")
+BENCHMARK_IOSTREAMS(IOStreamsStringLeft, strings,
+  std::left << std::setw(20))
+
+BENCHMARK_FORMAT(FormatStringRight, strings, "{:>20}")
+BENCHMARK_PRINTF(PrintfStringRight, strings, "%20s")
+BENCHMARK_IOSTREAMS(IOStreamsStringRight, strings,
+  std::right << std::setw(20))
+
+BENCHMARK_FORMAT(FormatStringCenter, strings, "{:*^20}")
+
+BENCHMARK_VALUES(FormatCustom, ints, fmt::Formatter f,
+  f.Clear(); f("{}") << Point(value, -value); sink += f.size())
+
+BENCHMARK_VALUES(FormatOStream, ints, fmt::Formatter f,
+  f.Clear(); f("{}") << Date(2012, value & 0xf, value & 0x1f);
+  sink += f.size())
+
+BENCHMARK_VALUES(IOStreamsOStream, ints, std::ostringstream os,
+  os.str(std::string()); os << Date(2012, value & 0xf, value & 0x1f);
+  sink += os.str().size())
+
+// Formats a message with twelve fields of fundamental types and C strings
+// which is dominated by the cost of passing the arguments.
+BENCHMARK_VALUES(FormatFields, ints, fmt::Formatter f,
+  std::size_t j = i % NUM_INPUTS; f.Clear();
+  f("{0} {1} {2} {3} {4} {5} {6} {7} {8} {9} {10} {11}")
+      << value << strings[j] << 'x' << doubles[j] << -value << 42u
+      << strings[j] << value << 1.5 << 'y' << value << strings[j];
+  sink += f.size())
+
+BENCHMARK_VALUES(PrintfFields, ints, char buffer[512],
+  std::size_t j = i % NUM_INPUTS;
+  sink += snprintf(buffer, sizeof(buffer),
+      "%d %s %c %.17g %d %u %s %d %.17g %c %d %s",
+      value, strings[j], 'x', doubles[j], -value, 42u,
+      strings[j], value, 1.5, 'y', value, strings[j]))
+
+BENCHMARK_VALUES(FormatTemp, ints, (void)0,
+  sink += std::strlen(c_str(fmt::Format("{0}:{1:.3f}:{2}")
+      << value << doubles[i % NUM_INPUTS] << strings[i % NUM_INPUTS])))
+
+BENCHMARK_VALUES(FormatTempCompiled, ints,
+  static const fmt::CompiledFormat format("{0}:{1:.3f}:{2}"),
+  sink += std::strlen(c_str(fmt::Format(format)
+      << value << doubles[i % NUM_INPUTS] << strings[i % NUM_INPUTS])))
+
+#if FMT_USE_THREAD_LOCAL
+// Enables the format cache of the current thread while the object exists.
+class EnableFormatCache {
+ public:
+  EnableFormatCache() { fmt::GetThreadFormatCache().set_max_size(64); }
+  ~EnableFormatCache() { fmt::GetThreadFormatCache().set_max_size(0); }
+};
+
+BENCHMARK_VALUES(FormatTempCached, ints, EnableFormatCache enable_cache,
+  sink += std::strlen(c_str(fmt::Format("{0}:{1:.3f}:{2}")
+      << value << doubles[i % NUM_INPUTS] << strings[i % NUM_INPUTS])))
+#endif
+
+// A template that is mostly literal text with a few fields.
+#define FMT_LITERAL_PREFIX \
+  "<tr class=\"row\"><td class=\"id\"><a href=\"/items/details?id="
+#define FMT_LITERAL_MIDDLE \
+  "\">details</a></td><td class=\"value\" style=\"text-align: right\">"
+#define FMT_LITERAL_SUFFIX \
+  "</td><td class=\"name\">Name: "
+
+BENCHMARK_FORMAT(FormatLiteral, ints,
+  FMT_LITERAL_PREFIX "{0}" FMT_LITERAL_MIDDLE "{0}" FMT_LITERAL_SUFFIX
+  "{0:x}</td></tr>\n")
+BENCHMARK_VALUES(PrintfLiteral, ints, char buffer[256],
+  sink += snprintf(buffer, sizeof(buffer),
+      FMT_LITERAL_PREFIX "%d" FMT_LITERAL_MIDDLE "%d" FMT_LITERAL_SUFFIX
+      "%x</td></tr>\n", value, value, value))
+
+BENCHMARK_VALUES(FormatPrint, ints, NullStdout null_stdout,
+  fmt::Print("{0}:{1:.3f}:{2}\n")
+      << value << doubles[i % NUM_INPUTS] << strings[i % NUM_INPUTS])
+
+BENCHMARK_VALUES(PrintfPrint, ints, NullStdout null_stdout,
+  std::printf("%d:%.3f:%s\n",
+      value, doubles[i % NUM_INPUTS], strings[i % NUM_INPUTS]))
+
+// Writes responses with a large body copying the body to the buffer.
+BENCHMARK_VALUES(FormatResponseBuffered, ints,
+  NullStdout null_stdout; static const std::string response_body(16384, 'x');
+  fmt::BufferedSink<fmt::FdOutput> sink,
+  sink("HTTP/1.1 200 OK\r\nX-Id: {0}\r\nContent-Length: {1}\r\n\r\n{2}")
+      << value << response_body.size() << response_body;
+  sink.Flush())
+
+// Writes responses with a large body passing it to writev by reference.
+BENCHMARK_VALUES(FormatResponseGather, ints,
+  NullStdout null_stdout; static const std::string response_body(16384, 'x');
+  fmt::GatherSink sink(1),
+  sink("HTTP/1.1 200 OK\r\nX-Id: {0}\r\nContent-Length: {1}\r\n\r\n{2}")
+      << value << response_body.size() << response_body;
+  sink.Flush())
+
+#if FMT_USE_ASYNC
+// Formatting is done on the worker thread, so this measures the cost of
+// capturing arguments as long as the worker keeps up.
+BENCHMARK_VALUES(AsyncPrint, ints,
+  NullStdout null_stdout; fmt::AsyncSink<fmt::FdOutput> log,
+  log.Format("{0}:{1:.3f}:{2}\n",
+      value, doubles[i % NUM_INPUTS], strings[i % NUM_INPUTS]))
+
+// Formatting is done on the calling thread and the output is written
+// by the worker thread.
+BENCHMARK_VALUES(ConcurrentPrint, ints,
+  NullStdout null_stdout; fmt::ConcurrentSink<fmt::FdOutput> out,
+  out.Print("{0}:{1:.3f}:{2}\n")
+      << value << doubles[i % NUM_INPUTS] << strings[i % NUM_INPUTS])
+
+// Counts the output size of parallel formatting.
+struct CountingOutput {
+  void operator()(const char *, std::size_t size) { sink += size; }
+};
+
+BENCHMARK_VALUES(FormatRowsSerial, ints,
+  static const fmt::CompiledFormat format("{0},{1:.3f},{2}\n");
+  fmt::Formatter f; CountingOutput out,
+  f.FormatArgs(format, value, doubles[i % NUM_INPUTS], strings[i % NUM_INPUTS]);
+  if (f.size() >= 4096) { out(f.data(), f.size()); f.Clear(); })
+
+// Formats the inputs as rows in parallel, NUM_INPUTS rows at a time.
+void FormatRowsParallel(std::size_t num_iterations) {
+  static const fmt::CompiledFormat format("{0},{1:.3f},{2}\n");
+  static fmt::ParallelFormatter pf;
+  CountingOutput out;
+  for (std::size_t i = 0; i < num_iterations; i += NUM_INPUTS) {
+    std::size_t num_rows =
+        std::min<std::size_t>(NUM_INPUTS, num_iterations - i);
+    pf.FormatRows(out, format, num_rows, ints, doubles, strings);
+  }
+}
+
+// Stores the arguments in binary form without formatting them.
+BENCHMARK_VALUES(BinaryLogPrint, ints, fmt::BinaryLog<CountingOutput> log,
+  log.Log("{0}:{1:.3f}:{2}\n",
+      value, doubles[i % NUM_INPUTS], strings[i % NUM_INPUTS]))
+#endif
+
+// Benchmarks replaying format strings from format_test.cc with arguments
+// of the same types. The code in args can refer to an int value as
+// `value`, a double as `d` and a string as `s`.
+#define BENCHMARK_CORPUS(name, format, args) \
+  BENCHMARK_VALUES(name, ints, fmt::Formatter f, \
+    const double d = doubles[i % NUM_INPUTS]; \
+    const char *const s = strings[i % NUM_INPUTS]; \
+    static_cast<void>(value); static_cast<void>(d); static_cast<void>(s); \
+    f.Clear(); f(format) << args; sink += f.size())
+
+BENCHMARK_CORPUS(CorpusMixed, "{0:0.10f}:{1:04}:{2:+g}:{3}:{4}:{5}:%",
+  d << value << d << s << reinterpret_cast<void*>(1000) << 'X')
+BENCHMARK_CORPUS(CorpusRepeatedArgs, "{0}{1}{0}", s << "cad")
+BENCHMARK_CORPUS(CorpusAutoIndex, "{}, {}, {}", 'a' << value << s)
+BENCHMARK_CORPUS(CorpusEscapes, "{{{0}}}", value)
+BENCHMARK_CORPUS(CorpusPrecisionArg, "{0:.{1}}", d << (value & 7))
+BENCHMARK_CORPUS(CorpusSignZero, "{0:+010.4g}", d)
+BENCHMARK_CORPUS(CorpusHash, "{0:#x}", value)
+BENCHMARK_CORPUS(CorpusGrouping, "{0:,}", value)
+BENCHMARK_CORPUS(CorpusFill, "{:*^30}", s)
+BENCHMARK_CORPUS(CorpusMessage, "cannot write to file: {0}", s)
+
+struct Benchmark {
+  const char *name;
+  void (*run)(std::size_t num_iterations);
+};
+
+const Benchmark BENCHMARKS[] = {
+  {"int/format", FormatInt},
+  {"int/printf", PrintfInt},
+  {"int/iostreams", IOStreamsInt},
+  {"int/format_ints", FormatInts},
+  {"int/formatted_size", FormattedSizeInt},
+  {"hex/format", FormatHex},
+  {"hex/printf", PrintfHex},
+  {"hex/iostreams", IOStreamsHex},
+  {"hex/sprint_transaction", FormatHexTransaction},
+  {"hex/hexdump", FormatHexDump},
+  {"oct/format", FormatOct},
+  {"oct/printf", PrintfOct},
+  {"oct/iostreams", IOStreamsOct},
+  {"double_shortest/format", FormatDoubleShortest},
+  {"double_shortest/printf", PrintfDoubleShortest},
+  {"double_shortest/iostreams", IOStreamsDoubleShortest},
+  {"double_e/format", FormatDoubleE},
+  {"double_e/printf", PrintfDoubleE},
+  {"double_e/iostreams", IOStreamsDoubleE},
+  {"double_f/format", FormatDoubleF},
+  {"double_f/printf", PrintfDoubleF},
+  {"double_f/iostreams", IOStreamsDoubleF},
+  {"double_g/format", FormatDoubleG},
+  {"double_g/printf", PrintfDoubleG},
+  {"double_g/iostreams", IOStreamsDoubleG},
+  {"string_left/format", FormatStringLeft},
+  {"string_left/printf", PrintfStringLeft},
+  {"string_left/iostreams", IOStreamsStringLeft},
+  {"string_right/format", FormatStringRight},
+  {"string_right/printf", PrintfStringRight},
+  {"string_right/iostreams", IOStreamsStringRight},
+  {"string_center/format", FormatStringCenter},
+  {"custom/format", FormatCustom},
+  {"ostream/format", FormatOStream},
+  {"ostream/iostreams", IOStreamsOStream},
+  {"fields/format", FormatFields},
+  {"fields/printf", PrintfFields},
+  {"temp/format", FormatTemp},
+  {"temp/compiled", FormatTempCompiled},
+#if FMT_USE_THREAD_LOCAL
+  {"temp/format_cache", FormatTempCached},
+#endif
+  {"literal/format", FormatLiteral},
+  {"literal/printf", PrintfLiteral},
+  {"print/format", FormatPrint},
+  {"print/printf", PrintfPrint},
+  {"response/buffered", FormatResponseBuffered},
+  {"response/gather", FormatResponseGather},
+#if FMT_USE_ASYNC
+  {"print/async", AsyncPrint},
+  {"print/concurrent", ConcurrentPrint},
+  {"print/binlog", BinaryLogPrint},
+  {"rows/compiled", FormatRowsSerial},
+  {"rows/parallel", FormatRowsParallel},
+#endif
+  {"corpus/mixed", CorpusMixed},
+  {"corpus/repeated_args", CorpusRepeatedArgs},
+  {"corpus/auto_index", CorpusAutoIndex},
+  {"corpus/escapes", CorpusEscapes},
+  {"corpus/precision_arg", CorpusPrecisionArg},
+  {"corpus/sign_zero", CorpusSignZero},
+  {"corpus/hash", CorpusHash},
+  {"corpus/grouping", CorpusGrouping},
+  {"corpus/fill", CorpusFill},
+  {"corpus/message", CorpusMessage}
+};
+
+struct Result {
+  double ns_per_op;
+  std::size_t num_iterations;
+  double bytes_per_op;
+};
+
+// Runs a benchmark increasing the number of iterations until it takes
+// at least min_time seconds.
+Result Run(const Benchmark &b, double min_time) {
+  std::size_t num_iterations = 1;
+  for (;;) {
+    std::size_t start_bytes = num_allocated_bytes;
+    double start = GetTime();
+    b.run(num_iterations);
+    double elapsed = GetTime() - start;
+    std::size_t bytes = num_allocated_bytes - start_bytes;
+    if (elapsed >= min_time || num_iterations >= 1000000000) {
+      Result result = {
+        elapsed * 1e9 / num_iterations, num_iterations,
+        static_cast<double>(bytes) / num_iterations
+      };
+      return result;
+    }
+    // Aim for 1.5 times the minimum time to avoid another round.
+    double scale = elapsed > 0 ? 1.5 * min_time / elapsed : 100;
+    if (scale > 100) scale = 100;
+    if (scale < 2) scale = 2;
+    num_iterations = static_cast<std::size_t>(num_iterations * scale);
+  }
+}
+
+// Times per operation in nanoseconds by benchmark name.
+typedef std::map<std::string, double> Timings;
+
+// Reads timings saved with --save. Returns false on error.
+bool ReadTimings(const char *filename, Timings &timings) {
+  std::FILE *f = std::fopen(filename, "r");
+  if (!f)
+    return false;
+  char name[256];
+  double ns_per_op = 0;
+  while (std::fscanf(f, "%255s %lf", name, &ns_per_op) == 2)
+    timings[name] = ns_per_op;
+  bool ok = std::feof(f) != 0;
+  std::fclose(f);
+  return ok;
+}
+
+bool WriteTimings(const char *filename, const Timings &timings) {
+  std::FILE *f = std::fopen(filename, "w");
+  if (!f)
+    return false;
+  for (Timings::const_iterator i = timings.begin(); i != timings.end(); ++i)
+    std::fprintf(f, "%s %.1f\n", i->first.c_str(), i->second);
+  return std::fclose(f) == 0;
+}
+}
+
+// Count allocated bytes. The global allocation functions are replaced
+// to measure allocations of the library as well as of its alternatives.
+void *operator new(std::size_t size) FMT_THROW_BAD_ALLOC {
+  num_allocated_bytes += size;
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) FMT_NOEXCEPT {
+  std::free(p);
+}
+
+void *operator new[](std::size_t size) FMT_THROW_BAD_ALLOC {
+  return operator new(size);
+}
+
+void operator delete[](void *p) FMT_NOEXCEPT {
+  operator delete(p);
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void *p, std::size_t) FMT_NOEXCEPT {
+  operator delete(p);
+}
+
+void operator delete[](void *p, std::size_t) FMT_NOEXCEPT {
+  operator delete(p);
+}
+#endif
+
+int main(int argc, char **argv) {
+  double min_time = 0.5;
+  const char *filter = "";
+  const char *save_filename = 0;
+  const char *baseline_filename = 0;
+  double threshold = 1.2;
+  int repetitions = 1;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char MIN_TIME[] = "--min_time=";
+    const char SAVE[] = "--save=";
+    const char BASELINE[] = "--baseline=";
+    const char THRESHOLD[] = "--threshold=";
+    const char REPETITIONS[] = "--repetitions=";
+    if (std::strncmp(arg, MIN_TIME, sizeof(MIN_TIME) - 1) == 0)
+      min_time = std::atof(arg + sizeof(MIN_TIME) - 1);
+    else if (std::strncmp(arg, SAVE, sizeof(SAVE) - 1) == 0)
+      save_filename = arg + sizeof(SAVE) - 1;
+    else if (std::strncmp(arg, BASELINE, sizeof(BASELINE) - 1) == 0)
+      baseline_filename = arg + sizeof(BASELINE) - 1;
+    else if (std::strncmp(arg, THRESHOLD, sizeof(THRESHOLD) - 1) == 0)
+      threshold = std::atof(arg + sizeof(THRESHOLD) - 1);
+    else if (std::strncmp(arg, REPETITIONS, sizeof(REPETITIONS) - 1) == 0)
+      repetitions = std::atoi(arg + sizeof(REPETITIONS) - 1);
+    else
+      filter = arg;
+  }
+  Timings baseline, timings;
+  if (baseline_filename && !ReadTimings(baseline_filename, baseline)) {
+    std::fprintf(stderr, "cannot read %s\n", baseline_filename);
+    return 1;
+  }
+  InitInputs();
+  std::printf("%-28s %12s %12s %12s%s\n",
+      "Benchmark", "ns/op", "Iterations", "Bytes/op",
+      baseline_filename ? "     Baseline" : "");
+  std::printf("%s\n", std::string(baseline_filename ? 80 : 67, '-').c_str());
+  int num_regressions = 0;
+  for (std::size_t i = 0; i < sizeof(BENCHMARKS) / sizeof(*BENCHMARKS); ++i) {
+    const Benchmark &b = BENCHMARKS[i];
+    if (!std::strstr(b.name, filter))
+      continue;
+    Result r = Run(b, min_time);
+    for (int j = 1; j < repetitions; ++j) {
+      Result next = Run(b, min_time);
+      if (next.ns_per_op < r.ns_per_op)
+        r = next;
+    }
+    timings[b.name] = r.ns_per_op;
+    std::printf("%-28s %12.1f %12lu %12.1f", b.name, r.ns_per_op,
+        static_cast<unsigned long>(r.num_iterations), r.bytes_per_op);
+    Timings::const_iterator base = baseline.find(b.name);
+    if (base != baseline.end()) {
+      std::printf(" %+11.1f%%", (r.ns_per_op / base->second - 1) * 100);
+      if (r.ns_per_op > base->second * threshold) {
+        std::printf(" regressed");
+        ++num_regressions;
+      }
+    }
+    std::printf("\n");
+    std::fflush(stdout);
+  }
+  if (save_filename && !WriteTimings(save_filename, timings)) {
+    std::fprintf(stderr, "cannot write %s\n", save_filename);
+    return 1;
+  }
+  if (num_regressions != 0) {
+    std::printf("%d benchmark(s) regressed by more than %.0f%%\n",
+        num_regressions, (threshold - 1) * 100);
+    return 1;
+  }
+  return 0;
+}
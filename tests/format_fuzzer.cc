@@ -0,0 +1,569 @@
+/*
+ Differential fuzzer for the format string parser.
+
+ Each input is decoded into a list of arguments and a format string which
+ is formatted by the single-pass interpreter, by a precompiled format,
+ through the format cache and by FormattedSize. All of them must produce
+ the same output or report the same error. Inputs with the high bit of
+ the first byte set are instead decoded into a single format specifier
+ that has a printf equivalent, and the output is compared with snprintf.
+ Any difference is printed to stderr before aborting.
+
+ The input decoding is as follows:
+
+   differential: <num_args> (<type> <value>)* <format string>
+   printf:       <mode> <flags> <width> <precision> <type> <value>
+
+ where integer and floating-point values take 8 bytes and a string value
+ is a byte with its length followed by its characters. Missing bytes are
+ read as zeros, so every input is valid.
+
+ Usage: format_fuzzer [<file>...]
+        format_fuzzer --random=<iterations> [--seed=<seed>]
+
+ Files are run as inputs, or stdin if there are no arguments which is
+ suitable for AFL. The random mode runs pseudo-random inputs biased
+ towards format string syntax. If FMT_LIBFUZZER is defined, main is not
+ defined and the program should be linked with libFuzzer.
+
+ Copyright (c) 2012, Victor Zverovich
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice, this
+    list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../format.h"
+
+#if _MSC_VER
+# undef snprintf
+# define snprintf _snprintf
+#endif
+
+using fmt::internal::LongLong;
+using fmt::internal::ULongLong;
+
+namespace {
+
+// Reads values from the fuzzer input. Reading past the end gives zeros.
+class Input {
+ private:
+  const unsigned char *data_;
+  std::size_t size_;
+
+ public:
+  Input(const unsigned char *data, std::size_t size)
+  : data_(data), size_(size) {}
+
+  unsigned char ReadByte() {
+    if (size_ == 0)
+      return 0;
+    --size_;
+    return *data_++;
+  }
+
+  ULongLong ReadULongLong() {
+    ULongLong value = 0;
+    for (int i = 0; i < 8; ++i)
+      value |= static_cast<ULongLong>(ReadByte()) << (i * 8);
+    return value;
+  }
+
+  double ReadDouble() {
+    ULongLong bits = ReadULongLong();
+    double value = 0;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  std::string ReadString(std::size_t size) {
+    size = std::min(size, size_);
+    std::string s(reinterpret_cast<const char*>(data_), size);
+    data_ += size;
+    size_ -= size;
+    return s;
+  }
+
+  std::string ReadRest() { return ReadString(size_); }
+};
+
+// A format argument decoded from the input.
+struct FuzzArg {
+  enum Type {
+    INT, UINT, LONG_LONG, ULONG_LONG, DOUBLE, LONG_DOUBLE, CHAR, STRING,
+    NUM_TYPES
+  };
+  Type type;
+  ULongLong bits;
+  double double_value;
+  std::string string_value;
+
+  explicit FuzzArg(Type t = INT) : type(t), bits(0), double_value(0) {}
+};
+
+typedef std::vector<FuzzArg> FuzzArgs;
+
+// Adds arguments starting from index to an inserter. The inserter
+// returned for a string argument formats when it is destroyed at the end
+// of the full expression that adds it, so the arguments are added by
+// nested calls to keep them all alive until the last one is added.
+// If count is not null, the output is counted with FormattedSize instead.
+void AddArgs(const fmt::internal::ArgInserter &const_inserter,
+             const FuzzArgs &args, std::size_t index, std::size_t *count) {
+  // The inserter may be a temporary, but adding arguments to it requires
+  // a non-const reference.
+  fmt::internal::ArgInserter &inserter =
+      const_cast<fmt::internal::ArgInserter&>(const_inserter);
+  if (index == args.size()) {
+    if (count)
+      *count = FormattedSize(inserter);
+    return;
+  }
+  const FuzzArg &arg = args[index++];
+  switch (arg.type) {
+  case FuzzArg::INT:
+    AddArgs(inserter << static_cast<int>(arg.bits), args, index, count);
+    break;
+  case FuzzArg::UINT:
+    AddArgs(inserter << static_cast<unsigned>(arg.bits), args, index, count);
+    break;
+  case FuzzArg::LONG_LONG:
+    AddArgs(inserter << static_cast<LongLong>(arg.bits), args, index, count);
+    break;
+  case FuzzArg::ULONG_LONG:
+    AddArgs(inserter << arg.bits, args, index, count);
+    break;
+  case FuzzArg::DOUBLE:
+    AddArgs(inserter << arg.double_value, args, index, count);
+    break;
+  case FuzzArg::LONG_DOUBLE:
+    AddArgs(inserter << static_cast<long double>(arg.double_value),
+            args, index, count);
+    break;
+  case FuzzArg::CHAR:
+    AddArgs(inserter << static_cast<char>(arg.bits), args, index, count);
+    break;
+  default:
+    AddArgs(inserter << arg.string_value, args, index, count);
+    break;
+  }
+}
+
+// Formats arguments with a format string or a precompiled format.
+template <typename Format>
+void FormatArgs(fmt::Formatter &f, const Format &format,
+                const FuzzArgs &args, std::size_t *count = 0) {
+  AddArgs(f(format), args, 0, count);
+}
+
+// The output of formatting or the message of the error reported.
+struct Result {
+  bool error;
+  std::string output;
+
+  Result() : error(false) {}
+
+  bool operator==(const Result &other) const {
+    return error == other.error && output == other.output;
+  }
+  bool operator!=(const Result &other) const { return !(*this == other); }
+};
+
+std::string Escape(const std::string &s) {
+  fmt::Formatter f;
+  for (std::size_t i = 0, n = s.size(); i < n; ++i) {
+    unsigned char c = static_cast<unsigned char>(s[i]);
+    if (c == '\\' || c == '"')
+      f("\\{}") << static_cast<char>(c);
+    else if (c < 0x20 || c >= 0x7f)
+      f("\\x{:02x}") << static_cast<unsigned>(c);
+    else
+      f("{}") << static_cast<char>(c);
+  }
+  return f.str();
+}
+
+std::string Describe(const Result &r) {
+  return str(fmt::Format(r.error ? "error \"{}\"" : "\"{}\"")
+      << Escape(r.output));
+}
+
+// Prints both results and the input they were produced from and aborts.
+FMT_NORETURN void ReportMismatch(
+    const char *name, const Result &expected, const Result &actual,
+    const std::string &format, const FuzzArgs &args) {
+  static const char *const TYPE_NAMES[] = {
+    "int", "unsigned", "long long", "unsigned long long",
+    "double", "long double", "char", "string"
+  };
+  fmt::Formatter f;
+  f("{} mismatch for format \"{}\"\n") << name << Escape(format);
+  for (std::size_t i = 0, n = args.size(); i < n; ++i) {
+    const FuzzArg &arg = args[i];
+    f("  arg {}: {} ") << i << TYPE_NAMES[arg.type];
+    if (arg.type == FuzzArg::STRING)
+      f("\"{}\"\n") << Escape(arg.string_value);
+    else if (arg.type == FuzzArg::DOUBLE || arg.type == FuzzArg::LONG_DOUBLE)
+      f("{}\n") << arg.double_value;
+    else
+      f("0x{:x}\n") << arg.bits;
+  }
+  f("  expected {}\n  actual   {}\n") << Describe(expected) << Describe(actual);
+  std::fwrite(f.data(), 1, f.size(), stderr);
+  std::abort();
+}
+
+void Check(const char *name, const Result &expected, const Result &actual,
+           const std::string &format, const FuzzArgs &args) {
+  if (expected != actual)
+    ReportMismatch(name, expected, actual, format, args);
+}
+
+template <typename Format>
+Result Run(const Format &format, const FuzzArgs &args) {
+  Result result;
+  try {
+    fmt::Formatter f;
+    FormatArgs(f, format, args);
+    result.output = f.str();
+  } catch (const fmt::FormatError &e) {
+    result.error = true;
+    result.output = e.what();
+  }
+  return result;
+}
+
+// Formats with a precompiled format. Syntax errors are reported by the
+// CompiledFormat constructor before any argument is checked, while the
+// interpreter reports the first error in the format string. So if the
+// format is invalid, only the presence of an error with the interpreter
+// is checked.
+Result RunCompiled(const std::string &format, const FuzzArgs &args,
+                   const Result &expected) {
+  Result result;
+  try {
+    fmt::CompiledFormat compiled_format(format);
+    return Run(compiled_format, args);
+  } catch (const fmt::FormatError &e) {
+    result.error = true;
+    result.output = expected.error ? expected.output : e.what();
+  }
+  return result;
+}
+
+// Compares all ways of formatting a format string with the interpreter.
+void FuzzFormat(Input &in) {
+  FuzzArgs args(in.ReadByte() % 5);
+  for (std::size_t i = 0, n = args.size(); i < n; ++i) {
+    FuzzArg &arg = args[i];
+    arg.type = static_cast<FuzzArg::Type>(in.ReadByte() % FuzzArg::NUM_TYPES);
+    if (arg.type == FuzzArg::STRING)
+      arg.string_value = in.ReadString(in.ReadByte() % 32);
+    else if (arg.type == FuzzArg::DOUBLE || arg.type == FuzzArg::LONG_DOUBLE)
+      arg.double_value = in.ReadDouble();
+    else
+      arg.bits = in.ReadULongLong();
+  }
+  // Format strings are null-terminated, so the format ends at the first
+  // null character.
+  std::string format = in.ReadRest();
+  format = format.c_str();
+
+  Result expected = Run(format.c_str(), args);
+  Check("compiled format", expected, RunCompiled(format, args, expected),
+        format, args);
+
+  Result count;
+  try {
+    fmt::Formatter f;
+    std::size_t size = 0;
+    FormatArgs(f, format.c_str(), args, &size);
+    count.output = str(fmt::Format("{}") << size);
+  } catch (const fmt::FormatError &e) {
+    count.error = true;
+    count.output = e.what();
+  }
+  Result expected_count = expected;
+  if (!expected.error)
+    expected_count.output = str(fmt::Format("{}") << expected.output.size());
+  Check("FormattedSize", expected_count, count, format, args);
+
+#if FMT_USE_THREAD_LOCAL
+  // The first use of the format string interprets and caches it and
+  // the second one uses the cached format.
+  fmt::FormatCache &cache = fmt::GetThreadFormatCache();
+  cache.set_max_size(1);
+  Result miss = Run(format.c_str(), args);
+  Result hit = Run(format.c_str(), args);
+  cache.set_max_size(0);
+  Check("format cache miss", expected, miss, format, args);
+  Check("format cache hit", expected, hit, format, args);
+#endif
+}
+
+// Compares formatting of a single value with the equivalent printf
+// conversion. Combinations of flags with different meanings or that are
+// errors in one of the libraries are avoided.
+void FuzzPrintf(Input &in) {
+  enum {
+    LEFT = 1, PLUS = 2, SPACE = 4, HASH = 8, ZERO = 16
+  };
+  static const char TYPES[] = "dxXoeEfFgGs";
+  unsigned flags = in.ReadByte();
+  unsigned width = in.ReadByte() % 32;
+  int precision = in.ReadByte() % 24;
+  if (precision >= 20)
+    precision = -1;
+  char type = TYPES[in.ReadByte() % (sizeof(TYPES) - 1)];
+
+  FuzzArgs args(1);
+  FuzzArg &arg = args[0];
+  bool is_double = std::strchr("eEfFgG", type) != 0;
+  if (type == 'd') {
+    arg.type = flags & 0x80 ? FuzzArg::LONG_LONG : FuzzArg::INT;
+    arg.bits = in.ReadULongLong();
+  } else if (type == 's') {
+    arg.type = FuzzArg::STRING;
+    arg.string_value = in.ReadString(in.ReadByte() % 32).c_str();
+  } else if (is_double) {
+    arg.type = FuzzArg::DOUBLE;
+    arg.double_value = in.ReadDouble();
+    // printf ignores the zero flag for NaN and infinity.
+    if (arg.double_value - arg.double_value != 0)
+      flags &= ~ZERO;
+  } else {
+    arg.type = flags & 0x80 ? FuzzArg::ULONG_LONG : FuzzArg::UINT;
+    arg.bits = in.ReadULongLong();
+    // printf omits the prefix of zero and format does not.
+    if (arg.bits == 0)
+      flags &= ~HASH;
+  }
+  if (type == 's') {
+    flags &= LEFT;
+    precision = -1;
+  } else if (!is_double) {
+    precision = -1;
+    if (type != 'd')
+      flags &= ~(PLUS | SPACE);
+    else
+      flags &= ~HASH;
+  }
+  if (flags & PLUS)
+    flags &= ~SPACE;
+  if (flags & LEFT)
+    flags &= ~ZERO;
+
+  fmt::Formatter format, printf_format;
+  format("{{:");
+  printf_format("%");
+  if (flags & LEFT) {
+    format("<");
+    printf_format("-");
+  } else if (type == 's') {
+    format(">");
+  }
+  static const char FLAG_CHARS[] = "+ #0";
+  for (unsigned i = 0; i < 4; ++i) {
+    if ((flags & (PLUS << i)) != 0) {
+      format("{}") << FLAG_CHARS[i];
+      printf_format("{}") << FLAG_CHARS[i];
+    }
+  }
+  if (width != 0) {
+    format("{}") << width;
+    printf_format("{}") << width;
+  }
+  if (precision >= 0) {
+    format(".{}") << precision;
+    printf_format(".{}") << precision;
+  }
+  if (arg.type == FuzzArg::LONG_LONG || arg.type == FuzzArg::ULONG_LONG)
+    printf_format("ll");
+  format("{}}}") << type;
+  printf_format("{}") << type;
+
+  char buffer[256];
+  const char *pf = printf_format.c_str();
+  int size = 0;
+  switch (arg.type) {
+  case FuzzArg::INT:
+    size = snprintf(buffer, sizeof(buffer), pf, static_cast<int>(arg.bits));
+    break;
+  case FuzzArg::UINT:
+    size = snprintf(
+        buffer, sizeof(buffer), pf, static_cast<unsigned>(arg.bits));
+    break;
+  case FuzzArg::LONG_LONG:
+    size = snprintf(
+        buffer, sizeof(buffer), pf, static_cast<LongLong>(arg.bits));
+    break;
+  case FuzzArg::ULONG_LONG:
+    size = snprintf(buffer, sizeof(buffer), pf, arg.bits);
+    break;
+  case FuzzArg::DOUBLE:
+    size = snprintf(buffer, sizeof(buffer), pf, arg.double_value);
+    break;
+  default:
+    size = snprintf(buffer, sizeof(buffer), pf, arg.string_value.c_str());
+    break;
+  }
+  // Outputs that do not fit in the buffer, such as large numbers with
+  // %f, are compared with the interpreter only.
+  std::string format_str = format.str();
+  Result expected = Run(format_str.c_str(), args);
+  if (size >= 0 && static_cast<std::size_t>(size) < sizeof(buffer)) {
+    Result printf_result;
+    printf_result.output.assign(buffer, size);
+    Check(pf, printf_result, expected, format_str, args);
+  }
+  Check("compiled format", expected, RunCompiled(format_str, args, expected),
+        format_str, args);
+}
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const unsigned char *data,
+                                      std::size_t size) {
+  Input in(data, size);
+  if (size != 0 && (data[0] & 0x80) != 0) {
+    in.ReadByte();
+    FuzzPrintf(in);
+  } else {
+    FuzzFormat(in);
+  }
+  return 0;
+}
+
+#ifndef FMT_LIBFUZZER
+namespace {
+
+bool ReadFile(std::FILE *file, std::string &data) {
+  char buffer[4096];
+  data.clear();
+  while (std::size_t n = std::fread(buffer, 1, sizeof(buffer), file))
+    data.append(buffer, n);
+  return !std::ferror(file);
+}
+
+// A linear congruential generator giving the same inputs on all platforms.
+class Random {
+ private:
+  ULongLong state_;
+
+ public:
+  explicit Random(ULongLong seed) : state_(seed) {}
+
+  unsigned operator()(unsigned n) {
+    state_ = state_ * 6364136223846793005ULL + 1442695040888963407ULL;
+    return static_cast<unsigned>(state_ >> 33) % n;
+  }
+};
+
+// Generates an input where most characters of the format string are
+// taken from the format specification syntax.
+void GenerateInput(Random &random, std::string &data) {
+  static const char SYNTAX[] = "{{{}}}:::<>^=+- #0123456789.,_xXodeEfFgGsc";
+  data.clear();
+  if (random(4) == 0) {
+    // A printf comparison input.
+    data.push_back(static_cast<char>(0x80 | random(0x80)));
+    for (std::size_t i = 0, n = 4 + random(40); i < n; ++i)
+      data.push_back(static_cast<char>(random(256)));
+    return;
+  }
+  std::size_t num_args = random(5);
+  data.push_back(static_cast<char>(num_args));
+  for (std::size_t i = 0; i < num_args; ++i) {
+    unsigned type = random(FuzzArg::NUM_TYPES);
+    data.push_back(static_cast<char>(type));
+    std::size_t size = type == FuzzArg::STRING ? 1 + random(8) : 8;
+    if (type == FuzzArg::STRING)
+      data.push_back(static_cast<char>(size - 1));
+    for (std::size_t j = 0; j < size - (type == FuzzArg::STRING); ++j) {
+      // Small numbers are more likely to be valid precisions.
+      data.push_back(static_cast<char>(
+          j == 0 || random(2) != 0 ? random(256) : random(3) * 255));
+    }
+  }
+  for (std::size_t i = 0, n = random(24); i < n; ++i) {
+    data.push_back(random(8) != 0 ?
+        SYNTAX[random(sizeof(SYNTAX) - 1)] : static_cast<char>(random(256)));
+  }
+}
+
+void RunInput(const std::string &data) {
+  LLVMFuzzerTestOneInput(
+      reinterpret_cast<const unsigned char*>(data.data()), data.size());
+}
+}
+
+int main(int argc, char **argv) {
+  const char RANDOM[] = "--random=";
+  const char SEED[] = "--seed=";
+  unsigned long num_iterations = 0;
+  unsigned long seed = 0;
+  std::vector<const char*> files;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    if (std::strncmp(arg, RANDOM, sizeof(RANDOM) - 1) == 0)
+      num_iterations = std::strtoul(arg + sizeof(RANDOM) - 1, 0, 10);
+    else if (std::strncmp(arg, SEED, sizeof(SEED) - 1) == 0)
+      seed = std::strtoul(arg + sizeof(SEED) - 1, 0, 10);
+    else
+      files.push_back(arg);
+  }
+  std::string data;
+  if (num_iterations != 0) {
+    Random random(seed);
+    for (unsigned long i = 0; i < num_iterations; ++i) {
+      GenerateInput(random, data);
+      RunInput(data);
+    }
+    std::printf("%lu inputs passed\n", num_iterations);
+    return 0;
+  }
+  if (files.empty()) {
+    if (!ReadFile(stdin, data)) {
+      std::fprintf(stderr, "cannot read stdin\n");
+      return 1;
+    }
+    RunInput(data);
+    return 0;
+  }
+  for (std::size_t i = 0, n = files.size(); i < n; ++i) {
+    std::FILE *file = std::fopen(files[i], "rb");
+    bool ok = file && ReadFile(file, data);
+    if (file)
+      std::fclose(file);
+    if (!ok) {
+      std::fprintf(stderr, "cannot read %s\n", files[i]);
+      return 1;
+    }
+    RunInput(data);
+  }
+  return 0;
+}
+#endif
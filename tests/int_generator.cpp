@@ -145,6 +145,19 @@ int main()
         cout << "format:\t\t" << t.elapsed() << " [s]" << flush << endl;
     }
 
+    // test the format library batch API which converts the whole column
+    // into a single buffer
+    {
+        util::high_resolution_timer t;
+
+        //[karma_int_performance_format_ints
+        fmt::Formatter format;
+        format.FormatInts(&v[0], &v[0] + v.size(), '\n');
+        //]
+
+        cout << "FormatInts:\t" << t.elapsed() << " [s]" << flush << endl;
+    }
+
     return 0;
 }
 